@@ -41,7 +41,7 @@ local action_names = {
   -- int arg, 1 buffer pos:
   "DISP",  "IMM_S", "IMM_B", "IMM_W", "IMM_D",  "IMM_WB", "IMM_DB",
   -- action arg (1 byte), int arg, 1 buffer pos (reg/num):
-  "VREG", "SPACE", -- !x64: VREG support NYI.
+  "VREG", "SPACE",
   -- ptrdiff_t arg, 1 buffer pos (address): !x64
   "SETLABEL", "REL_A",
   -- action arg (1 byte) or int arg, 2 buffer pos (link, offset):
@@ -460,8 +460,15 @@ local function wputszarg(sz, n)
 end
 
 -- Put multi-byte opcode with operand-size dependent modifications.
+-- Returns the number of opcode bytes that follow the REX prefix, if any.
 local function wputop(sz, op, rex)
-  local r
+  local r, nrex
+  local function wputrex()
+    wputb(64 + band(rex, 15)); rex = 0; nrex = 0
+  end
+  local function wputopb(n)
+    wputb(n); if nrex then nrex = nrex + 1 end
+  end
   if rex ~= 0 and not x64 then werror("bad operand size") end
   if sz == "w" then wputb(102) end
   -- Needs >32 bit numbers, but only for crc32 eax, word [ebx]
@@ -471,20 +478,28 @@ local function wputop(sz, op, rex)
     if rex ~= 0 then
       local opc3 = band(op, 0xffff00)
       if opc3 == 0x0f3a00 or opc3 == 0x0f3800 then
-	wputb(64 + band(rex, 15)); rex = 0
+	wputrex()
       end
     end
-    wputb(shr(op, 16)); op = band(op, 0xffff)
+    wputopb(shr(op, 16)); op = band(op, 0xffff)
   end
   if op >= 256 then
     local b = shr(op, 8)
-    if b == 15 and rex ~= 0 then wputb(64 + band(rex, 15)); rex = 0 end
-    wputb(b)
+    if b == 15 and rex ~= 0 then wputrex() end
+    wputopb(b)
     op = band(op, 255)
   end
-  if rex ~= 0 then wputb(64 + band(rex, 15)) end
+  if rex ~= 0 then wputrex() end
   if sz == "b" then op = op - 1 end
-  wputb(op)
+  wputopb(op)
+  return nrex
+end
+
+-- Put variable register action. The action argument byte holds the kind
+-- of the register field and, on x64, how many bytes back the REX prefix
+-- is so that registers r8-r15 can set its extension bit.
+local function wvreg(vreg, kind, back)
+  waction("VREG", vreg); wputxb(kind + shl(back or 0, 2))
 end
 
 -- Put ModRM or SIB formatted byte.
@@ -493,8 +508,11 @@ local function wputmodrm(m, s, rm, vs, vrm)
   wputb(shl(m, 6) + shl(band(s, 7), 3) + band(rm, 7))
 end
 
--- Put ModRM/SIB plus optional displacement.
-local function wputmrmsib(t, imark, s, vsreg)
+-- Put ModRM/SIB plus optional displacement. 'nrex' is the number of opcode
+-- bytes after the REX prefix, if there is one.
+local function wputmrmsib(t, imark, s, vsreg, nrex)
+  local mback = nrex and nrex + 2
+  local sback = nrex and nrex + 3
   local vreg, vxreg
   local reg, xreg = t.reg, t.xreg
   if reg and reg < 0 then reg = 0; vreg = t.vreg end
@@ -504,8 +522,8 @@ local function wputmrmsib(t, imark, s, vsreg)
   -- Register mode.
   if sub(t.mode, 1, 1) == "r" then
     wputmodrm(3, s, reg)
-    if vsreg then waction("VREG", vsreg); wputxb(2) end
-    if vreg then waction("VREG", vreg); wputxb(0) end
+    if vsreg then wvreg(vsreg, 2, mback) end
+    if vreg then wvreg(vreg, 0, mback) end
     return
   end
 
@@ -519,9 +537,9 @@ local function wputmrmsib(t, imark, s, vsreg)
       -- [xreg*xsc+disp] -> (0, s, esp) (xsc, xreg, ebp)
       wputmodrm(0, s, 4)
       if imark == "I" then waction("MARK") end
-      if vsreg then waction("VREG", vsreg); wputxb(2) end
+      if vsreg then wvreg(vsreg, 2, mback) end
       wputmodrm(t.xsc, xreg, 5)
-      if vxreg then waction("VREG", vxreg); wputxb(3) end
+      if vxreg then wvreg(vxreg, 3, sback) end
     else
       -- Pure 32 bit displacement.
       if x64 and tdisp ~= "table" then
@@ -533,7 +551,7 @@ local function wputmrmsib(t, imark, s, vsreg)
 	wputmodrm(0, s, 5) -- [disp|rip-label] -> (0, s, ebp)
 	if imark == "I" then waction("MARK") end
       end
-      if vsreg then waction("VREG", vsreg); wputxb(2) end
+      if vsreg then wvreg(vsreg, 2, mback) end
     end
     if riprel then -- Emit rip-relative displacement.
       if match("UWSiI", imark) then
@@ -561,16 +579,16 @@ local function wputmrmsib(t, imark, s, vsreg)
   if xreg or band(reg, 7) == 4 then
     wputmodrm(m or 2, s, 4) -- ModRM.
     if m == nil or imark == "I" then waction("MARK") end
-    if vsreg then waction("VREG", vsreg); wputxb(2) end
+    if vsreg then wvreg(vsreg, 2, mback) end
     wputmodrm(t.xsc or 0, xreg or 4, reg) -- SIB.
-    if vxreg then waction("VREG", vxreg); wputxb(3) end
-    if vreg then waction("VREG", vreg); wputxb(1) end
+    if vxreg then wvreg(vxreg, 3, sback) end
+    if vreg then wvreg(vreg, 1, sback) end
   else
     wputmodrm(m or 2, s, reg) -- ModRM.
     if (imark == "I" and (m == 1 or m == 2)) or
        (m == nil and (vsreg or vreg)) then waction("MARK") end
-    if vsreg then waction("VREG", vsreg); wputxb(2) end
-    if vreg then waction("VREG", vreg); wputxb(1) end
+    if vsreg then wvreg(vsreg, 2, mback) end
+    if vreg then wvreg(vreg, 1, mback) end
   end
 
   -- Put displacement.
@@ -1512,18 +1530,23 @@ local function dopattern(pat, args, sz, op, needrex)
       if t.xreg and t.xreg > 7 then rex = rex + 2 end
       if s > 7 then rex = rex + 4 end
       if needrex then rex = rex + 16 end
-      wputop(szov, opcode, rex); opcode = nil
+      -- Variable registers may need the REX prefix to reach r8-r15.
+      if x64 and rex < 16 and (t.vreg or t.vxreg or (addin and addin.vreg)) then
+	rex = rex + 16
+      end
+      local nrex = wputop(szov, opcode, rex); opcode = nil
       local imark = sub(pat, -1) -- Force a mark (ugly).
       -- Put ModRM/SIB with regno/last digit as spare.
-      wputmrmsib(t, imark, s, addin and addin.vreg)
+      wputmrmsib(t, imark, s, addin and addin.vreg, nrex)
       addin = nil
     else
       if opcode then -- Flush opcode.
 	if szov == "q" and rex == 0 then rex = rex + 8 end
 	if needrex then rex = rex + 16 end
 	if addin and addin.reg == -1 then
-	  wputop(szov, opcode - 7, rex)
-	  waction("VREG", addin.vreg); wputxb(0)
+	  if x64 and rex < 16 then rex = rex + 16 end
+	  local nrex = wputop(szov, opcode - 7, rex)
+	  wvreg(addin.vreg, 0, nrex and nrex + 1)
 	else
 	  if addin and addin.reg > 7 then rex = rex + 1 end
 	  wputop(szov, opcode, rex)
@@ -1708,8 +1731,8 @@ if x64 then
 	rex = a.reg > 7 and 9 or 8
       end
     end
-    wputop(sz, opcode, rex)
-    if vreg then waction("VREG", vreg); wputxb(0) end
+    local nrex = wputop(sz, opcode, rex)
+    if vreg then wvreg(vreg, 0, nrex + 1) end
     waction("IMM_D", format("(unsigned int)(%s)", op64))
     waction("IMM_D", format("(unsigned int)((%s)>>32)", op64))
   end
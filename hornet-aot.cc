@@ -0,0 +1,120 @@
+#include "hornet/aot.hh"
+#include "hornet/java.hh"
+#include "hornet/vm.hh"
+#include "hornet/zip.hh"
+
+#include <libgen.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <jni.h>
+
+static const char *program;
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: %s [-options] jarfile output\n",
+            program
+           );
+
+    exit(EXIT_FAILURE);
+}
+
+// Load every class in the JAR file. Classes that do not load are skipped.
+static std::vector<std::shared_ptr<hornet::klass>> load_classes(const char *jar)
+{
+    std::vector<std::shared_ptr<hornet::klass>> klasses;
+
+    auto zip = hornet::zip_open(jar);
+    if (!zip) {
+        fprintf(stderr, "error: Cannot open '%s'.\n", jar);
+        exit(EXIT_FAILURE);
+    }
+
+    for (unsigned long i = 0; i < zip->nr_entries; i++) {
+        std::string filename{zip->entries[i].filename};
+        auto suffix = filename.rfind(".class");
+        if (suffix == std::string::npos || suffix + strlen(".class") != filename.size()) {
+            continue;
+        }
+        auto class_name = filename.substr(0, suffix);
+
+        auto klass = hornet::system_loader()->load_class(class_name.c_str());
+        if (!klass) {
+            fprintf(stderr, "warning: Cannot load class '%s'.\n", class_name.c_str());
+            hornet::thread::current()->exception = nullptr;
+            continue;
+        }
+        klasses.push_back(klass);
+    }
+
+    hornet::zip_close(zip);
+
+    return klasses;
+}
+
+int main(int argc, char *argv[])
+{
+    JavaVMInitArgs vm_args;
+    JNIEnv *env;
+    JavaVM *vm;
+
+    program = basename(argv[0]);
+
+    vm_args.version = JNI_VERSION_1_6;
+
+    if (JNI_GetDefaultJavaVMInitArgs(&vm_args) != JNI_OK) {
+        fprintf(stderr, "error: Cannot get default VM init arguments.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    JavaVMOption options[argc + 1];
+    std::string classpath;
+    int idx, nr_options = 0;
+
+    for (idx = 1; idx < argc; idx++) {
+        if (*argv[idx] != '-')
+            break;
+
+        if (!strcmp(argv[idx], "-classpath") || !strcmp(argv[idx], "-cp")) {
+            idx++;
+            if (idx >= argc) {
+                usage();
+            }
+            classpath = std::string{argv[idx]} + ":";
+            continue;
+        }
+
+        options[nr_options++].optionString = argv[idx];
+    }
+
+    if (argc - idx != 2)
+        usage();
+
+    auto jar = argv[idx];
+    auto output = argv[idx + 1];
+
+    // Classes outside the JAR file, such as the class library, are looked
+    // up from the class path.
+    classpath += jar;
+    options[nr_options++].optionString = const_cast<char *>("-cp");
+    options[nr_options++].optionString = const_cast<char *>(classpath.c_str());
+
+    vm_args.nOptions = nr_options;
+    vm_args.options  = options;
+
+    if (JNI_CreateJavaVM(&vm, reinterpret_cast<void **>(&env), &vm_args) != JNI_OK) {
+        fprintf(stderr, "error: Cannot create a virtual machine.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    auto klasses = load_classes(jar);
+
+    auto ok = hornet::aot_compile(klasses, output);
+
+    vm->DestroyJavaVM();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,82 @@
+#ifndef HORNET_AOT_HH
+#define HORNET_AOT_HH
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hornet {
+
+struct klass;
+
+//
+// Ahead-of-time compiled code is a shared object built by hornet-aot. It
+// exports 'hornet_aot_library', which lists the compiled classes with the
+// i2c adapters of their methods. The tables are plain C layout so that the
+// compiler can emit them as LLVM constants.
+//
+// Addresses of VM objects are not known until run time, so the code loads
+// them from slots that the VM fills in from relocations when it binds a
+// class. Some relocations only record a value the code depends on, such as
+// a field offset, and binding fails if the VM disagrees.
+//
+static constexpr uint32_t aot_version = 1;
+
+enum aot_reloc_kind : uint32_t {
+    aot_reloc_klass,            // klass*
+    aot_reloc_method,           // method*
+    aot_reloc_static_field,     // address of the value of a static field
+    aot_reloc_runtime,          // runtime symbol, by name
+    aot_reloc_field_offset,     // check: offset of an instance field
+    aot_reloc_instance_size,    // check: instance size of a class
+};
+
+struct aot_reloc {
+    uint32_t    kind;
+    uint32_t    value;
+    const char* klass;
+    const char* name;
+    const char* descriptor;
+    void**      slot;
+};
+
+struct aot_method {
+    const char* name;
+    const char* descriptor;
+    void*       entry_point;
+};
+
+struct aot_class {
+    const char*       name;
+    // Hash of the class file the code was compiled from.
+    uint64_t          hash;
+    uint32_t          nr_methods;
+    uint32_t          nr_relocs;
+    const aot_method* methods;
+    const aot_reloc*  relocs;
+};
+
+struct aot_library {
+    uint32_t         version;
+    uint32_t         nr_classes;
+    const aot_class* classes;
+};
+
+// Load a library for -XX:AOTLibrary=<path>. Prints an error and returns
+// false if it cannot be used.
+bool aot_load(const char* path);
+
+// Install the AOT-compiled code of a newly loaded class, if the library has
+// code for this exact class file. The relocations are resolved when one of
+// its methods is first called.
+void aot_bind(klass* klass);
+
+#ifdef CONFIG_HAVE_LLVM
+// Compile the methods of 'klasses' into the shared object 'output'.
+bool aot_compile(const std::vector<std::shared_ptr<klass>>& klasses, const std::string& output);
+#endif
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef HORNET_CODE_CACHE_HH
+#define HORNET_CODE_CACHE_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace hornet {
+
+extern size_t reserved_code_cache_size;
+extern bool print_code_cache;
+
+// Compiled code calls other compiled code with 32-bit displacements, so the
+// whole cache has to fit in a 2 GiB window.
+constexpr size_t max_code_cache_size = 2ULL * 1024 * 1024 * 1024;
+
+//
+// Executable memory for JIT-compiled code.
+//
+// The cache grows in segments of hugepage size up to a fixed capacity. Each
+// segment is mapped twice: compilers encode code through a writable view
+// and the code runs from an executable view, so that no page is ever both
+// writable and executable. The executable views are carved out of one
+// address range that is reserved up front.
+//
+// Compiler threads bump-allocate from chunks of their own and only take the
+// cache lock to get a new chunk. Freed code goes to a free list that later
+// allocations are served from first. Adjacent free blocks are merged.
+//
+class code_cache {
+public:
+    explicit code_cache(size_t capacity);
+    ~code_cache();
+
+    // Allocate space for 'size' bytes of code and return its executable
+    // address, or nullptr if the cache is full.
+    void* alloc(size_t size);
+
+    // Return code that is no longer reachable to the cache.
+    void free(void* code);
+
+    // Size of the block of code returned by alloc(), which is at least the
+    // size that was asked for.
+    size_t size(const void* code);
+
+    // Return the writable view of executable address 'code'.
+    void* writable(void* code);
+
+    void print_stats(FILE* out);
+
+private:
+    struct segment {
+        char*  exec;
+        char*  write;
+        size_t size;
+    };
+
+    char* alloc_segment(size_t size);
+    char* alloc_free(size_t size);
+    void free_block(char* block, size_t size);
+    void unlink_free(char* block, size_t size);
+    void set_size(char* block, size_t size);
+    segment* lookup_segment(const void* code);
+    bool add_segment();
+
+    uint64_t _generation;
+    std::vector<segment> _segments;
+    size_t _capacity;
+    char* _exec_base;
+    std::atomic<size_t> _nr_segments;
+    char* _next;
+    char* _end;
+
+    // Free blocks by size for allocation and by address for merging.
+    std::multimap<size_t, char*> _free_list;
+    std::map<char*, size_t> _free_blocks;
+    std::atomic<size_t> _free_bytes;
+
+    std::atomic<size_t> _used_bytes;
+    std::atomic<uint64_t> _nr_allocs;
+    std::atomic<uint64_t> _nr_reused;
+    std::atomic<uint64_t> _nr_frees;
+
+    std::mutex _mutex;
+};
+
+}
+
+#endif
@@ -28,6 +28,15 @@ public:
         return start;
     }
 
+    // Offsets of the bump pointer and the limit for compiled code that
+    // allocates inline.
+    static constexpr size_t next_offset() {
+        return offsetof(memory_block, _next);
+    }
+    static constexpr size_t end_offset() {
+        return offsetof(memory_block, _end);
+    }
+
     //
     // Block allocator:
     //
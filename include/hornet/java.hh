@@ -1,6 +1,7 @@
 #ifndef HORNET_JAVA_HH
 #define HORNET_JAVA_HH
 
+#include "hornet/code_cache.hh"
 #include "hornet/zip.hh"
 #include "hornet/vm.hh"
 
@@ -10,11 +11,16 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 #include <mutex>
+#include <queue>
+#include <thread>
+#include <condition_variable>
 #include <stack>
+#include <new>
 
 namespace hornet {
 
@@ -163,6 +169,7 @@ struct attr_info {
 };
 
 struct code_attr : attr_info {
+    uint16_t max_stack;
     uint16_t max_locals;
     char*    code;
     uint32_t code_length;
@@ -198,7 +205,7 @@ private:
     void read_const_method_type();
     void read_const_invoke_dynamic();
 
-    std::shared_ptr<field> read_field_info(constant_pool &constant_pool);
+    std::shared_ptr<field> read_field_info(klass* klass, constant_pool &constant_pool);
     std::shared_ptr<method> read_method_info(klass* klass, constant_pool &constant_pool);
     std::unique_ptr<attr_info> read_attr_info(constant_pool &constant_pool);
     std::unique_ptr<code_attr> read_code_attribute(constant_pool &constant_pool);
@@ -208,6 +215,8 @@ private:
     uint32_t read_u4();
     uint64_t read_u8();
 
+    uint64_t hash() const;
+
     size_t _offset;
     size_t _size;
     char *_data;
@@ -220,6 +229,10 @@ extern bool verbose_verifier;
 bool verify_method(std::shared_ptr<method> method);
 void verifier_stats();
 
+extern bool print_bytecode_ngrams;
+
+void bytecode_ngram_stats();
+
 class classpath_entry {
 public:
     classpath_entry() { }
@@ -266,8 +279,12 @@ public:
     void register_entry(std::string path);
     std::shared_ptr<klass> load_class(const char *class_name);
 private:
+    std::shared_ptr<klass> lookup_class(const char *class_name);
+    std::shared_ptr<klass> define_class(const char *class_name, std::shared_ptr<klass> klass);
     std::shared_ptr<klass> try_to_load_class(const char *class_name);
     std::vector<std::shared_ptr<classpath_entry>> _entries;
+    std::mutex _mutex;
+    std::map<std::string, std::shared_ptr<klass>> _klasses;
 };
 
 class system_loader {
@@ -299,33 +316,204 @@ static inline uint8_t read_opc_u1(char *p)
 
 static inline uint16_t read_opc_u2(char *p)
 {
-    return p[1] << 8 | p[2];
+    return static_cast<uint8_t>(p[1]) << 8 | static_cast<uint8_t>(p[2]);
 }
 
+//
+// An interpreter frame. Frames live in the current thread's Java stack: the
+// local variables come first, followed by the frame itself and the operand
+// stack, which grows upwards. A callee's locals overlap the outgoing
+// arguments on top of the caller's operand stack so that arguments are
+// passed without copying.
+//
 struct frame {
-    frame(uint16_t max_locals)
-       : locals(max_locals), pc(0) {}
+    // Push a frame for a call from native code on top of the Java stack.
+    // The caller fills in the arguments.
+    static frame* enter(method* method) {
+        auto& stack = thread::current()->stack;
+
+        return enter(stack, method, stack.top(), nullptr);
+    }
+
+    // Push a frame for a call from an interpreter frame.
+    static frame* enter(method* method, frame* caller) {
+        auto* locals = caller->sp - method->args_count;
+
+        caller->sp = locals;
+
+        method->spread_args(locals);
+
+        return enter(*caller->_stack, method, locals, caller);
+    }
+
+    // Pop the frame and everything above it off the Java stack.
+    void leave() {
+        _stack->pop(_prev_top);
+    }
 
-    std::vector<value_t> locals;
-    std::stack<value_t>    ostack;
-    uint16_t               pc;
+    frame(const frame&) = delete;
+    frame& operator=(const frame&) = delete;
+
+    void push(value_t value) {
+        *sp++ = value;
+    }
+
+    value_t pop() {
+        return *--sp;
+    }
+
+    value_t peek() const {
+        return sp[-1];
+    }
+
+    // Offset of the operand stack from the locals in value slots. The
+    // interpreter addresses locals and operand stack slots uniformly as
+    // registers relative to the locals.
+    static size_t ostack_offset(const struct method* method);
+
+    struct method* method;
+    // The calling frame if this frame was pushed by the interpreter itself.
+    frame*      caller;
+    // The interpreter's translated code for the method.
+    const char* code;
+    value_t*    locals;
+    value_t*    ostack;
+    value_t*    sp;
+    uint16_t    pc;
+
+private:
+    static frame* enter(java_stack& stack, struct method* method, value_t* locals, frame* caller);
+
+    frame(java_stack& stack, value_t* prev_top, struct method* method, value_t* locals, frame* caller)
+        : method(method)
+        , caller(caller)
+        , code(nullptr)
+        , locals(locals)
+        , ostack(reinterpret_cast<value_t*>(this + 1))
+        , sp(ostack)
+        , pc(0)
+        , _stack(&stack)
+        , _prev_top(prev_top)
+    { }
+
+    java_stack* _stack;
+    value_t*    _prev_top;
 };
 
+constexpr size_t frame_header_slots = (sizeof(frame) + sizeof(value_t) - 1) / sizeof(value_t);
+
+inline size_t frame::ostack_offset(const struct method* method)
+{
+    return method->max_locals + frame_header_slots;
+}
+
+inline frame* frame::enter(java_stack& stack, struct method* method, value_t* locals, frame* caller)
+{
+    auto* header = locals + method->max_locals;
+
+    auto prev_top = stack.push(locals, ostack_offset(method) + method->max_stack);
+
+    return new (header) frame(stack, prev_top, method, locals, caller);
+}
+
 enum class backend_type {
     interp,
     dynasm,
     llvm,
+    tiered,
 };
 
+//
+// Compiled code has a native signature with one value_t argument per Java
+// argument. Adapters generated from the method's signature convert between
+// it and the interpreter's frame layout:
+//
+//  - i2c: loads the arguments from the locals of an interpreter frame and
+//    calls the compiled code. JIT backends return it from compile() and call
+//    it from run().
+//
+//  - c2i: has the native signature and passes the arguments on to
+//    call_interpreter(). Compiled code calls it for methods that have not
+//    been compiled.
+//
+typedef value_t (*i2c_adapter_t)(value_t* locals);
+
+value_t call_interpreter(method* method, value_t* args);
+
+// An on-stack replacement entry point takes the locals of an interpreter
+// frame that is at the entry of a loop with an empty operand stack and
+// runs the rest of the method.
+typedef value_t (*osr_entry_t)(value_t* locals);
+
 class backend {
 public:
     virtual ~backend() { };
-    virtual value_t execute(method* method, frame& frame) = 0;
+
+    value_t execute(method* method, frame& frame);
+
+    // Return the entry point of a method, translating it on first use.
+    void* entry_point(method* method) {
+        auto entry_point = method->entry_point.load(std::memory_order_acquire);
+        if (!entry_point) {
+            entry_point = lookup_entry_point(method);
+        }
+        return entry_point;
+    }
+
+    // Run a method through an entry point returned by compile().
+    virtual value_t run(method* method, void* entry_point, frame& frame) = 0;
+
+    // Called when the Java thread has no frames left on its stack, so that
+    // code that was replaced while it was running can be freed.
+    virtual void quiesce() {
+    }
+
+protected:
+    // Translate a method and return its entry point, or nullptr if the
+    // backend cannot translate it. Called at most once per method with the
+    // backend lock held.
+    virtual void* compile(method* method) = 0;
+
+    // Translate an on-stack replacement entry that starts executing the
+    // method at the loop header at 'bci'. See osr_entry_t.
+    virtual void* compile_osr(method* method, uint16_t bci) {
+        return nullptr;
+    }
+
+    // Free the code of an entry point returned by compile() that was never
+    // published, or that was replaced and can no longer run.
+    virtual void release(void* entry_point) {
+    }
+
+    // The code of an entry point returned by compile() as registered with
+    // register_stack_maps(), or nullptr if it has no stack maps.
+    virtual const void* code(void* entry_point) {
+        return nullptr;
+    }
+
+    // Returns true if the backend registers stack maps for its code, so
+    // that the code can hold references at a safepoint.
+    virtual bool has_stack_maps() const {
+        return false;
+    }
+
+private:
+    void* lookup_entry_point(method* method);
+
+    std::mutex _mutex;
+
+    friend class tiered_backend;
 };
 
 class interp_backend : public backend {
 public:
-    virtual value_t execute(method* method, frame& frame) override;
+    virtual value_t run(method* method, void* entry_point, frame& frame) override;
+
+protected:
+    virtual void* compile(method* method) override;
+
+private:
+    std::vector<std::unique_ptr<char[]>> _code;
 };
 
 struct dasm_State;
@@ -335,25 +523,213 @@ class dynasm_backend : public backend {
 public:
     dynasm_backend();
     ~dynasm_backend();
-    virtual value_t execute(method* method, frame& frame) override;
 
     dasm_State* D;
+
+    virtual value_t run(method* method, void* entry_point, frame& frame) override;
+
+    void* c2i_adapter(method* method);
+
+    // Compiled code calls other methods with a 'call rel32' that starts
+    // out at a resolution stub of the callee. The stub calls this with the
+    // return address of the call. Once the callee has been compiled by this
+    // backend, the call is patched to go straight to it. Until then the
+    // call goes through the callee's c2i adapter.
+    static void* resolve_call(dynasm_backend* backend, method* callee, void* c2i, char* return_address);
+
+protected:
+    virtual void* compile(method* method) override;
+    virtual void* compile_osr(method* method, uint16_t bci) override;
+    virtual void release(void* entry_point) override;
+    virtual const void* code(void* entry_point) override;
+    virtual bool has_stack_maps() const override {
+        return true;
+    }
+
 private:
-    size_t _offset;
-    void* _code;
+    void* encode(size_t& size);
+    void* resolution_stub(method* method);
+    void* compiled_entry_point(method* method);
+    void patch_call(char* return_address, void* target);
+
+    struct patched_call {
+        char* return_address;
+        void* c2i;
+    };
+
+    dasm_State* _adapter_D;
+    code_cache _code_cache;
+    std::map<method*, void*> _c2i_adapters;
+    std::map<method*, void*> _resolution_stubs;
+    // Compiled method of each i2c adapter returned by compile(). Callers
+    // look it up when they resolve a call.
+    std::map<void*, void*> _i2c_targets;
+    // Calls patched by resolve_call(), by the code they call, so that they
+    // can be pointed back at the c2i adapter when the code is released.
+    std::multimap<void*, patched_call> _patched_calls;
+    std::mutex _code_mutex;
 
     friend dynasm_translator;
 };
 
+// Optimization level of the LLVM tier from 0 to 3. It picks the IR pass
+// pipeline and the code generator's level.
+extern unsigned int llvm_opt_level;
+extern bool print_llvm_timing;
+
 class llvm_backend : public backend {
 public:
     llvm_backend();
     ~llvm_backend();
-    virtual value_t execute(method* method, frame& frame) override;
+
+    virtual value_t run(method* method, void* entry_point, frame& frame) override;
+
+    void* c2i_adapter(method* method);
+
+protected:
+    virtual void* compile(method* method) override;
+    virtual void* compile_osr(method* method, uint16_t bci) override;
+
+private:
+    std::map<method*, void*> _c2i_adapters;
+};
+
+//
+// Tiered execution starts every method in the interpreter and promotes it to
+// DynASM (tier 1) and then LLVM (tier 2) once its invocation or back-edge
+// count crosses the thresholds of the next tier. Tiers whose backend is not
+// compiled in are skipped over.
+//
+// Promotions are queued to a pool of compiler threads, hottest method first,
+// and the method keeps running its current code until the new code is
+// installed. With -XX:-BackgroundCompilation the requesting thread waits for
+// the compilation unless it has opted out with thread::block_on_compilation,
+// which -XX:-BlockOnCompilation clears for the Java thread.
+//
+// Backends without stack maps, such as LLVM, are skipped for methods that
+// can hold references (see holds_references()), so that every compiled
+// frame that holds references has stack maps. A safepoint walk through
+// LLVM frames still reports its roots as incomplete.
+//
+// Compiler threads stop at shutdown without compiling the tasks that are
+// still queued. They mark them done so that no thread waits for them.
+//
+constexpr uint8_t max_tier = 2;
+
+struct tier_threshold {
+    uint64_t invocations;
+    uint64_t backedges;
+};
+
+extern tier_threshold tier_thresholds[max_tier + 1];
+extern uint64_t osr_threshold;
+extern bool tiered_compilation;
+extern bool background_compilation;
+extern unsigned int compiler_count;
+extern bool print_compilation;
+
+struct compiled_code {
+    class backend* backend;
+    void*          entry_point;
+    uint8_t        tier;
+};
+
+struct osr_code {
+    osr_code(uint16_t bci, osr_code* next)
+        : entry_point(nullptr)
+        , bci(bci)
+        , next(next)
+    { }
+
+    // Set by the compiler thread. Stays nullptr if the loop cannot be
+    // compiled.
+    std::atomic<osr_entry_t> entry_point;
+    uint16_t    bci;
+    osr_code*   next;
+};
+
+struct compile_task {
+    compile_task(struct method* method, uint8_t tier, osr_code* osr, uint64_t hotness)
+        : method(method)
+        , tier(tier)
+        , osr(osr)
+        , hotness(hotness)
+        , blocking(false)
+        , done(false)
+    { }
+
+    struct method* method;
+    uint8_t   tier;
+    osr_code* osr;
+    uint64_t  hotness;
+    // A thread waits for the task to be done.
+    bool      blocking;
+    bool      done;
+};
+
+struct compile_task_order {
+    bool operator()(const std::shared_ptr<compile_task>& a, const std::shared_ptr<compile_task>& b) const {
+        return a->hotness < b->hotness;
+    }
+};
+
+class tiered_backend : public interp_backend {
+public:
+    tiered_backend();
+    ~tiered_backend();
+
+    virtual value_t run(method* method, void* entry_point, frame& frame) override;
+    virtual void quiesce() override;
+
+    void promote(method* method, uint8_t tier);
+
+    // Return the OSR entry point for the loop at 'bci', compiling it on first
+    // use. Returns nullptr if no backend can compile the loop.
+    osr_entry_t osr_entry(method* method, uint16_t bci);
+
+private:
+    void submit(std::shared_ptr<compile_task> task);
+    void compiler_thread();
+    void compile(compile_task& task);
+    bool install(method* method, backend* backend, void* entry_point, uint8_t tier);
+    void reclaim();
+
+    std::unique_ptr<backend> _tiers[max_tier + 1];
+    // Backends are not thread-safe, so each tier compiles one method at a time.
+    std::mutex _tier_locks[max_tier + 1];
+
+    std::vector<std::unique_ptr<compiled_code>> _compiled;
+    // Code replaced by a higher tier, freed by reclaim() or quiesce().
+    std::vector<compiled_code*> _retired;
+    // Safepoints in a row at which reclaim() could not walk the stack.
+    unsigned int _reclaim_retries;
+    std::vector<std::unique_ptr<osr_code>> _osr;
+    std::mutex _code_mutex;
+
+    std::priority_queue<std::shared_ptr<compile_task>,
+                        std::vector<std::shared_ptr<compile_task>>,
+                        compile_task_order> _queue;
+    std::mutex _queue_mutex;
+    std::condition_variable _queue_cv;
+    std::condition_variable _done_cv;
+    std::vector<std::thread> _compiler_threads;
+    bool _shutdown;
 };
 
 extern backend* _backend;
 
+inline void check_tier_up(method* method, const method_data* data)
+{
+    auto tier = method->tier.load(std::memory_order_relaxed);
+    if (tier >= max_tier) {
+        return;
+    }
+    auto& next = tier_thresholds[tier + 1];
+    if (data->invocation_count >= next.invocations || data->backedge_count >= next.backedges) {
+        static_cast<tiered_backend*>(_backend)->promote(method, tier + 1);
+    }
+}
+
 }
 
 #endif
@@ -0,0 +1,43 @@
+#ifndef HORNET_PERF_HH
+#define HORNET_PERF_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace hornet {
+
+struct method;
+
+extern bool perf_map;
+extern bool perf_jitdump;
+
+// Start of the code that was generated for bytecode index 'bci'.
+struct perf_line {
+    const void* addr;
+    uint16_t    bci;
+};
+
+// Symbol of a method for profilers: class, name and descriptor.
+std::string perf_symbol(const method* method);
+
+// File that the line info of a method refers to: its class.
+std::string perf_source(const method* method);
+
+//
+// Describe JIT-compiled code to perf(1).
+//
+// With -XX:+PerfMap every piece of code gets a line in /tmp/perf-<pid>.map.
+// With -XX:+PerfJitDump it is also written to /tmp/jit-<pid>.dump with its
+// bytes and line info for 'perf inject --jit'. The lines of a piece of code
+// all refer to 'source'. Line numbers in the dump are bytecode indices plus
+// one, because line zero means "no line" in DWARF.
+//
+void perf_register_code(const std::string& name, const void* code, size_t size,
+                        const std::string& source = std::string(),
+                        const std::vector<perf_line>& lines = std::vector<perf_line>());
+
+}
+
+#endif
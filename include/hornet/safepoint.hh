@@ -0,0 +1,114 @@
+#ifndef HORNET_SAFEPOINT_HH
+#define HORNET_SAFEPOINT_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace hornet {
+
+struct object;
+
+//
+// Object references that are live at a safepoint poll or a call site of
+// compiled code.
+//
+struct stack_map {
+    // Registers, by x86-64 register number, that hold references.
+    std::vector<uint8_t> regs;
+    // Frame slots, by offset from the frame pointer, that hold references.
+    std::vector<int32_t> slots;
+
+    bool empty() const {
+        return regs.empty() && slots.empty();
+    }
+};
+
+//
+// Compiled code polls for safepoints with a load from the poll page. Arming
+// a safepoint protects the page, and the next poll faults and parks the
+// thread until the safepoint is disarmed.
+//
+// Stack maps are looked up by the address of the polling load and by the
+// return address of a call. Code that has stack maps registers one for
+// every poll and call site, including the ones without references, so a pc
+// that has no map is not in such code.
+//
+// The interpreter polls at invocations and loop back-edges with a check of
+// a flag instead, and parks in safepoint_block().
+//
+char* safepoint_poll_page();
+
+extern std::atomic<bool> safepoint_pending;
+
+void safepoint_block();
+
+inline void safepoint_poll()
+{
+    if (safepoint_pending.load(std::memory_order_relaxed)) {
+        safepoint_block();
+    }
+}
+
+void register_stack_maps(const void* code, size_t size, std::map<const void*, stack_map> maps);
+void unregister_stack_maps(const void* code);
+const stack_map* lookup_stack_map(const void* pc);
+
+void safepoint_arm();
+void safepoint_disarm();
+
+// Returns true once a thread is parked at a poll.
+bool safepoint_reached();
+
+//
+// Visit the references of the parked thread.
+//
+// Compiled frames are walked through the frame pointer chain, from the
+// parked frame and from the c2i adapter of every call into the
+// interpreter, and described by stack maps. 'visit' gets the address of
+// each reference so that a moving collector can update it.
+//
+// Interpreter frames are not typed, so every slot of the Java stack goes to
+// 'visit_ambiguous', and a moving collector has to pin the objects they
+// point to instead.
+//
+// Returns false if the thread runs code that has no stack maps, which is
+// the case for LLVM-compiled code. The roots are then incomplete and the
+// safepoint cannot be used to move objects.
+//
+bool safepoint_visit_roots(const std::function<void(object**)>& visit,
+                           const std::function<void(uint64_t*)>& visit_ambiguous);
+
+//
+// Visit the start of the code, as registered with register_stack_maps(), of
+// every compiled frame of the parked thread. Returns false, and may have
+// missed frames, when safepoint_visit_roots() would.
+//
+bool safepoint_visit_code(const std::function<void(const void*)>& visit);
+
+//
+// With -XX:GuaranteedSafepointInterval=<ms> a VM thread brings the Java
+// thread to a safepoint periodically and checks its roots, which exercises
+// the stack maps in the absence of a moving collector.
+//
+// The VM thread also runs the safepoint operations, at every safepoint and
+// at one that safepoint_request() asks for. It is started if there is an
+// interval or an operation.
+//
+extern unsigned int guaranteed_safepoint_interval;
+extern bool print_safepoint_statistics;
+
+// Add an operation before safepoint_start(). It stays until the VM shuts down.
+void safepoint_add_operation(std::function<void()> operation);
+void safepoint_request();
+
+void safepoint_start();
+void safepoint_stop();
+void safepoint_stats();
+
+}
+
+#endif
@@ -10,6 +10,8 @@
 
 namespace hornet {
 
+struct field;
+struct klass;
 struct method;
 
 enum class type {
@@ -57,17 +59,51 @@ struct basic_block {
     }
 };
 
+// An argument of a method: its type and the local variable slot it is
+// passed in.
+struct argument {
+    type     t;
+    uint16_t slot;
+};
+
+// Parse the arguments of a method from its descriptor. Returns false if an
+// argument has a type that translators do not support.
+bool parse_args(const method* method, std::vector<argument>& args);
+
+// The type of the value a non-void method returns.
+type return_type(const method* method);
+
+// Returns true if a method can hold an object reference in a local or on
+// its operand stack: it has an instruction that loads or produces one.
+bool holds_references(method* method);
+
+// Execution counter of a basic block for -XX:+PrintBytecodeNgrams.
+uint64_t* ngram_counter(const method* method, const basic_block& bblock);
+
+// Bytecode index used when there is no on-stack replacement entry.
+constexpr uint16_t no_osr_bci = UINT16_MAX;
+
 class translator {
 public:
-    translator(method* method)
+    translator(method* method, uint16_t osr_bci = no_osr_bci)
         : _method(method)
+        , _osr_bci(osr_bci)
+        , _bci(0)
+        , _bailout(false)
     { }
 
     virtual ~translator() { }
 
-    void translate();
+    // Translate the method. Returns false if the backend bailed out.
+    bool translate();
 
 protected:
+    // Give up on the method because the backend cannot translate the current
+    // instruction.
+    void bailout() {
+        _bailout = true;
+    }
+
     void scan();
 
     void translate(std::shared_ptr<basic_block> bblock);
@@ -75,7 +111,14 @@ protected:
     std::shared_ptr<basic_block> lookup(uint16_t offset);
 
     virtual void prologue () = 0;
+    // Prologue of an on-stack replacement entry that receives the locals of
+    // an interpreter frame and continues at 'bblock'.
+    virtual void osr_prologue(std::shared_ptr<basic_block> bblock) {
+        bailout();
+    }
     virtual void begin(std::shared_ptr<basic_block> bblock) = 0;
+    // Called before each instruction, with _bci set to its bytecode index.
+    virtual void begin_insn() { }
     virtual void op_const (type t, int64_t value) = 0;
     virtual void op_load  (type t, uint16_t idx) = 0;
     virtual void op_store (type t, uint16_t idx) = 0;
@@ -85,15 +128,24 @@ protected:
     virtual void op_swap() = 0;
     virtual void op_binary(type t, binop op) = 0;
     virtual void op_iinc(uint8_t idx, jint value) = 0;
+    virtual void op_if(type t, cmpop op, std::shared_ptr<basic_block> target) = 0;
     virtual void op_if_cmp(type t, cmpop op, std::shared_ptr<basic_block> target) = 0;
     virtual void op_goto(std::shared_ptr<basic_block> target) = 0;
     virtual void op_ret() = 0;
     virtual void op_ret_void() = 0;
+    virtual void op_getstatic(type t, field* field) = 0;
+    virtual void op_putstatic(type t, field* field) = 0;
+    virtual void op_getfield(type t, field* field) = 0;
+    virtual void op_putfield(type t, field* field) = 0;
     virtual void op_invokestatic(method* target) = 0;
-    virtual void op_new() = 0;
+    virtual void op_new(klass* klass) = 0;
     virtual void op_arraylength() = 0;
 
     method* _method;
+    uint16_t _osr_bci;
+    // Bytecode index of the instruction being translated.
+    uint16_t _bci;
+    bool _bailout;
     std::map<uint16_t, std::shared_ptr<basic_block>> _bblock_map;
     std::vector<std::shared_ptr<basic_block>> _bblock_list;
 };
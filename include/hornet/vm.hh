@@ -5,8 +5,11 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 #include <mutex>
 
@@ -14,6 +17,8 @@ namespace hornet {
 
 class constant_pool;
 struct method;
+struct compiled_code;
+struct osr_code;
 struct field;
 struct klass;
 class loader;
@@ -23,6 +28,14 @@ public:
     void register_klass(std::shared_ptr<klass> klass);
     void invoke(method* method);
 
+    template<typename Fn>
+    void for_each_klass(Fn fn) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto klass : _klasses) {
+            fn(klass.get());
+        }
+    }
+
 private:
     std::mutex _mutex;
     std::vector<std::shared_ptr<klass>> _klasses;
@@ -46,12 +59,17 @@ struct klass {
     std::string   name;
     klass*        super;
     uint16_t      access_flags;
+    // Size of an instance in bytes, including the object header.
+    size_t        instance_size;
+    // Hash of the class file, used to match ahead-of-time compiled code.
+    uint64_t      hash;
 
     klass(loader* loader, std::shared_ptr<constant_pool> const_pool);
     ~klass();
 
     void add(std::shared_ptr<method> method);
     void add(std::shared_ptr<field> field);
+    void layout_fields();
     bool verify();
 
     std::shared_ptr<constant_pool> const_pool() const {
@@ -69,6 +87,10 @@ struct klass {
         return false;
     }
 
+    const method_list_type& methods() const {
+        return _methods;
+    }
+
     std::shared_ptr<method> lookup_method(std::string name, std::string desciptor);
     std::shared_ptr<field> lookup_field(std::string name, std::string desciptor);
 
@@ -84,7 +106,12 @@ private:
 };
 
 struct field {
+    // The class that declares the field.
+    struct klass* klass;
+    // Value of a static field. Instance fields live in the object at offset.
     value_t     value;
+    uint32_t    offset;
+    uint16_t    access_flags;
     std::string name;
     std::string descriptor;
 
@@ -94,6 +121,60 @@ struct field {
     bool matches(std::string name, std::string descriptor);
 };
 
+//
+// Per-method execution profile ("method data"). The interpreter updates the
+// counters without synchronization, so they are approximate under
+// contention. Profile sites are laid out from the bytecode when the
+// profile is created and are sorted by bytecode index.
+//
+// Gotos have branch counters as well, which are never not taken, so that
+// every back-edge of a loop is counted on its own.
+//
+struct branch_counter {
+    uint16_t bci;
+    uint64_t taken;
+    uint64_t not_taken;
+};
+
+// Range of array lengths seen at arraylength.
+struct array_length_range {
+    uint16_t bci;
+    uint32_t min;
+    uint32_t max;
+    uint64_t count;
+
+    void record(uint32_t length) {
+        if (!count++) {
+            min = max = length;
+            return;
+        }
+        if (length < min) {
+            min = length;
+        }
+        if (length > max) {
+            max = length;
+        }
+    }
+};
+
+struct method_data {
+    uint64_t invocation_count;
+    uint64_t backedge_count;
+    std::vector<branch_counter>     branches;
+    std::vector<array_length_range> array_lengths;
+
+    explicit method_data(const method* method);
+
+    branch_counter*     lookup_branch(uint16_t bci);
+    array_length_range* lookup_array_length(uint16_t bci);
+
+    void print(FILE* out) const;
+};
+
+extern bool print_method_data;
+
+void method_data_stats();
+
 struct method {
     // Method lifecycle is tied to the class it belongs to. Use a pointer to
     // klass instead of a smart pointer to break the cyclic dependency during
@@ -104,18 +185,70 @@ struct method {
     std::string descriptor;
     struct klass* return_type;
     uint16_t    args_count;
+    uint16_t    args_size;
+    uint16_t    max_stack;
     uint16_t    max_locals;
     char*       code;
     uint32_t    code_length;
 
+    // Backend-specific entry point of the translated method. The slot is
+    // filled in once by the first caller and then reused by every later
+    // invocation.
+    std::atomic<void*> entry_point;
+
+    // Execution profile, allocated on first use.
+    std::atomic<method_data*> data;
+
+    // Highest tier the method has been promoted to and the best code
+    // produced so far. A promotion whose compilation fails still raises the
+    // tier so that it is not retried.
+    std::atomic<uint8_t> tier;
+    std::atomic<compiled_code*> compiled;
+
+    // On-stack replacement entry points, one per loop header that has been
+    // compiled.
+    std::atomic<osr_code*> osr;
+
     method();
     ~method();
 
+    method_data* profile() {
+        auto data = this->data.load(std::memory_order_acquire);
+        if (!data) {
+            data = alloc_profile();
+        }
+        return data;
+    }
+
+    bool returns_void() const {
+        return descriptor.back() == 'V';
+    }
+
+    bool returns_reference() const {
+        auto ret = descriptor[descriptor.find(')') + 1];
+        return ret == 'L' || ret == '[';
+    }
+
     bool is_init() const {
         return name[0] == '<';
     }
 
+    bool is_static() const;
+
     bool matches(std::string name, std::string descriptor);
+
+    // Arguments are passed one slot per value but long and double arguments
+    // take up two local variable slots in the callee. Move the arguments in
+    // place to their local variable slots.
+    void spread_args(value_t* locals) const {
+        if (args_size != args_count) {
+            spread_wide_args(locals);
+        }
+    }
+
+private:
+    method_data* alloc_profile();
+    void spread_wide_args(value_t* locals) const;
 };
 
 struct array {
@@ -127,19 +260,116 @@ struct array {
         , length(length) {}
 };
 
+static constexpr size_t java_stack_size = 8ULL * 1024UL * 1024UL; /* 8 MB */
+
+//
+// A per-thread stack for interpreter frames. Frames are carved out of one
+// contiguous mmap'd region by bumping a pointer so that calls never need to
+// allocate memory.
+//
+class java_stack {
+public:
+    explicit java_stack(size_t size);
+    ~java_stack();
+
+    java_stack(const java_stack&) = delete;
+    java_stack& operator=(const java_stack&) = delete;
+
+    value_t* base() const {
+        return _base;
+    }
+
+    value_t* top() const {
+        return _top;
+    }
+
+    bool empty() const {
+        return _top == _base;
+    }
+
+    // Make [base, base + nr_slots) the topmost frame and return the previous
+    // top of stack that is passed to pop() when the frame goes away.
+    value_t* push(value_t* base, size_t nr_slots) {
+        auto prev = _top;
+        auto top  = base + nr_slots;
+        if (top > _end) {
+            overflow();
+        }
+        _top = top;
+        return prev;
+    }
+
+    void pop(value_t* prev) {
+        _top = prev;
+    }
+
+private:
+    [[noreturn]] void overflow();
+
+    value_t* _base;
+    value_t* _end;
+    value_t* _top;
+};
+
+//
+// A call from compiled code into the interpreter. The c2i adapter leaves
+// its frame pointer in thread::last_compiled_fp and call_interpreter() links
+// it into the thread's chain of anchors for the duration of the call, so
+// that a safepoint can walk the compiled frames below the interpreter. An
+// anchor without a frame pointer comes from code that has no stack maps.
+//
+struct frame_anchor {
+    void*         fp;
+    frame_anchor* prev;
+};
+
 class thread {
 public:
     thread();
     ~thread();
 
     object *exception;
-
+    java_stack stack;
+
+    // Wait for queued compilations when background compilation is disabled.
+    // Latency-critical threads clear this to keep running their current code.
+    bool block_on_compilation;
+
+    void*         last_compiled_fp;
+    frame_anchor* anchor;
+
+    //
+    // Java code runs on a single OS thread, the one that created the VM:
+    // there is one thread object, and attaching other threads is not
+    // supported. Compiled code relies on it to embed the addresses of the
+    // thread's fields, such as the allocation buffer, as constants, and
+    // asserts single_threaded() where it does.
+    //
     static thread *current() {
         static thread thread;
 
         return &thread;
     }
 
+    // Make the calling OS thread the one that runs Java code.
+    void attach() {
+        _os_thread = std::this_thread::get_id();
+        _nr_attached.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void detach() {
+        _nr_attached.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    bool single_threaded() const {
+        return _nr_attached.load(std::memory_order_relaxed) == 1;
+    }
+
+    // True if the calling OS thread is the one that runs Java code.
+    bool is_attached() const {
+        return _os_thread == std::this_thread::get_id();
+    }
+
     template<typename T>
     T* alloc() { return alloc<T>(0); }
 
@@ -156,8 +386,16 @@ public:
         return reinterpret_cast<T*>(p);
     }
 
+    // Compiled code bumps the allocation buffer inline and calls
+    // gc_new_object() only when the buffer is full.
+    memory_block** alloc_buffer() {
+        return &_alloc_buffer;
+    }
+
 private:
     memory_block* _alloc_buffer;
+    std::thread::id _os_thread;
+    std::atomic<unsigned int> _nr_attached;
 
 };
 
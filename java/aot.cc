@@ -0,0 +1,271 @@
+#include "hornet/aot.hh"
+
+#include "hornet/java.hh"
+#include "hornet/safepoint.hh"
+#include "hornet/vm.hh"
+
+#include <dlfcn.h>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+namespace hornet {
+
+static const aot_library* library;
+
+// Classes of the library by name, so that loading a class does not scan
+// the whole library.
+static std::map<std::string, const aot_class*> library_classes;
+
+static void bind(klass* klass);
+
+// Runs AOT-compiled methods through their i2c adapters.
+class aot_backend : public backend {
+public:
+    virtual value_t run(method* method, void* entry_point, frame& frame) override {
+        auto i2c = reinterpret_cast<i2c_adapter_t>(entry_point);
+
+        return i2c(frame.locals);
+    }
+
+    compiled_code* install(void* entry_point) {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _compiled.emplace_back(new compiled_code{this, entry_point, max_tier});
+        return _compiled.back().get();
+    }
+
+protected:
+    virtual void* compile(method* method) override {
+        return nullptr;
+    }
+
+private:
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<compiled_code>> _compiled;
+};
+
+static aot_backend aot;
+
+// Runs the methods of classes that have not been bound yet. The first call
+// binds the class, which replaces the compiled code of its methods, and
+// runs the method again with whatever is installed now.
+class aot_binder : public aot_backend {
+public:
+    virtual value_t run(method* method, void* entry_point, frame& frame) override {
+        bind(method->klass);
+
+        return _backend->execute(method, frame);
+    }
+};
+
+static aot_binder binder;
+
+// Classes that have code in the library and are waiting for their first
+// call to be bound.
+static std::map<klass*, const aot_class*> unbound_classes;
+static std::mutex unbound_mutex;
+
+bool aot_load(const char* path)
+{
+    auto handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "error: %s\n", dlerror());
+        return false;
+    }
+    auto lib = static_cast<const aot_library*>(dlsym(handle, "hornet_aot_library"));
+    if (!lib) {
+        fprintf(stderr, "error: %s: not an AOT library.\n", path);
+        dlclose(handle);
+        return false;
+    }
+    if (lib->version != aot_version) {
+        fprintf(stderr, "error: %s: AOT library version %u, expected %u.\n", path, lib->version, aot_version);
+        dlclose(handle);
+        return false;
+    }
+    library = lib;
+    for (uint32_t i = 0; i < lib->nr_classes; i++) {
+        library_classes.insert(std::make_pair(std::string{lib->classes[i].name}, &lib->classes[i]));
+    }
+    return true;
+}
+
+static const aot_class* lookup_class(klass* klass)
+{
+    auto it = library_classes.find(klass->name);
+    if (it == library_classes.end() || it->second->hash != klass->hash) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+//
+// Classes that the code refers to are loaded when the class is bound at its
+// first call, not while it is being loaded itself. A class that does not
+// load keeps the code from being bound, and the interpreter raises the
+// error when it gets to an instruction that needs the class. The loader's
+// exception is therefore dropped, but an exception that was pending before
+// is left alone.
+//
+static klass* resolve_klass(const char* name)
+{
+    auto* current = thread::current();
+    auto* pending = current->exception;
+
+    auto klass = system_loader()->load_class(name);
+    if (!klass) {
+        fprintf(stderr, "warning: aot: class '%s' does not load\n", name);
+    }
+    current->exception = pending;
+
+    return klass.get();
+}
+
+static void* resolve_runtime(const char* name)
+{
+    if (!strcmp(name, "poll_page")) {
+        return safepoint_poll_page();
+    }
+    if (!strcmp(name, "alloc_buffer")) {
+        assert(thread::current()->single_threaded());
+        return thread::current()->alloc_buffer();
+    }
+    if (!strcmp(name, "gc_new_object")) {
+        return reinterpret_cast<void*>(&gc_new_object);
+    }
+    if (!strcmp(name, "call_interpreter")) {
+        return reinterpret_cast<void*>(&call_interpreter);
+    }
+    return nullptr;
+}
+
+// Fill in the slot of a relocation or check the value it records. Returns
+// false if the code does not match this VM.
+static bool resolve(const aot_reloc& reloc)
+{
+    if (reloc.kind == aot_reloc_runtime) {
+        auto addr = resolve_runtime(reloc.name);
+        *reloc.slot = addr;
+        return addr != nullptr;
+    }
+    auto* klass = resolve_klass(reloc.klass);
+    if (!klass) {
+        return false;
+    }
+    switch (reloc.kind) {
+    case aot_reloc_klass:
+        *reloc.slot = klass;
+        return true;
+    case aot_reloc_instance_size:
+        return klass->instance_size == reloc.value;
+    case aot_reloc_method: {
+        auto method = klass->lookup_method(reloc.name, reloc.descriptor);
+        *reloc.slot = method.get();
+        return method != nullptr;
+    }
+    case aot_reloc_static_field:
+    case aot_reloc_field_offset: {
+        auto field = klass->lookup_field(reloc.name, reloc.descriptor);
+        if (!field) {
+            return false;
+        }
+        if (reloc.kind == aot_reloc_field_offset) {
+            return field->offset == reloc.value;
+        }
+        *reloc.slot = &field->value;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+static method* lookup_method(klass* klass, const aot_method& aot_method)
+{
+    for (auto& method : klass->methods()) {
+        if (method->matches(aot_method.name, aot_method.descriptor)) {
+            return method.get();
+        }
+    }
+    return nullptr;
+}
+
+//
+// Methods that have code in the library are installed at the highest tier
+// right away, so that tiered compilation leaves them alone, but go through
+// the binder until their class is bound.
+//
+void aot_bind(klass* klass)
+{
+    if (!library) {
+        return;
+    }
+    auto* aot_class = lookup_class(klass);
+    if (!aot_class) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(unbound_mutex);
+
+        unbound_classes.insert(std::make_pair(klass, aot_class));
+    }
+    for (uint32_t i = 0; i < aot_class->nr_methods; i++) {
+        auto& aot_method = aot_class->methods[i];
+        auto* method = lookup_method(klass, aot_method);
+        if (!method) {
+            continue;
+        }
+        // The interpreter counts calls to compiled methods in their profile.
+        method->profile();
+        method->tier.store(max_tier, std::memory_order_relaxed);
+        method->compiled.store(binder.install(aot_method.entry_point), std::memory_order_release);
+    }
+}
+
+//
+// Resolve the relocations of a class and install the code of its methods.
+// A class whose relocations do not resolve gives its methods back to the
+// interpreter and the JIT.
+//
+static void bind(klass* klass)
+{
+    const aot_class* aot_class;
+    {
+        std::lock_guard<std::mutex> lock(unbound_mutex);
+
+        auto it = unbound_classes.find(klass);
+        if (it == unbound_classes.end()) {
+            return;
+        }
+        aot_class = it->second;
+        unbound_classes.erase(it);
+    }
+    bool resolved = true;
+    for (uint32_t i = 0; i < aot_class->nr_relocs && resolved; i++) {
+        resolved = resolve(aot_class->relocs[i]);
+        if (!resolved && print_compilation) {
+            fprintf(stderr, "aot: %s: relocation %u does not resolve\n", klass->name.c_str(), i);
+        }
+    }
+    for (uint32_t i = 0; i < aot_class->nr_methods; i++) {
+        auto& aot_method = aot_class->methods[i];
+        auto* method = lookup_method(klass, aot_method);
+        if (!method) {
+            continue;
+        }
+        if (!resolved) {
+            method->compiled.store(nullptr, std::memory_order_release);
+            method->tier.store(0, std::memory_order_relaxed);
+            continue;
+        }
+        method->compiled.store(aot.install(aot_method.entry_point), std::memory_order_release);
+        if (print_compilation) {
+            fprintf(stderr, "aot: %s.%s%s\n", klass->name.c_str(), method->name.c_str(), method->descriptor.c_str());
+        }
+    }
+}
+
+}
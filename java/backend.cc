@@ -1,7 +1,71 @@
 #include <hornet/java.hh>
 
+#include <cstdio>
+
 namespace hornet {
 
 backend* _backend;
 
-} 
+unsigned int llvm_opt_level = 2;
+bool print_llvm_timing;
+
+value_t backend::execute(method* method, frame& frame)
+{
+    // Methods bound to ahead-of-time compiled code run it instead of being
+    // translated by the backend.
+    auto* compiled = method->compiled.load(std::memory_order_acquire);
+    if (compiled) {
+        return compiled->backend->run(method, compiled->entry_point, frame);
+    }
+    return run(method, entry_point(method), frame);
+}
+
+value_t call_interpreter(method* method, value_t* args)
+{
+    auto* current = thread::current();
+
+    frame_anchor anchor{current->last_compiled_fp, current->anchor};
+    current->last_compiled_fp = nullptr;
+    current->anchor = &anchor;
+
+    auto* frame = frame::enter(method);
+
+    for (int i = 0; i < method->args_count; i++) {
+        frame->locals[i] = args[i];
+    }
+
+    method->spread_args(frame->locals);
+
+    auto value = _backend->execute(method, *frame);
+
+    frame->leave();
+
+    current->anchor = anchor.prev;
+
+    return value;
+}
+
+void* backend::lookup_entry_point(method* method)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // Another thread may have translated the method while we were waiting
+    // for the lock.
+    auto entry_point = method->entry_point.load(std::memory_order_relaxed);
+    if (entry_point) {
+        return entry_point;
+    }
+
+    entry_point = compile(method);
+    if (!entry_point) {
+        fprintf(stderr, "error: unable to translate %s.%s%s\n",
+                method->klass->name.c_str(), method->name.c_str(), method->descriptor.c_str());
+        abort();
+    }
+
+    method->entry_point.store(entry_point, std::memory_order_release);
+
+    return entry_point;
+}
+
+}
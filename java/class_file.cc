@@ -42,12 +42,15 @@ std::shared_ptr<klass> class_file::parse()
 
     auto access_flags = read_u2();
 
-    /*auto this_class = */read_u2();
+    auto this_class = read_u2();
 
     auto super_class = read_u2();
 
     auto* klass = new hornet::klass(hornet::system_loader(), const_pool);
 
+    auto klassref = const_pool->get_class(this_class);
+    klass->name = const_pool->get_utf8(klassref->name_index)->bytes;
+
     auto interfaces_count = read_u2();
 
     for (auto i = 0; i < interfaces_count; i++)
@@ -56,7 +59,7 @@ std::shared_ptr<klass> class_file::parse()
     auto fields_count = read_u2();
 
     for (auto i = 0; i < fields_count; i++) {
-        auto field = read_field_info(*const_pool);
+        auto field = read_field_info(klass, *const_pool);
 
         klass->add(field);
     }
@@ -84,6 +87,10 @@ std::shared_ptr<klass> class_file::parse()
         klass->super = nullptr;
     }
 
+    klass->layout_fields();
+
+    klass->hash = hash();
+
     return std::shared_ptr<hornet::klass>(klass);
 }
 
@@ -260,9 +267,9 @@ void class_file::read_const_invoke_dynamic()
     /*auto name_and_type_index = */read_u2();
 }
 
-std::shared_ptr<field> class_file::read_field_info(constant_pool &constant_pool)
+std::shared_ptr<field> class_file::read_field_info(klass* klass, constant_pool &constant_pool)
 {
-    /*auto access_flags = */read_u2();
+    auto access_flags = read_u2();
     auto name_index = read_u2();
 
     auto *cp_name = constant_pool.get_utf8(name_index);
@@ -273,6 +280,8 @@ std::shared_ptr<field> class_file::read_field_info(constant_pool &constant_pool)
 
     auto f = std::make_shared<field>();
 
+    f->klass        = klass;
+    f->access_flags = access_flags;
     f->name         = cp_name->bytes;
     f->descriptor   = cp_descriptor->bytes;
 
@@ -317,17 +326,21 @@ static klass* parse_type(std::string descriptor, int& pos)
     return nullptr;
 }
 
+// Instance methods receive 'this' as their first argument.
 static void parse_method_descriptor(std::shared_ptr<method> m)
 {
     int pos = 0;
 
-    m->args_count = 0;
+    m->args_count = m->is_static() ? 0 : 1;
+    m->args_size = m->args_count;
 
     assert(m->descriptor[pos++] == '(');
 
     while (m->descriptor[pos] != ')') {
+        auto ch = m->descriptor[pos];
         parse_type(m->descriptor, pos);
         m->args_count++;
+        m->args_size += (ch == 'J' || ch == 'D') ? 2 : 1;
     }
     m->return_type = parse_type(m->descriptor, ++pos);
 }
@@ -356,6 +369,8 @@ std::shared_ptr<method> class_file::read_method_info(klass* klass, constant_pool
     m->access_flags = access_flags;
     m->name         = cp_name->bytes;
     m->descriptor   = cp_descriptor->bytes;
+    m->max_stack    = 0;
+    m->max_locals   = 0;
     m->code         = nullptr;
     m->code_length  = 0;
 
@@ -367,6 +382,7 @@ std::shared_ptr<method> class_file::read_method_info(klass* klass, constant_pool
         switch (attr->type) {
         case attr_type::code: {
             code_attr* c = static_cast<code_attr*>(attr.get());
+            m->max_stack   = c->max_stack;
             m->max_locals  = c->max_locals;
             m->code        = c->code;
             m->code_length = c->code_length;
@@ -404,7 +420,7 @@ std::unique_ptr<code_attr>
 class_file::read_code_attribute(constant_pool& constant_pool)
 {
     auto* attr = new code_attr();
-    /*auto max_stack = */read_u2();
+    attr->max_stack = read_u2();
     attr->max_locals = read_u2();
     attr->code_length = read_u4();
     attr->code = new char[attr->code_length];
@@ -448,4 +464,15 @@ uint64_t class_file::read_u8()
     return static_cast<uint64_t>(read_u4()) << 32 | read_u4();
 }
 
+// 64-bit FNV-1a of the whole class file.
+uint64_t class_file::hash() const
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < _size; i++) {
+        hash ^= static_cast<uint8_t>(_data[i]);
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
 }
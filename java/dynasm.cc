@@ -1,10 +1,15 @@
 #include "hornet/java.hh"
 
 #include "hornet/translator.hh"
+#include "hornet/perf.hh"
+#include "hornet/safepoint.hh"
 #include "hornet/vm.hh"
+#include "hornet/gc.hh"
 
-#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <utility>
 
 #include <classfile_constants.h>
 #include <jni.h>
@@ -13,17 +18,16 @@ using namespace std;
 
 namespace hornet {
 
-static const int mmap_size = 4096;
-
 class dynasm_translator : public translator {
 public:
-    dynasm_translator(method* method, dynasm_backend* backend);
+    dynasm_translator(method* method, dynasm_backend* backend, uint16_t osr_bci = no_osr_bci);
     ~dynasm_translator();
 
     template<typename T>
     T trampoline();
 
     virtual void prologue () override;
+    virtual void osr_prologue(std::shared_ptr<basic_block> bblock) override;
     virtual void begin(std::shared_ptr<basic_block> bblock) override;
     virtual void op_const (type t, int64_t value) override;
     virtual void op_load  (type t, uint16_t idx) override;
@@ -34,16 +38,93 @@ public:
     virtual void op_swap() override;
     virtual void op_binary(type t, binop op) override;
     virtual void op_iinc(uint8_t idx, jint value) override;
+    virtual void op_if(type t, cmpop op, std::shared_ptr<basic_block> bblock) override;
     virtual void op_if_cmp(type t, cmpop op, std::shared_ptr<basic_block> bblock) override;
     virtual void op_goto(std::shared_ptr<basic_block> bblock) override;
     virtual void op_ret() override;
     virtual void op_ret_void() override;
+    virtual void op_getstatic(type t, field* field) override;
+    virtual void op_putstatic(type t, field* field) override;
+    virtual void op_getfield(type t, field* field) override;
+    virtual void op_putfield(type t, field* field) override;
     virtual void op_invokestatic(method* target) override;
-    virtual void op_new() override;
+    virtual void op_new(klass* klass) override;
     virtual void op_arraylength() override;
 
 private:
+    void allocate_registers();
+    void compute_live_refs();
+    void enter_frame();
+    void leave_frame();
+    int32_t stack_slot(uint16_t depth);
+    int32_t save_slot(size_t idx);
+    int stack_reg(uint16_t depth);
+    void load(int reg, uint16_t depth);
+    void store(uint16_t depth, int reg);
+    void move(uint16_t to, uint16_t from);
+    int use(uint16_t depth, int scratch);
+    int def(uint16_t depth, int scratch);
+    void commit(uint16_t depth, int reg);
+    int new_label();
+    void jump(cmpop op, int label);
+    void branch(cmpop op, std::shared_ptr<basic_block> bblock);
+    void poll(stack_map map);
+    stack_map live_refs(uint16_t bci);
+    stack_map call_refs(uint16_t bci, uint16_t depth);
+    void save_locals(uint16_t bci);
+    void restore_locals(uint16_t bci);
+    void enter(std::shared_ptr<basic_block> bblock);
+    void save_stack(uint16_t depth);
+    void restore_stack(uint16_t depth);
+    void pass_args(uint16_t base, size_t nr_args);
+    void link_calls(void* code);
+    void register_code(void* code, size_t size);
+    void register_maps(void* code, size_t size);
+
     dynasm_backend* ctx;
+
+    // A call whose return address is at pc label 'label' and that goes to
+    // 'target' until it is resolved.
+    struct call_site {
+        int   label;
+        void* target;
+    };
+    std::vector<call_site> _call_sites;
+
+    // A safepoint poll whose load is at pc label 'label', or a call that
+    // returns to it.
+    struct map_site {
+        int       label;
+        stack_map map;
+    };
+    std::vector<map_site> _stack_maps;
+
+    // Pc labels past the bytecode indices that have been handed out.
+    int _nr_labels;
+
+    // Locals that hold a reference which is read later, at the entry of
+    // every instruction.
+    std::vector<std::vector<bool>> _live_refs;
+
+    // Live range of a local in bytecode order and the register assigned to
+    // it, or no_reg if the local lives in its frame slot.
+    struct live_interval {
+        uint16_t idx;
+        uint16_t start;
+        uint16_t end;
+        int      reg;
+    };
+    std::vector<live_interval> _intervals;
+    std::vector<int> _local_regs;
+    std::vector<bool> _saved_regs;
+
+    // Operand stack depth at the current instruction, and whether each
+    // slot holds a reference. The slots are also recorded at the start of
+    // every block that has been entered or branched to.
+    uint16_t _depth;
+    std::vector<bool> _stack_refs;
+    bool _reachable;
+    std::map<uint16_t, std::vector<bool>> _block_stack;
 };
 
 #define Dst             ctx
@@ -55,70 +136,652 @@ private:
 
 #include "dynasm_x64.h"
 
-dynasm_translator::dynasm_translator(method* method, dynasm_backend* backend)
-    : translator(method)
+dynasm_translator::dynasm_translator(method* method, dynasm_backend* backend, uint16_t osr_bci)
+    : translator(method, osr_bci)
     , ctx(backend)
+    , _nr_labels(0)
+    , _depth(0)
+    , _stack_refs(method->max_stack, false)
+    , _reachable(true)
 {
+    dasm_growpc(ctx, method->code_length);
 }
 
 dynasm_translator::~dynasm_translator()
 {
 }
 
+// Local variable accessed by the instruction at 'pc', if any.
+static bool local_access(char* code, uint16_t pc, uint16_t& idx)
+{
+    uint8_t opc = code[pc];
+
+    switch (opc) {
+    case JVM_OPC_iload:
+    case JVM_OPC_lload:
+    case JVM_OPC_aload:
+    case JVM_OPC_istore:
+    case JVM_OPC_lstore:
+    case JVM_OPC_astore:
+    case JVM_OPC_iinc:
+        idx = read_opc_u1(code + pc);
+        return true;
+    case JVM_OPC_iload_0:
+    case JVM_OPC_iload_1:
+    case JVM_OPC_iload_2:
+    case JVM_OPC_iload_3:
+        idx = opc - JVM_OPC_iload_0;
+        return true;
+    case JVM_OPC_lload_0:
+    case JVM_OPC_lload_1:
+    case JVM_OPC_lload_2:
+    case JVM_OPC_lload_3:
+        idx = opc - JVM_OPC_lload_0;
+        return true;
+    case JVM_OPC_aload_0:
+    case JVM_OPC_aload_1:
+    case JVM_OPC_aload_2:
+    case JVM_OPC_aload_3:
+        idx = opc - JVM_OPC_aload_0;
+        return true;
+    case JVM_OPC_istore_0:
+    case JVM_OPC_istore_1:
+    case JVM_OPC_istore_2:
+    case JVM_OPC_istore_3:
+        idx = opc - JVM_OPC_istore_0;
+        return true;
+    case JVM_OPC_lstore_0:
+    case JVM_OPC_lstore_1:
+    case JVM_OPC_lstore_2:
+    case JVM_OPC_lstore_3:
+        idx = opc - JVM_OPC_lstore_0;
+        return true;
+    case JVM_OPC_astore_0:
+    case JVM_OPC_astore_1:
+    case JVM_OPC_astore_2:
+    case JVM_OPC_astore_3:
+        idx = opc - JVM_OPC_astore_0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Target of the branch instruction at 'pc', if any.
+static bool branch_target(char* code, uint16_t pc, uint16_t& target)
+{
+    uint8_t opc = code[pc];
+
+    switch (opc) {
+    case JVM_OPC_ifeq:
+    case JVM_OPC_ifne:
+    case JVM_OPC_iflt:
+    case JVM_OPC_ifge:
+    case JVM_OPC_ifgt:
+    case JVM_OPC_ifle:
+    case JVM_OPC_if_icmpeq:
+    case JVM_OPC_if_icmpne:
+    case JVM_OPC_if_icmplt:
+    case JVM_OPC_if_icmpge:
+    case JVM_OPC_if_icmpgt:
+    case JVM_OPC_if_icmple:
+    case JVM_OPC_if_acmpeq:
+    case JVM_OPC_if_acmpne:
+    case JVM_OPC_goto:
+    case JVM_OPC_ifnull:
+    case JVM_OPC_ifnonnull: {
+        int16_t offset = read_opc_u2(code + pc);
+        target = pc + offset;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+static bool falls_through(uint8_t opc)
+{
+    switch (opc) {
+    case JVM_OPC_goto:
+    case JVM_OPC_ireturn:
+    case JVM_OPC_lreturn:
+    case JVM_OPC_areturn:
+    case JVM_OPC_return:
+    case JVM_OPC_athrow:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static bool is_ref_load(uint8_t opc)
+{
+    switch (opc) {
+    case JVM_OPC_aload:
+    case JVM_OPC_aload_0:
+    case JVM_OPC_aload_1:
+    case JVM_OPC_aload_2:
+    case JVM_OPC_aload_3:
+        return true;
+    default:
+        return false;
+    }
+}
+
+//
+// Backward liveness of locals that hold references, for the stack maps of
+// safepoint polls. The verifier guarantees that a local has the same type
+// on every path to its use, so a local is a live reference if the next
+// access on some path is an aload. Stores and loads of other types end the
+// live range.
+//
+void dynasm_translator::compute_live_refs()
+{
+    auto* code = _method->code;
+
+    std::vector<uint16_t> pcs;
+    for (uint16_t pc = 0; pc < _method->code_length; pc += opcode_length[static_cast<uint8_t>(code[pc])]) {
+        pcs.push_back(pc);
+    }
+
+    _live_refs.assign(_method->code_length, std::vector<bool>(_method->max_locals, false));
+
+    bool changed;
+    do {
+        changed = false;
+        for (size_t i = pcs.size(); i-- > 0; ) {
+            auto pc = pcs[i];
+            uint8_t opc = code[pc];
+
+            std::vector<bool> live(_method->max_locals, false);
+            auto merge = [&](uint16_t succ) {
+                for (uint16_t idx = 0; idx < _method->max_locals; idx++) {
+                    if (_live_refs[succ][idx]) {
+                        live[idx] = true;
+                    }
+                }
+            };
+            if (falls_through(opc) && i + 1 < pcs.size()) {
+                merge(pcs[i + 1]);
+            }
+            uint16_t idx, target;
+            if (branch_target(code, pc, target)) {
+                merge(target);
+            }
+            if (local_access(code, pc, idx)) {
+                live[idx] = is_ref_load(opc);
+            }
+            if (live != _live_refs[pc]) {
+                _live_refs[pc] = live;
+                changed = true;
+            }
+        }
+    } while (changed);
+}
+
+// Stack map of a poll that is followed by bytecode index 'bci' with an
+// empty operand stack.
+stack_map dynasm_translator::live_refs(uint16_t bci)
+{
+    stack_map map;
+    for (uint16_t idx = 0; idx < _method->max_locals; idx++) {
+        if (!_live_refs[bci][idx]) {
+            continue;
+        }
+        if (_local_regs[idx] != no_reg) {
+            map.regs.push_back(_local_regs[idx]);
+        } else {
+            map.slots.push_back(local(idx));
+        }
+    }
+    return map;
+}
+
+//
+// Stack map of a call that returns to bytecode index 'bci' with the operand
+// stack slots below 'depth' saved to the frame. The callee may run into a
+// safepoint, so live references in local registers are saved to their frame
+// slots around the call as well, and the map covers frame slots only.
+//
+// gc_new_object() never reaches a safepoint, so allocations need no map.
+//
+stack_map dynasm_translator::call_refs(uint16_t bci, uint16_t depth)
+{
+    stack_map map;
+    for (uint16_t idx = 0; idx < _method->max_locals; idx++) {
+        if (_live_refs[bci][idx]) {
+            map.slots.push_back(local(idx));
+        }
+    }
+    for (uint16_t i = 0; i < depth; i++) {
+        if (_stack_refs[i]) {
+            map.slots.push_back(stack_slot(i));
+        }
+    }
+    return map;
+}
+
+int dynasm_translator::new_label()
+{
+    int label = _method->code_length + _nr_labels++;
+    dasm_growpc(ctx, label + 1);
+    return label;
+}
+
+//
+// Linear-scan register allocation of locals.
+//
+// The live interval of a local spans its first and last access in bytecode
+// order, and arguments are live from the start. An interval that overlaps a
+// loop is widened to the whole loop because its value may flow around the
+// back-edge. Intervals are then visited in order of their start and get a
+// free register if there is one. Otherwise the interval that ends last,
+// either the new one or an active one, is spilled to its frame slot for the
+// whole method.
+//
+void dynasm_translator::allocate_registers()
+{
+    std::vector<int> interval_of(_method->max_locals, -1);
+
+    auto access = [&](uint16_t idx, uint16_t pc) {
+        if (interval_of[idx] < 0) {
+            interval_of[idx] = _intervals.size();
+            _intervals.push_back(live_interval{idx, pc, pc, no_reg});
+        }
+        _intervals[interval_of[idx]].end = pc;
+    };
+
+    std::vector<argument> args;
+    parse_args(_method, args);
+    for (auto& arg : args) {
+        access(arg.slot, 0);
+    }
+
+    std::vector<std::pair<uint16_t, uint16_t>> loops;
+    for (uint16_t pc = 0; pc < _method->code_length; pc += opcode_length[static_cast<uint8_t>(_method->code[pc])]) {
+        uint16_t idx, target;
+        if (local_access(_method->code, pc, idx)) {
+            access(idx, pc);
+        }
+        if (branch_target(_method->code, pc, target) && target <= pc) {
+            loops.emplace_back(target, pc);
+        }
+    }
+
+    // Widening an interval can make it overlap an enclosing loop, so
+    // iterate until nothing changes.
+    bool changed;
+    do {
+        changed = false;
+        for (auto& loop : loops) {
+            for (auto& interval : _intervals) {
+                if (interval.start > loop.second || interval.end < loop.first) {
+                    continue;
+                }
+                if (interval.start > loop.first || interval.end < loop.second) {
+                    interval.start = std::min(interval.start, loop.first);
+                    interval.end   = std::max(interval.end, loop.second);
+                    changed = true;
+                }
+            }
+        }
+    } while (changed);
+
+    std::sort(_intervals.begin(), _intervals.end(), [](const live_interval& a, const live_interval& b) {
+        return a.start < b.start;
+    });
+
+    std::vector<live_interval*> active;
+    std::vector<int> free_regs;
+    for (int i = nr_local_regs - 1; i >= 0; i--) {
+        free_regs.push_back(i);
+    }
+
+    for (auto& interval : _intervals) {
+        for (auto it = active.begin(); it != active.end(); ) {
+            if ((*it)->end < interval.start) {
+                free_regs.push_back((*it)->reg);
+                it = active.erase(it);
+            } else {
+                it++;
+            }
+        }
+        if (free_regs.empty()) {
+            auto spill = std::max_element(active.begin(), active.end(), [](live_interval* a, live_interval* b) {
+                return a->end < b->end;
+            });
+            if ((*spill)->end > interval.end) {
+                interval.reg = (*spill)->reg;
+                (*spill)->reg = no_reg;
+                *spill = &interval;
+            }
+            continue;
+        }
+        interval.reg = free_regs.back();
+        free_regs.pop_back();
+        active.push_back(&interval);
+    }
+
+    _local_regs.assign(_method->max_locals, no_reg);
+    _saved_regs.assign(nr_local_regs, false);
+    for (auto& interval : _intervals) {
+        if (interval.reg != no_reg) {
+            _saved_regs[interval.reg] = true;
+            interval.reg = local_regs[interval.reg];
+            _local_regs[interval.idx] = interval.reg;
+        }
+    }
+}
+
 template<typename T> T dynasm_translator::trampoline()
 {
     size_t size;
+    auto* code = ctx->encode(size);
+    if (code) {
+        link_calls(code);
+        register_maps(code, size);
+        register_code(code, size);
+    }
+    return reinterpret_cast<T>(code);
+}
 
-    if (dasm_link(ctx, &size) != DASM_S_OK) {
-        assert(0);
+void dynasm_translator::link_calls(void* code)
+{
+    for (auto& site : _call_sites) {
+        auto* return_address = static_cast<char*>(code) + dasm_getpclabel(ctx, site.label);
+        ctx->patch_call(return_address, site.target);
+    }
+}
+
+// Every poll and call site is registered, including the ones without
+// references, because the stack walk stops at a return address that has no
+// map.
+void dynasm_translator::register_maps(void* code, size_t size)
+{
+    std::map<const void*, stack_map> maps;
+    for (auto& site : _stack_maps) {
+        maps.insert(std::make_pair(static_cast<char*>(code) + dasm_getpclabel(ctx, site.label), std::move(site.map)));
+    }
+    register_stack_maps(code, size, std::move(maps));
+}
+
+// Every basic block has a pc label at its bytecode index, which gives perf
+// line info at basic block granularity.
+void dynasm_translator::register_code(void* code, size_t size)
+{
+    if (!perf_map && !perf_jitdump) {
+        return;
+    }
+    std::vector<perf_line> lines;
+    for (auto& bblock : _bblock_list) {
+        auto offset = dasm_getpclabel(ctx, bblock->start);
+        if (offset >= 0) {
+            lines.push_back(perf_line{static_cast<char*>(code) + offset, bblock->start});
+        }
     }
+    auto name = perf_symbol(_method);
+    if (_osr_bci != no_osr_bci) {
+        name += "_osr";
+    }
+    perf_register_code(name, code, size, perf_source(_method), lines);
+}
 
-    if (ctx->_offset + size >= mmap_size) {
+void* dynasm_backend::encode(size_t& size)
+{
+    if (dasm_link(this, &size) != DASM_S_OK) {
         assert(0);
     }
 
-    //
-    // XXX: not thread safe
-    //
-    unsigned char* code = static_cast<unsigned char*>(ctx->_code) + ctx->_offset;
-    ctx->_offset += size;
+    auto* code = _code_cache.alloc(size);
+    if (!code) {
+        return nullptr;
+    }
 
-    dasm_encode(ctx, code);
+    dasm_encode(this, _code_cache.writable(code));
 
-    return reinterpret_cast<T>(code);
+    return code;
 }
 
 dynasm_backend::dynasm_backend()
-    : _offset(0)
+    : _code_cache(reserved_code_cache_size)
 {
+    // c2i adapters are assembled with a state of their own because they are
+    // requested in the middle of translating a caller.
     dasm_init(this, DASM_MAXSECTION);
 
     dasm_setupglobal(this, nullptr, 0);
 
-    dasm_setup(this, actions);
+    _adapter_D = D;
 
-    _code = mmap(NULL, mmap_size, PROT_WRITE | PROT_EXEC, MAP_ANON | MAP_PRIVATE, -1, 0);
-    if (_code == MAP_FAILED) {
-        assert(0);
-    }
+    dasm_init(this, DASM_MAXSECTION);
+
+    dasm_setupglobal(this, nullptr, 0);
+
+    dasm_setup(this, actions);
 }
 
 dynasm_backend::~dynasm_backend()
 {
-    munmap(_code, mmap_size);
+    dasm_free(this);
+
+    D = _adapter_D;
 
     dasm_free(this);
 }
 
-value_t dynasm_backend::execute(method* method, frame& frame)
+void* dynasm_backend::compile(method* method)
 {
+    dasm_setup(this, actions);
+
     dynasm_translator translator(method, this);
 
-    translator.translate();
+    if (!translator.translate()) {
+        return nullptr;
+    }
+
+    auto* code = translator.trampoline<void*>();
+    if (!code) {
+        return nullptr;
+    }
+
+    std::vector<argument> args;
+    parse_args(method, args);
 
-    auto fp = translator.trampoline<value_t (*)()>();
+    dasm_setup(this, actions);
+
+    emit_i2c_adapter(this, args, code);
+
+    size_t size;
+    auto* adapter = encode(size);
+    if (!adapter) {
+        unregister_stack_maps(code);
+        _code_cache.free(code);
+        return nullptr;
+    }
+    perf_register_code(perf_symbol(method) + "_i2c", adapter, size);
+
+    std::lock_guard<std::mutex> lock(_code_mutex);
+
+    _i2c_targets.insert(std::make_pair(adapter, code));
+
+    return adapter;
+}
+
+void dynasm_backend::release(void* entry_point)
+{
+    std::lock_guard<std::mutex> lock(_code_mutex);
+
+    auto it = _i2c_targets.find(entry_point);
+    assert(it != _i2c_targets.end());
+
+    auto* code = static_cast<char*>(it->second);
+
+    // Calls that were patched to go straight to the code go through the
+    // callee's c2i adapter again.
+    auto callers = _patched_calls.equal_range(code);
+    for (auto call = callers.first; call != callers.second; call++) {
+        patch_call(call->second.return_address, call->second.c2i);
+    }
+    _patched_calls.erase(callers.first, callers.second);
+
+    // Forget the calls that the code itself makes.
+    auto* end = code + _code_cache.size(code);
+    for (auto call = _patched_calls.begin(); call != _patched_calls.end(); ) {
+        if (call->second.return_address >= code && call->second.return_address < end) {
+            call = _patched_calls.erase(call);
+        } else {
+            call++;
+        }
+    }
+
+    unregister_stack_maps(code);
+    _code_cache.free(code);
+    _code_cache.free(entry_point);
+    _i2c_targets.erase(it);
+}
+
+const void* dynasm_backend::code(void* entry_point)
+{
+    std::lock_guard<std::mutex> lock(_code_mutex);
+
+    auto it = _i2c_targets.find(entry_point);
+    assert(it != _i2c_targets.end());
+
+    return it->second;
+}
+
+void* dynasm_backend::c2i_adapter(method* method)
+{
+    auto it = _c2i_adapters.find(method);
+    if (it != _c2i_adapters.end()) {
+        return it->second;
+    }
+
+    std::vector<argument> args;
+    if (!parse_args(method, args) || args.size() > nr_arg_regs) {
+        return nullptr;
+    }
+
+    std::swap(D, _adapter_D);
+
+    dasm_setup(this, actions);
+
+    emit_c2i_adapter(this, method, args.size());
+
+    size_t size;
+    auto* adapter = encode(size);
+
+    std::swap(D, _adapter_D);
+
+    if (!adapter) {
+        return nullptr;
+    }
+    perf_register_code(perf_symbol(method) + "_c2i", adapter, size);
+
+    _c2i_adapters.insert(std::make_pair(method, adapter));
+
+    return adapter;
+}
+
+void* dynasm_backend::resolution_stub(method* method)
+{
+    auto it = _resolution_stubs.find(method);
+    if (it != _resolution_stubs.end()) {
+        return it->second;
+    }
+
+    auto* c2i = c2i_adapter(method);
+    if (!c2i) {
+        return nullptr;
+    }
+
+    std::vector<argument> args;
+    parse_args(method, args);
+
+    std::swap(D, _adapter_D);
+
+    dasm_setup(this, actions);
+
+    emit_resolution_stub(this, method, args.size(), c2i);
+
+    size_t size;
+    auto* stub = encode(size);
+
+    std::swap(D, _adapter_D);
+
+    if (!stub) {
+        return nullptr;
+    }
+    perf_register_code(perf_symbol(method) + "_stub", stub, size);
+
+    _resolution_stubs.insert(std::make_pair(method, stub));
+
+    return stub;
+}
+
+// Entry point of a method compiled by this backend, or nullptr. Without
+// tiered compilation the method is compiled on first use like the
+// interpreter does.
+void* dynasm_backend::compiled_entry_point(method* method)
+{
+    if (tiered_compilation) {
+        auto* compiled = method->compiled.load(std::memory_order_acquire);
+        if (!compiled || compiled->backend != this) {
+            return nullptr;
+        }
+        return compiled->entry_point;
+    }
+    return this->entry_point(method);
+}
+
+// Point the call that returns to 'return_address' at 'target'. The
+// displacement is aligned, so other threads see either the old or the new
+// target.
+void dynasm_backend::patch_call(char* return_address, void* target)
+{
+    auto* disp = static_cast<std::atomic<int32_t>*>(_code_cache.writable(return_address - 4));
+
+    disp->store(static_cast<char*>(target) - return_address, std::memory_order_relaxed);
+}
+
+void* dynasm_backend::resolve_call(dynasm_backend* backend, method* callee, void* c2i, char* return_address)
+{
+    auto* entry_point = backend->compiled_entry_point(callee);
+
+    std::lock_guard<std::mutex> lock(backend->_code_mutex);
+
+    // The code is looked up under the lock because replaced code can be
+    // released at any time.
+    auto it = backend->_i2c_targets.find(entry_point);
+    if (it == backend->_i2c_targets.end()) {
+        return c2i;
+    }
+    auto* target = it->second;
+
+    backend->patch_call(return_address, target);
+    backend->_patched_calls.insert(std::make_pair(target, patched_call{return_address, c2i}));
+
+    return target;
+}
+
+void* dynasm_backend::compile_osr(method* method, uint16_t bci)
+{
+    dasm_setup(this, actions);
+
+    dynasm_translator translator(method, this, bci);
+
+    if (!translator.translate()) {
+        return nullptr;
+    }
+
+    return translator.trampoline<void*>();
+}
+
+value_t dynasm_backend::run(method* method, void* entry_point, frame& frame)
+{
+    auto i2c = reinterpret_cast<i2c_adapter_t>(entry_point);
 
-    return fp();
+    return i2c(frame.locals);
 }
 
 }
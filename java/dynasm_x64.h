@@ -0,0 +1,976 @@
+/*
+** This file has been pre-processed with DynASM.
+** http://luajit.org/dynasm.html
+** DynASM version 1.3.0, DynASM x64 version 1.3.0
+** DO NOT EDIT! The original file is in "java/dynasm_x64.dasc".
+*/
+
+#line 1 "java/dynasm_x64.dasc"
+//|.arch x64
+#if DASM_VERSION != 10300
+#error "Version mismatch between DynASM and included encoding engine"
+#endif
+#line 2 "java/dynasm_x64.dasc"
+//|.section code, cold
+#define DASM_SECTION_CODE	0
+#define DASM_SECTION_COLD	1
+#define DASM_MAXSECTION		2
+#line 3 "java/dynasm_x64.dasc"
+//|.actionlist actions
+static const unsigned char actions[561] = {
+  85,72,137,229,72,129,252,236,239,255,72,137,133,253,240,14,233,255,72,139,
+  133,253,240,14,233,255,201,195,255,72,137,192,240,14,240,12,255,72,139,135,
+  253,240,14,233,255,72,139,135,233,72,137,133,233,255,85,72,137,229,73,137,
+  252,250,255,73,139,130,253,240,14,233,255,72,184,237,237,252,255,208,201,
+  195,255,72,137,132,253,240,14,36,233,255,72,184,237,237,72,137,40,72,191,
+  237,237,72,137,230,72,184,237,237,252,255,208,201,195,255,72,191,237,237,
+  72,190,237,237,72,186,237,237,72,139,77,8,72,184,237,237,252,255,208,73,137,
+  195,255,72,139,132,253,240,14,36,233,255,201,65,252,255,227,255,249,255,72,
+  199,192,240,12,237,255,72,184,240,8,237,237,255,64,1,192,240,14,240,12,255,
+  64,41,192,240,14,240,12,255,64,15,175,192,240,18,240,16,255,64,137,192,240,
+  14,153,64,252,247,252,248,240,12,64,137,192,240,12,255,64,137,192,240,14,
+  153,64,252,247,252,248,240,12,64,137,208,240,12,255,64,33,192,240,14,240,
+  12,255,64,9,192,240,14,240,12,255,64,49,192,240,14,240,12,255,72,1,192,240,
+  14,240,12,255,72,41,192,240,14,240,12,255,72,15,175,192,240,18,240,16,255,
+  72,137,192,240,14,72,153,72,252,247,252,248,240,12,72,137,192,240,12,255,
+  72,137,192,240,14,72,153,72,252,247,252,248,240,12,72,137,208,240,12,255,
+  72,33,192,240,14,240,12,255,72,9,192,240,14,240,12,255,72,49,192,240,14,240,
+  12,255,64,129,192,240,12,239,255,129,133,233,239,255,15,132,245,255,15,133,
+  245,255,15,140,245,255,15,141,245,255,15,143,245,255,15,142,245,255,72,185,
+  237,237,249,133,1,255,252,233,245,249,255,64,133,192,240,14,240,12,255,72,
+  133,192,240,14,240,12,255,64,57,192,240,14,240,12,255,72,57,192,240,14,240,
+  12,255,252,233,245,255,72,185,237,237,72,139,1,240,14,255,72,185,237,237,
+  72,137,1,240,14,255,72,139,128,253,240,14,240,13,233,255,72,137,128,253,240,
+  14,240,13,233,255,72,137,192,240,14,255,250,3,15,31,0,232,0,0,0,0,249,255,
+  72,185,237,237,72,139,9,72,139,129,233,72,141,144,233,72,59,145,233,15,135,
+  244,247,72,137,145,233,72,186,237,237,72,137,144,233,248,2,254,1,248,1,255,
+  72,191,237,237,72,184,237,237,252,255,208,255,252,233,244,2,254,0,64,139,
+  128,253,240,14,240,13,233,255
+};
+
+#line 4 "java/dynasm_x64.dasc"
+
+// System V AMD64 integer argument registers.
+static const int arg_regs[] = { 7 /* rdi */, 6 /* rsi */, 2 /* rdx */, 1 /* rcx */, 8 /* r8 */, 9 /* r9 */ };
+
+static const size_t nr_arg_regs = sizeof(arg_regs) / sizeof(arg_regs[0]);
+
+static const int no_reg = -1;
+
+static const int rax = 0;
+static const int rcx = 1;
+
+// Callee-saved registers that hold locals picked by the register allocator.
+static const int local_regs[] = { 3 /* rbx */, 12 /* r12 */, 13 /* r13 */, 14 /* r14 */, 15 /* r15 */ };
+
+static const size_t nr_local_regs = sizeof(local_regs) / sizeof(local_regs[0]);
+
+// Operand stack slots map to registers by depth so that every block agrees
+// on where the stack lives. Deeper slots are spilled to the frame, and so
+// are the registers that are live across a call. rax, rcx and rdx are left
+// as scratch registers.
+static const int stack_regs[] = { 6 /* rsi */, 7 /* rdi */, 8 /* r8 */, 9 /* r9 */, 10 /* r10 */, 11 /* r11 */ };
+
+static const size_t nr_stack_regs = sizeof(stack_regs) / sizeof(stack_regs[0]);
+
+//
+// The frame below the saved frame pointer holds the slots of locals, of
+// operand stack slots, and of the callee-saved registers that the method
+// uses.
+//
+static int32_t local(uint16_t idx)
+{
+    return -8 * (idx + 1);
+}
+
+static int32_t aligned_frame_size(size_t nr_slots)
+{
+    return (nr_slots * 8 + 15) & ~15;
+}
+
+int32_t dynasm_translator::stack_slot(uint16_t depth)
+{
+    return local(_method->max_locals + depth);
+}
+
+int32_t dynasm_translator::save_slot(size_t idx)
+{
+    return local(_method->max_locals + _method->max_stack + idx);
+}
+
+int dynasm_translator::stack_reg(uint16_t depth)
+{
+    return depth < nr_stack_regs ? stack_regs[depth] : no_reg;
+}
+
+void dynasm_translator::enter_frame()
+{
+    //|  push rbp
+    //|  mov rbp, rsp
+    //|  sub rsp, aligned_frame_size(_method->max_locals + _method->max_stack + nr_local_regs)
+    dasm_put(Dst, 0, aligned_frame_size(_method->max_locals + _method->max_stack + nr_local_regs));
+#line 63 "java/dynasm_x64.dasc"
+
+    for (size_t i = 0; i < nr_local_regs; i++) {
+        if (_saved_regs[i]) {
+            //|  mov [rbp+save_slot(i)], Rq(local_regs[i])
+            dasm_put(Dst, 10, (local_regs[i]), save_slot(i));
+#line 67 "java/dynasm_x64.dasc"
+        }
+    }
+}
+
+void dynasm_translator::leave_frame()
+{
+    for (size_t i = 0; i < nr_local_regs; i++) {
+        if (_saved_regs[i]) {
+            //|  mov Rq(local_regs[i]), [rbp+save_slot(i)]
+            dasm_put(Dst, 18, (local_regs[i]), save_slot(i));
+#line 76 "java/dynasm_x64.dasc"
+        }
+    }
+    //|  leave
+    //|  ret
+    dasm_put(Dst, 26);
+#line 80 "java/dynasm_x64.dasc"
+
+    _reachable = false;
+}
+
+void dynasm_translator::prologue()
+{
+    std::vector<argument> args;
+    if (!parse_args(_method, args) || args.size() > nr_arg_regs) {
+        bailout();
+        return;
+    }
+
+    allocate_registers();
+    compute_live_refs();
+
+    enter_frame();
+
+    for (size_t i = 0; i < args.size(); i++) {
+        auto reg = _local_regs[args[i].slot];
+        if (reg != no_reg) {
+            //|  mov Rq(reg), Rq(arg_regs[i])
+            dasm_put(Dst, 29, (arg_regs[i]), (reg));
+#line 101 "java/dynasm_x64.dasc"
+        } else {
+            //|  mov [rbp+local(args[i].slot)], Rq(arg_regs[i])
+            dasm_put(Dst, 10, (arg_regs[i]), local(args[i].slot));
+#line 103 "java/dynasm_x64.dasc"
+        }
+    }
+}
+
+void dynasm_translator::osr_prologue(std::shared_ptr<basic_block> bblock)
+{
+    allocate_registers();
+    compute_live_refs();
+
+    enter_frame();
+
+    // Copy the interpreter's locals, passed in rdi, to the compiled frame.
+    // Registers are loaded only for the locals that are live at the entry
+    // because a register may be shared by locals whose intervals do not
+    // overlap.
+    for (auto& interval : _intervals) {
+        if (interval.reg != no_reg && interval.start <= bblock->start && bblock->start <= interval.end) {
+            //|  mov Rq(interval.reg), [rdi+8*interval.idx]
+            dasm_put(Dst, 37, (interval.reg), 8*interval.idx);
+#line 121 "java/dynasm_x64.dasc"
+        }
+    }
+    for (uint16_t idx = 0; idx < _method->max_locals; idx++) {
+        if (_local_regs[idx] == no_reg) {
+            //|  mov rax, [rdi+8*idx]
+            //|  mov [rbp+local(idx)], rax
+            dasm_put(Dst, 45, 8*idx, local(idx));
+#line 127 "java/dynasm_x64.dasc"
+        }
+    }
+
+    op_goto(bblock);
+}
+
+//
+// i2c adapter: called with the locals of an interpreter frame in rdi.
+//
+static void emit_i2c_adapter(dynasm_backend* ctx, const std::vector<argument>& args, void* target)
+{
+    //|  push  rbp
+    //|  mov   rbp, rsp
+    //|  mov   r10, rdi
+    dasm_put(Dst, 54);
+#line 141 "java/dynasm_x64.dasc"
+    for (size_t i = 0; i < args.size(); i++) {
+        //|  mov   Rq(arg_regs[i]), [r10+8*args[i].slot]
+        dasm_put(Dst, 63, (arg_regs[i]), 8*args[i].slot);
+#line 143 "java/dynasm_x64.dasc"
+    }
+    //|  mov64 rax, reinterpret_cast<uintptr_t>(target)
+    //|  call  rax
+    //|  leave
+    //|  ret
+    dasm_put(Dst, 71, (unsigned int)(reinterpret_cast<uintptr_t>(target)), (unsigned int)((reinterpret_cast<uintptr_t>(target))>>32));
+#line 148 "java/dynasm_x64.dasc"
+}
+
+//
+// c2i adapter: spills the register arguments to an array on the stack and
+// passes it to call_interpreter(). It leaves its frame pointer, which links
+// to the caller's frame and return address, for the stack walk of a
+// safepoint (see frame_anchor).
+//
+static void emit_c2i_adapter(dynasm_backend* ctx, method* method, size_t nr_args)
+{
+    //|  push  rbp
+    //|  mov   rbp, rsp
+    //|  sub   rsp, aligned_frame_size(nr_args)
+    dasm_put(Dst, 0, aligned_frame_size(nr_args));
+#line 161 "java/dynasm_x64.dasc"
+    for (size_t i = 0; i < nr_args; i++) {
+        //|  mov   [rsp+8*i], Rq(arg_regs[i])
+        dasm_put(Dst, 81, (arg_regs[i]), 8*i);
+#line 163 "java/dynasm_x64.dasc"
+    }
+    assert(thread::current()->single_threaded());
+    //|  mov64 rax, reinterpret_cast<uintptr_t>(&thread::current()->last_compiled_fp)
+    //|  mov   [rax], rbp
+    //|  mov64 rdi, reinterpret_cast<uintptr_t>(method)
+    //|  mov   rsi, rsp
+    //|  mov64 rax, reinterpret_cast<uintptr_t>(&call_interpreter)
+    //|  call  rax
+    //|  leave
+    //|  ret
+    dasm_put(Dst, 90, (unsigned int)(reinterpret_cast<uintptr_t>(&thread::current()->last_compiled_fp)), (unsigned int)((reinterpret_cast<uintptr_t>(&thread::current()->last_compiled_fp))>>32), (unsigned int)(reinterpret_cast<uintptr_t>(method)), (unsigned int)((reinterpret_cast<uintptr_t>(method))>>32), (unsigned int)(reinterpret_cast<uintptr_t>(&call_interpreter)), (unsigned int)((reinterpret_cast<uintptr_t>(&call_interpreter))>>32));
+#line 173 "java/dynasm_x64.dasc"
+}
+
+//
+// Resolution stub: has the callee's native signature. It saves the argument
+// registers, resolves the call and continues at the code it resolved to.
+//
+static void emit_resolution_stub(dynasm_backend* ctx, method* method, size_t nr_args, void* c2i)
+{
+    //|  push  rbp
+    //|  mov   rbp, rsp
+    //|  sub   rsp, aligned_frame_size(nr_args)
+    dasm_put(Dst, 0, aligned_frame_size(nr_args));
+#line 184 "java/dynasm_x64.dasc"
+    for (size_t i = 0; i < nr_args; i++) {
+        //|  mov   [rsp+8*i], Rq(arg_regs[i])
+        dasm_put(Dst, 81, (arg_regs[i]), 8*i);
+#line 186 "java/dynasm_x64.dasc"
+    }
+    //|  mov64 rdi, reinterpret_cast<uintptr_t>(ctx)
+    //|  mov64 rsi, reinterpret_cast<uintptr_t>(method)
+    //|  mov64 rdx, reinterpret_cast<uintptr_t>(c2i)
+    //|  mov   rcx, [rbp+8]
+    //|  mov64 rax, reinterpret_cast<uintptr_t>(&dynasm_backend::resolve_call)
+    //|  call  rax
+    //|  mov   r11, rax
+    dasm_put(Dst, 114, (unsigned int)(reinterpret_cast<uintptr_t>(ctx)), (unsigned int)((reinterpret_cast<uintptr_t>(ctx))>>32), (unsigned int)(reinterpret_cast<uintptr_t>(method)), (unsigned int)((reinterpret_cast<uintptr_t>(method))>>32), (unsigned int)(reinterpret_cast<uintptr_t>(c2i)), (unsigned int)((reinterpret_cast<uintptr_t>(c2i))>>32), (unsigned int)(reinterpret_cast<uintptr_t>(&dynasm_backend::resolve_call)), (unsigned int)((reinterpret_cast<uintptr_t>(&dynasm_backend::resolve_call))>>32));
+#line 194 "java/dynasm_x64.dasc"
+    for (size_t i = 0; i < nr_args; i++) {
+        //|  mov   Rq(arg_regs[i]), [rsp+8*i]
+        dasm_put(Dst, 141, (arg_regs[i]), 8*i);
+#line 196 "java/dynasm_x64.dasc"
+    }
+    //|  leave
+    //|  jmp   r11
+    dasm_put(Dst, 150);
+#line 199 "java/dynasm_x64.dasc"
+}
+
+//
+// Operand stack slots are accessed through registers. use() returns the
+// register that holds the slot at 'depth', loading a spilled slot into
+// 'scratch' first. def() returns the register to compute the slot in and
+// commit() writes it back if the slot is spilled.
+//
+void dynasm_translator::load(int reg, uint16_t depth)
+{
+    auto src = stack_reg(depth);
+    if (src == no_reg) {
+        //|  mov Rq(reg), [rbp+stack_slot(depth)]
+        dasm_put(Dst, 18, (reg), stack_slot(depth));
+#line 212 "java/dynasm_x64.dasc"
+    } else if (src != reg) {
+        //|  mov Rq(reg), Rq(src)
+        dasm_put(Dst, 29, (src), (reg));
+#line 214 "java/dynasm_x64.dasc"
+    }
+}
+
+void dynasm_translator::store(uint16_t depth, int reg)
+{
+    auto dst = stack_reg(depth);
+    if (dst == no_reg) {
+        //|  mov [rbp+stack_slot(depth)], Rq(reg)
+        dasm_put(Dst, 10, (reg), stack_slot(depth));
+#line 222 "java/dynasm_x64.dasc"
+    } else if (dst != reg) {
+        //|  mov Rq(dst), Rq(reg)
+        dasm_put(Dst, 29, (reg), (dst));
+#line 224 "java/dynasm_x64.dasc"
+    }
+}
+
+void dynasm_translator::move(uint16_t to, uint16_t from)
+{
+    store(to, use(from, rax));
+}
+
+int dynasm_translator::use(uint16_t depth, int scratch)
+{
+    auto reg = stack_reg(depth);
+    if (reg == no_reg) {
+        load(scratch, depth);
+        return scratch;
+    }
+    return reg;
+}
+
+int dynasm_translator::def(uint16_t depth, int scratch)
+{
+    auto reg = stack_reg(depth);
+    return reg != no_reg ? reg : scratch;
+}
+
+void dynasm_translator::commit(uint16_t depth, int reg)
+{
+    if (stack_reg(depth) == no_reg) {
+        store(depth, reg);
+    }
+}
+
+// Record the operand stack at the entry of 'bblock'. Blocks are laid out in
+// bytecode order and every path into a block has to agree on its depth. The
+// verifier guarantees that they agree on the types.
+void dynasm_translator::enter(std::shared_ptr<basic_block> bblock)
+{
+    auto it = _block_stack.find(bblock->start);
+    if (it == _block_stack.end()) {
+        _block_stack.insert(std::make_pair(bblock->start, std::vector<bool>(_stack_refs.begin(), _stack_refs.begin() + _depth)));
+    } else if (it->second.size() != _depth) {
+        bailout();
+    }
+}
+
+void dynasm_translator::begin(std::shared_ptr<basic_block> bblock)
+{
+    if (!_reachable) {
+        auto it = _block_stack.find(bblock->start);
+        _depth = 0;
+        if (it != _block_stack.end()) {
+            _depth = it->second.size();
+            std::copy(it->second.begin(), it->second.end(), _stack_refs.begin());
+        }
+        _reachable = true;
+    }
+    enter(bblock);
+
+    //|=>bblock->start:
+    dasm_put(Dst, 156, bblock->start);
+#line 282 "java/dynasm_x64.dasc"
+}
+
+void dynasm_translator::op_const(type t, int64_t value)
+{
+    auto reg = def(_depth, rax);
+    if (value == static_cast<int32_t>(value)) {
+        //|  mov Rq(reg), static_cast<int32_t>(value)
+        dasm_put(Dst, 158, (reg), static_cast<int32_t>(value));
+#line 289 "java/dynasm_x64.dasc"
+    } else {
+        //|  mov64 Rq(reg), value
+        dasm_put(Dst, 165, (reg), (unsigned int)(value), (unsigned int)((value)>>32));
+#line 291 "java/dynasm_x64.dasc"
+    }
+    _stack_refs[_depth] = t == type::t_ref;
+    commit(_depth++, reg);
+}
+
+void dynasm_translator::op_load(type t, uint16_t idx)
+{
+    auto dst = def(_depth, rax);
+    auto src = _local_regs[idx];
+    if (src != no_reg) {
+        //|  mov Rq(dst), Rq(src)
+        dasm_put(Dst, 29, (src), (dst));
+#line 302 "java/dynasm_x64.dasc"
+    } else {
+        //|  mov Rq(dst), [rbp+local(idx)]
+        dasm_put(Dst, 18, (dst), local(idx));
+#line 304 "java/dynasm_x64.dasc"
+    }
+    _stack_refs[_depth] = t == type::t_ref;
+    commit(_depth++, dst);
+}
+
+void dynasm_translator::op_store(type t, uint16_t idx)
+{
+    auto src = use(--_depth, rax);
+    auto dst = _local_regs[idx];
+    if (dst != no_reg) {
+        //|  mov Rq(dst), Rq(src)
+        dasm_put(Dst, 29, (src), (dst));
+#line 315 "java/dynasm_x64.dasc"
+    } else {
+        //|  mov [rbp+local(idx)], Rq(src)
+        dasm_put(Dst, 10, (src), local(idx));
+#line 317 "java/dynasm_x64.dasc"
+    }
+}
+
+void dynasm_translator::op_pop()
+{
+    _depth--;
+}
+
+void dynasm_translator::op_dup()
+{
+    move(_depth, _depth - 1);
+    _stack_refs[_depth] = _stack_refs[_depth - 1];
+    _depth++;
+}
+
+void dynasm_translator::op_dup_x1()
+{
+    move(_depth, _depth - 1);
+    move(_depth - 1, _depth - 2);
+    move(_depth - 2, _depth);
+    _stack_refs[_depth] = _stack_refs[_depth - 1];
+    _stack_refs[_depth - 1] = _stack_refs[_depth - 2];
+    _stack_refs[_depth - 2] = _stack_refs[_depth];
+    _depth++;
+}
+
+void dynasm_translator::op_swap()
+{
+    load(rcx, _depth - 1);
+    move(_depth - 1, _depth - 2);
+    store(_depth - 2, rcx);
+    std::vector<bool>::swap(_stack_refs[_depth - 1], _stack_refs[_depth - 2]);
+}
+
+void dynasm_translator::op_binary(type t, binop op)
+{
+    auto rhs = use(_depth - 1, rcx);
+    auto lhs = use(_depth - 2, rax);
+
+    switch (t) {
+    case type::t_int: {
+        switch (op) {
+        case binop::op_add:
+            //|  add Rd(lhs), Rd(rhs)
+            dasm_put(Dst, 172, (rhs), (lhs));
+#line 361 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_sub:
+            //|  sub Rd(lhs), Rd(rhs)
+            dasm_put(Dst, 180, (rhs), (lhs));
+#line 364 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_mul:
+            //|  imul Rd(lhs), Rd(rhs)
+            dasm_put(Dst, 188, (lhs), (rhs));
+#line 367 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_div:
+            //|  mov  eax, Rd(lhs)
+            //|  cdq
+            //|  idiv Rd(rhs)
+            //|  mov  Rd(lhs), eax
+            dasm_put(Dst, 197, (lhs), (rhs), (lhs));
+#line 373 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_rem:
+            //|  mov  eax, Rd(lhs)
+            //|  cdq
+            //|  idiv Rd(rhs)
+            //|  mov  Rd(lhs), edx
+            dasm_put(Dst, 216, (lhs), (rhs), (lhs));
+#line 379 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_and:
+            //|  and Rd(lhs), Rd(rhs)
+            dasm_put(Dst, 235, (rhs), (lhs));
+#line 382 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_or:
+            //|  or Rd(lhs), Rd(rhs)
+            dasm_put(Dst, 243, (rhs), (lhs));
+#line 385 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_xor:
+            //|  xor Rd(lhs), Rd(rhs)
+            dasm_put(Dst, 251, (rhs), (lhs));
+#line 388 "java/dynasm_x64.dasc"
+            break;
+        default: bailout(); return;
+        }
+        break;
+    }
+    case type::t_long: {
+        switch (op) {
+        case binop::op_add:
+            //|  add Rq(lhs), Rq(rhs)
+            dasm_put(Dst, 259, (rhs), (lhs));
+#line 397 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_sub:
+            //|  sub Rq(lhs), Rq(rhs)
+            dasm_put(Dst, 267, (rhs), (lhs));
+#line 400 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_mul:
+            //|  imul Rq(lhs), Rq(rhs)
+            dasm_put(Dst, 275, (lhs), (rhs));
+#line 403 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_div:
+            //|  mov  rax, Rq(lhs)
+            //|  cqo
+            //|  idiv Rq(rhs)
+            //|  mov  Rq(lhs), rax
+            dasm_put(Dst, 284, (lhs), (rhs), (lhs));
+#line 409 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_rem:
+            //|  mov  rax, Rq(lhs)
+            //|  cqo
+            //|  idiv Rq(rhs)
+            //|  mov  Rq(lhs), rdx
+            dasm_put(Dst, 304, (lhs), (rhs), (lhs));
+#line 415 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_and:
+            //|  and Rq(lhs), Rq(rhs)
+            dasm_put(Dst, 324, (rhs), (lhs));
+#line 418 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_or:
+            //|  or Rq(lhs), Rq(rhs)
+            dasm_put(Dst, 332, (rhs), (lhs));
+#line 421 "java/dynasm_x64.dasc"
+            break;
+        case binop::op_xor:
+            //|  xor Rq(lhs), Rq(rhs)
+            dasm_put(Dst, 340, (rhs), (lhs));
+#line 424 "java/dynasm_x64.dasc"
+            break;
+        default: bailout(); return;
+        }
+        break;
+    }
+    default: bailout(); return;
+    }
+
+    _depth--;
+
+    commit(_depth - 1, lhs);
+}
+
+void dynasm_translator::op_iinc(uint8_t idx, jint value)
+{
+    auto reg = _local_regs[idx];
+    if (reg != no_reg) {
+        //|  add Rd(reg), value
+        dasm_put(Dst, 348, (reg), value);
+#line 442 "java/dynasm_x64.dasc"
+    } else {
+        //|  add dword [rbp+local(idx)], value
+        dasm_put(Dst, 355, local(idx), value);
+#line 444 "java/dynasm_x64.dasc"
+    }
+}
+
+static cmpop negate(cmpop op)
+{
+    switch (op) {
+    case cmpop::op_cmpeq: return cmpop::op_cmpne;
+    case cmpop::op_cmpne: return cmpop::op_cmpeq;
+    case cmpop::op_cmplt: return cmpop::op_cmpge;
+    case cmpop::op_cmpge: return cmpop::op_cmplt;
+    case cmpop::op_cmpgt: return cmpop::op_cmple;
+    case cmpop::op_cmple: return cmpop::op_cmpgt;
+    default:              assert(0);
+    }
+}
+
+void dynasm_translator::jump(cmpop op, int label)
+{
+    switch (op) {
+    case cmpop::op_cmpeq:
+        //|  je =>label
+        dasm_put(Dst, 360, label);
+#line 465 "java/dynasm_x64.dasc"
+        break;
+    case cmpop::op_cmpne:
+        //|  jne =>label
+        dasm_put(Dst, 364, label);
+#line 468 "java/dynasm_x64.dasc"
+        break;
+    case cmpop::op_cmplt:
+        //|  jl =>label
+        dasm_put(Dst, 368, label);
+#line 471 "java/dynasm_x64.dasc"
+        break;
+    case cmpop::op_cmpge:
+        //|  jge =>label
+        dasm_put(Dst, 372, label);
+#line 474 "java/dynasm_x64.dasc"
+        break;
+    case cmpop::op_cmpgt:
+        //|  jg =>label
+        dasm_put(Dst, 376, label);
+#line 477 "java/dynasm_x64.dasc"
+        break;
+    case cmpop::op_cmple:
+        //|  jle =>label
+        dasm_put(Dst, 380, label);
+#line 480 "java/dynasm_x64.dasc"
+        break;
+    }
+}
+
+//
+// Safepoint poll. The load faults while a safepoint is armed. rcx is
+// scratch at every poll, and rax may hold the return value.
+//
+void dynasm_translator::poll(stack_map map)
+{
+    int label = new_label();
+
+    //|  mov64 rcx, reinterpret_cast<uintptr_t>(safepoint_poll_page())
+    //|=>label:
+    //|  test [rcx], eax
+    dasm_put(Dst, 384, (unsigned int)(reinterpret_cast<uintptr_t>(safepoint_poll_page())), (unsigned int)((reinterpret_cast<uintptr_t>(safepoint_poll_page()))>>32), label);
+#line 495 "java/dynasm_x64.dasc"
+
+    _stack_maps.push_back(map_site{label, std::move(map)});
+}
+
+// Back-edges poll on the taken path only. Loop headers are expected to have
+// an empty operand stack, so the stack map only has to cover locals.
+void dynasm_translator::branch(cmpop op, std::shared_ptr<basic_block> bblock)
+{
+    enter(bblock);
+
+    if (bblock->start > _bci) {
+        jump(op, bblock->start);
+        return;
+    }
+    if (_depth) {
+        bailout();
+        return;
+    }
+    int skip = new_label();
+    jump(negate(op), skip);
+    poll(live_refs(bblock->start));
+    //|  jmp =>bblock->start
+    //|=>skip:
+    dasm_put(Dst, 392, bblock->start, skip);
+#line 518 "java/dynasm_x64.dasc"
+}
+
+void dynasm_translator::op_if(type t, cmpop op, std::shared_ptr<basic_block> bblock)
+{
+    auto reg = use(--_depth, rax);
+    if (t == type::t_int) {
+        //|  test Rd(reg), Rd(reg)
+        dasm_put(Dst, 397, (reg), (reg));
+#line 525 "java/dynasm_x64.dasc"
+    } else {
+        //|  test Rq(reg), Rq(reg)
+        dasm_put(Dst, 405, (reg), (reg));
+#line 527 "java/dynasm_x64.dasc"
+    }
+    branch(op, bblock);
+}
+
+void dynasm_translator::op_if_cmp(type t, cmpop op, std::shared_ptr<basic_block> bblock)
+{
+    auto rhs = use(--_depth, rcx);
+    auto lhs = use(--_depth, rax);
+    if (t == type::t_int) {
+        //|  cmp Rd(lhs), Rd(rhs)
+        dasm_put(Dst, 413, (rhs), (lhs));
+#line 537 "java/dynasm_x64.dasc"
+    } else {
+        //|  cmp Rq(lhs), Rq(rhs)
+        dasm_put(Dst, 421, (rhs), (lhs));
+#line 539 "java/dynasm_x64.dasc"
+    }
+    branch(op, bblock);
+}
+
+void dynasm_translator::op_goto(std::shared_ptr<basic_block> bblock)
+{
+    enter(bblock);
+
+    if (bblock->start <= _bci) {
+        if (_depth) {
+            bailout();
+            return;
+        }
+        poll(live_refs(bblock->start));
+    }
+    //|  jmp =>bblock->start
+    dasm_put(Dst, 429, bblock->start);
+#line 555 "java/dynasm_x64.dasc"
+
+    _reachable = false;
+}
+
+// Locals are dead at a return, so only a returned reference is live at the
+// poll.
+void dynasm_translator::op_ret()
+{
+    load(rax, --_depth);
+    stack_map map;
+    if (_method->returns_reference()) {
+        map.regs.push_back(rax);
+    }
+    poll(std::move(map));
+    leave_frame();
+}
+
+void dynasm_translator::op_ret_void()
+{
+    poll(stack_map());
+    leave_frame();
+}
+
+void dynasm_translator::op_getstatic(type t, field* field)
+{
+    auto dst = def(_depth, rax);
+    //|  mov64 rcx, reinterpret_cast<uintptr_t>(&field->value)
+    //|  mov   Rq(dst), [rcx]
+    dasm_put(Dst, 433, (unsigned int)(reinterpret_cast<uintptr_t>(&field->value)), (unsigned int)((reinterpret_cast<uintptr_t>(&field->value))>>32), (dst));
+#line 583 "java/dynasm_x64.dasc"
+    _stack_refs[_depth] = t == type::t_ref;
+    commit(_depth++, dst);
+}
+
+void dynasm_translator::op_putstatic(type t, field* field)
+{
+    auto src = use(--_depth, rax);
+    //|  mov64 rcx, reinterpret_cast<uintptr_t>(&field->value)
+    //|  mov   [rcx], Rq(src)
+    dasm_put(Dst, 443, (unsigned int)(reinterpret_cast<uintptr_t>(&field->value)), (unsigned int)((reinterpret_cast<uintptr_t>(&field->value))>>32), (src));
+#line 592 "java/dynasm_x64.dasc"
+}
+
+void dynasm_translator::op_getfield(type t, field* field)
+{
+    auto obj = use(_depth - 1, rax);
+    //|  mov  Rq(obj), [Rq(obj)+field->offset]
+    dasm_put(Dst, 453, (obj), (obj), field->offset);
+#line 598 "java/dynasm_x64.dasc"
+    _stack_refs[_depth - 1] = t == type::t_ref;
+    commit(_depth - 1, obj);
+}
+
+void dynasm_translator::op_putfield(type t, field* field)
+{
+    auto src = use(--_depth, rcx);
+    auto obj = use(--_depth, rax);
+    //|  mov  [Rq(obj)+field->offset], Rq(src)
+    dasm_put(Dst, 463, (src), (obj), field->offset);
+#line 607 "java/dynasm_x64.dasc"
+}
+
+// Operand stack registers are caller-saved. Spill the ones below 'depth' to
+// their frame slots around a call.
+void dynasm_translator::save_stack(uint16_t depth)
+{
+    for (uint16_t i = 0; i < depth && i < nr_stack_regs; i++) {
+        //|  mov [rbp+stack_slot(i)], Rq(stack_reg(i))
+        dasm_put(Dst, 10, (stack_reg(i)), stack_slot(i));
+#line 615 "java/dynasm_x64.dasc"
+    }
+}
+
+void dynasm_translator::restore_stack(uint16_t depth)
+{
+    for (uint16_t i = 0; i < depth && i < nr_stack_regs; i++) {
+        //|  mov Rq(stack_reg(i)), [rbp+stack_slot(i)]
+        dasm_put(Dst, 18, (stack_reg(i)), stack_slot(i));
+#line 622 "java/dynasm_x64.dasc"
+    }
+}
+
+// Local registers are callee-saved, but the ones that hold a reference that
+// is live after the call at 'bci' go to their frame slots so that the stack
+// map of the call site can describe them (see call_refs()).
+void dynasm_translator::save_locals(uint16_t bci)
+{
+    for (uint16_t idx = 0; idx < _method->max_locals; idx++) {
+        if (_live_refs[bci][idx] && _local_regs[idx] != no_reg) {
+            //|  mov [rbp+local(idx)], Rq(_local_regs[idx])
+            dasm_put(Dst, 10, (_local_regs[idx]), local(idx));
+#line 633 "java/dynasm_x64.dasc"
+        }
+    }
+}
+
+void dynasm_translator::restore_locals(uint16_t bci)
+{
+    for (uint16_t idx = 0; idx < _method->max_locals; idx++) {
+        if (_live_refs[bci][idx] && _local_regs[idx] != no_reg) {
+            //|  mov Rq(_local_regs[idx]), [rbp+local(idx)]
+            dasm_put(Dst, 18, (_local_regs[idx]), local(idx));
+#line 642 "java/dynasm_x64.dasc"
+        }
+    }
+}
+
+// Move the arguments on top of the operand stack, starting at depth 'base',
+// to the argument registers. Stack and argument registers overlap, so a
+// move whose destination is still to be read waits, and rax breaks cycles.
+void dynasm_translator::pass_args(uint16_t base, size_t nr_args)
+{
+    struct arg_move {
+        int      dst;
+        int      src;
+        uint16_t depth;
+    };
+    std::vector<arg_move> moves;
+    for (size_t i = 0; i < nr_args; i++) {
+        moves.push_back(arg_move{arg_regs[i], stack_reg(base + i), static_cast<uint16_t>(base + i)});
+    }
+
+    while (!moves.empty()) {
+        auto ready = std::find_if(moves.begin(), moves.end(), [&](const arg_move& move) {
+            return std::none_of(moves.begin(), moves.end(), [&](const arg_move& other) {
+                return other.src == move.dst && &other != &move;
+            });
+        });
+        if (ready == moves.end()) {
+            auto blocked = std::find_if(moves.begin(), moves.end(), [&](const arg_move& move) {
+                return move.src == moves.front().dst;
+            });
+            //|  mov rax, Rq(blocked->src)
+            dasm_put(Dst, 473, (blocked->src));
+#line 672 "java/dynasm_x64.dasc"
+            blocked->src = rax;
+            continue;
+        }
+        if (ready->src == no_reg) {
+            //|  mov Rq(ready->dst), [rbp+stack_slot(ready->depth)]
+            dasm_put(Dst, 18, (ready->dst), stack_slot(ready->depth));
+#line 677 "java/dynasm_x64.dasc"
+        } else if (ready->src != ready->dst) {
+            //|  mov Rq(ready->dst), Rq(ready->src)
+            dasm_put(Dst, 29, (ready->src), (ready->dst));
+#line 679 "java/dynasm_x64.dasc"
+        }
+        moves.erase(ready);
+    }
+}
+
+void dynasm_translator::op_invokestatic(method* target)
+{
+    std::vector<argument> args;
+    if (!parse_args(target, args) || args.size() > nr_arg_regs) {
+        bailout();
+        return;
+    }
+
+    auto* stub = ctx->resolution_stub(target);
+    if (!stub) {
+        bailout();
+        return;
+    }
+
+    uint16_t base = _depth - args.size();
+    uint16_t next = _bci + opcode_length[JVM_OPC_invokestatic];
+
+    save_stack(base);
+    save_locals(next);
+
+    pass_args(base, args.size());
+
+    // Align the displacement of the call so that it can be patched while
+    // other threads run the code.
+    int label = new_label();
+
+    //|  .align 4
+    //|  .byte 0x0f, 0x1f, 0x00
+    //|  .byte 0xe8
+    //|  .dword 0
+    //|=>label:
+    dasm_put(Dst, 479, label);
+#line 715 "java/dynasm_x64.dasc"
+
+    _call_sites.push_back(call_site{label, stub});
+    _stack_maps.push_back(map_site{label, call_refs(next, base)});
+
+    restore_locals(next);
+    restore_stack(base);
+
+    _depth = base;
+
+    if (!target->returns_void()) {
+        _stack_refs[_depth] = target->returns_reference();
+        store(_depth++, rax);
+    }
+}
+
+//
+// Objects are bump-allocated from the thread's allocation buffer inline.
+// The call to gc_new_object() that switches to a new buffer is kept out of
+// line in the cold section. Java code runs on a single thread, so the
+// address of its buffer pointer is a constant (see thread::current()).
+//
+void dynasm_translator::op_new(klass* klass)
+{
+    assert(thread::current()->single_threaded());
+
+    auto* buffer = thread::current()->alloc_buffer();
+
+    //|  mov64 rcx, reinterpret_cast<uintptr_t>(buffer)
+    //|  mov   rcx, [rcx]
+    //|  mov   rax, [rcx+memory_block::next_offset()]
+    //|  lea   rdx, [rax+klass->instance_size]
+    //|  cmp   rdx, [rcx+memory_block::end_offset()]
+    //|  ja    >1
+    //|  mov   [rcx+memory_block::next_offset()], rdx
+    //|  mov64 rdx, reinterpret_cast<uintptr_t>(klass)
+    //|  mov   [rax+offsetof(object, klass)], rdx
+    //|2:
+    //|.cold
+    dasm_put(Dst, 491, (unsigned int)(reinterpret_cast<uintptr_t>(buffer)), (unsigned int)((reinterpret_cast<uintptr_t>(buffer))>>32), memory_block::next_offset(), klass->instance_size, memory_block::end_offset(), memory_block::next_offset(), (unsigned int)(reinterpret_cast<uintptr_t>(klass)), (unsigned int)((reinterpret_cast<uintptr_t>(klass))>>32), offsetof(object, klass));
+#line 753 "java/dynasm_x64.dasc"
+    //|1:
+    dasm_put(Dst, 530);
+#line 754 "java/dynasm_x64.dasc"
+    save_stack(_depth);
+    //|  mov64 rdi, reinterpret_cast<uintptr_t>(klass)
+    //|  mov64 rax, reinterpret_cast<uintptr_t>(&gc_new_object)
+    //|  call  rax
+    dasm_put(Dst, 533, (unsigned int)(reinterpret_cast<uintptr_t>(klass)), (unsigned int)((reinterpret_cast<uintptr_t>(klass))>>32), (unsigned int)(reinterpret_cast<uintptr_t>(&gc_new_object)), (unsigned int)((reinterpret_cast<uintptr_t>(&gc_new_object))>>32));
+#line 758 "java/dynasm_x64.dasc"
+    restore_stack(_depth);
+    //|  jmp   <2
+    //|.code
+    dasm_put(Dst, 545);
+#line 761 "java/dynasm_x64.dasc"
+
+    _stack_refs[_depth] = true;
+    store(_depth++, rax);
+}
+
+void dynasm_translator::op_arraylength()
+{
+    auto obj = use(_depth - 1, rax);
+    //|  mov  Rd(obj), [Rq(obj)+offsetof(array, length)]
+    dasm_put(Dst, 551, (obj), (obj), offsetof(array, length));
+#line 770 "java/dynasm_x64.dasc"
+    _stack_refs[_depth - 1] = false;
+    commit(_depth - 1, obj);
+}
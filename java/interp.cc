@@ -1,10 +1,13 @@
 #include "hornet/java.hh"
+#include "hornet/safepoint.hh"
 
 #include "hornet/translator.hh"
 #include "hornet/vm.hh"
 
 #include <cassert>
+#include <cstring>
 #include <stack>
+#include <utility>
 
 #include <classfile_constants.h>
 #include <jni.h>
@@ -35,54 +38,71 @@ array* from_value<array*>(value_t value)
     return reinterpret_cast<array*>(value);
 }
 
-template<typename T>
-void op_const(frame& frame, T value)
+template<>
+char* from_value<char*>(value_t value)
 {
-    frame.ostack.push(to_value<T>(value));
+    return reinterpret_cast<char*>(value);
 }
 
-void op_load(frame& frame, uint16_t idx)
+//
+// Instructions address local variables and operand stack slots uniformly as
+// registers, which are value slot indices relative to the frame's locals.
+//
+template<typename T>
+T read_const(const char* code, uint16_t& pc)
 {
-    frame.ostack.push(frame.locals[idx]);
+    auto* src = reinterpret_cast<const T*>(code + pc);
+    pc += sizeof(T);
+    return *src;
 }
 
-void op_store(frame& frame, uint16_t idx)
+value_t& read_reg(frame& frame, const char* code, uint16_t& pc)
 {
-    frame.locals[idx] = frame.ostack.top();
-    frame.ostack.pop();
+    auto reg = read_const<uint16_t>(code, pc);
+    return frame.locals[reg];
 }
 
-void op_pop(frame& frame)
+//
+// The value that an instruction computes for the very next one is kept in
+// 'tos', the cached top of the operand stack, instead of in its register.
+// Instructions that read or write the cached value do not encode that
+// register at all.
+//
+// Only one slot is cached, on purpose. Locals and constants are operands
+// of the register form and never pass through the operand stack, so a
+// second cached slot would only pay off for an instruction whose operands
+// are both computed by the two instructions before it. That is rare, and
+// mostly around calls, which spill the operands anyway. It would also
+// double the number of instruction variants.
+//
+template<bool cached>
+value_t& read_reg(frame& frame, const char* code, uint16_t& pc, value_t& tos)
 {
-    frame.ostack.pop();
+    if (cached) {
+        return tos;
+    }
+    return read_reg(frame, code, pc);
 }
 
-void op_dup(frame& frame)
+template<typename T>
+void op_const(frame& frame, const char* code, uint16_t& pc)
 {
-    auto value = frame.ostack.top();
-    frame.ostack.push(value);
+    auto& dst = read_reg(frame, code, pc);
+    dst = to_value(read_const<T>(code, pc));
 }
 
-void op_dup_x1(frame& frame)
+void op_move(frame& frame, const char* code, uint16_t& pc)
 {
-    auto value1 = frame.ostack.top();
-    frame.ostack.pop();
-    auto value2 = frame.ostack.top();
-    frame.ostack.pop();
-
-    frame.ostack.push(value1);
-    frame.ostack.push(value2);
-    frame.ostack.push(value1);
+    auto& dst = read_reg(frame, code, pc);
+    auto& src = read_reg(frame, code, pc);
+    dst = src;
 }
 
-void op_swap(frame& frame)
+void op_swap(frame& frame, const char* code, uint16_t& pc)
 {
-    auto value1 = frame.ostack.top();
-    frame.ostack.pop();
-    auto value2 = frame.ostack.top();
-    frame.ostack.pop();
-    frame.ostack.push(value1);
-    frame.ostack.push(value2);
+    auto& reg1 = read_reg(frame, code, pc);
+    auto& reg2 = read_reg(frame, code, pc);
+    std::swap(reg1, reg2);
 }
 
 enum class unop {
@@ -99,12 +119,12 @@ T eval(unop op, T a)
 }
 
 template<typename T>
-void op_unary(frame& frame, unop op)
+void op_unary(frame& frame, unop op, const char* code, uint16_t& pc)
 {
-    auto value = from_value<T>(frame.ostack.top());
-    frame.ostack.pop();
+    auto& dst = read_reg(frame, code, pc);
+    auto value = from_value<T>(read_reg(frame, code, pc));
     auto result = eval(op, value);
-    frame.ostack.push(to_value<T>(result));
+    dst = to_value<T>(result);
 }
 
 template<typename T>
@@ -147,15 +167,24 @@ jdouble eval(binop op, jdouble a, jdouble b)
     }
 }
 
-template<typename T>
-void op_binary(frame& frame, binop op)
+template<typename T, bool tos_in = false, bool tos_out = false>
+void op_binary(frame& frame, binop op, const char* code, uint16_t& pc, value_t& tos)
 {
-    auto value2 = from_value<T>(frame.ostack.top());
-    frame.ostack.pop();
-    auto value1 = from_value<T>(frame.ostack.top());
-    frame.ostack.pop();
+    auto& dst = read_reg<tos_out>(frame, code, pc, tos);
+    auto value1 = from_value<T>(read_reg<tos_in>(frame, code, pc, tos));
+    auto value2 = from_value<T>(read_reg(frame, code, pc));
     auto result = eval(op, value1, value2);
-    frame.ostack.push(to_value<T>(result));
+    dst = to_value<T>(result);
+}
+
+template<typename T, bool tos_in = false, bool tos_out = false>
+void op_binary_imm(frame& frame, binop op, const char* code, uint16_t& pc, value_t& tos)
+{
+    auto& dst = read_reg<tos_out>(frame, code, pc, tos);
+    auto value1 = from_value<T>(read_reg<tos_in>(frame, code, pc, tos));
+    auto value2 = read_const<T>(code, pc);
+    auto result = eval(op, value1, value2);
+    dst = to_value<T>(result);
 }
 
 void op_iinc(frame& frame, uint16_t idx, jint value)
@@ -179,14 +208,13 @@ T eval(shiftop op, T a, jint b)
 }
 
 template<typename T>
-void op_shift(frame& frame, shiftop op, jint mask)
+void op_shift(frame& frame, shiftop op, jint mask, const char* code, uint16_t& pc)
 {
-    auto value2 = from_value<jint>(frame.ostack.top());
-    frame.ostack.pop();
-    auto value1 = from_value<T>(frame.ostack.top());
-    frame.ostack.pop();
+    auto& dst = read_reg(frame, code, pc);
+    auto value1 = from_value<T>(read_reg(frame, code, pc));
+    auto value2 = from_value<jint>(read_reg(frame, code, pc));
     auto result = eval(op, value1, value2 & mask);
-    frame.ostack.push(to_value<T>(result));
+    dst = to_value<T>(result);
 }
 
 template<typename T>
@@ -203,76 +231,222 @@ bool eval(cmpop op, T a, T b)
     }
 }
 
-template<typename T>
-void op_if_cmp(method* method, frame& frame, cmpop op, int16_t offset)
-{
-    uint8_t opc = method->code[frame.pc];
-    auto value2 = from_value<T>(frame.ostack.top());
-    frame.ostack.pop();
-    auto value1 = from_value<T>(frame.ostack.top());
-    frame.ostack.pop();
-    if (eval(op, value1, value2)) {
-        frame.pc += offset;
-    } else {
-        frame.pc += opcode_length[opc];
+//
+// Branches carry the target, the bytecode index of the target for
+// on-stack replacement, and a pointer to the branch's counters in the
+// method's side table.
+//
+// A back-edge returns the OSR entry point of the loop once the back-edge
+// itself has been taken often enough for the loop to be compiled. The
+// entry point is called with the frame's locals and runs the rest of the
+// method.
+//
+// The target bytecode index is no_osr_bci if the operand stack is not
+// empty at the target.
+//
+// Methods are profiled from the moment they are translated, so the
+// profile always exists when the interpreter runs.
+//
+// The counters double as the interpreter's safepoint polls. The cached top
+// of stack is never live across a call or a branch, so every value of the
+// thread is in its Java stack at a poll.
+void count_invocation(method* method)
+{
+    safepoint_poll();
+
+    auto* data = method->data.load(std::memory_order_relaxed);
+    data->invocation_count++;
+    if (tiered_compilation) {
+        check_tier_up(method, data);
     }
 }
 
-void op_goto(frame& frame, int16_t offset)
+osr_entry_t count_backedge(frame& frame, uint16_t target_bci, const branch_counter* counter)
 {
-    frame.pc += offset;
+    safepoint_poll();
+
+    auto* method = frame.method;
+    auto* data = method->data.load(std::memory_order_relaxed);
+    data->backedge_count++;
+    if (!tiered_compilation) {
+        return nullptr;
+    }
+    check_tier_up(method, data);
+    if (target_bci == no_osr_bci || counter->taken < osr_threshold) {
+        return nullptr;
+    }
+    return static_cast<tiered_backend*>(_backend)->osr_entry(method, target_bci);
 }
 
-void op_getstatic(method* method, frame& frame, uint16_t idx)
+osr_entry_t op_branch(frame& frame, bool cond, const char* code, uint16_t& pc)
 {
-    auto field = method->klass->resolve_field(idx);
-    assert(field != nullptr);
-    frame.ostack.push(field->value);
+    auto target = read_const<uint16_t>(code, pc);
+    auto target_bci = read_const<uint16_t>(code, pc);
+    auto* counter = read_const<branch_counter*>(code, pc);
+    if (!cond) {
+        counter->not_taken++;
+        return nullptr;
+    }
+    counter->taken++;
+    osr_entry_t osr = nullptr;
+    if (target < pc) {
+        osr = count_backedge(frame, target_bci, counter);
+    }
+    pc = target;
+    return osr;
+}
+
+template<typename T, bool tos_in = false>
+osr_entry_t op_if(frame& frame, cmpop op, const char* code, uint16_t& pc, value_t& tos)
+{
+    auto value = from_value<T>(read_reg<tos_in>(frame, code, pc, tos));
+    return op_branch(frame, eval(op, value, T(0)), code, pc);
 }
 
-void op_invokestatic(method* target, frame& frame)
+template<typename T, bool tos_in = false>
+osr_entry_t op_if_cmp(frame& frame, cmpop op, const char* code, uint16_t& pc, value_t& tos)
 {
-    hornet::frame new_frame(target->max_locals);
-    for (int i = 0; i < target->args_count; i++) {
-        auto arg_idx = target->args_count - i - 1;
-        new_frame.locals[arg_idx] = frame.ostack.top();
-        frame.ostack.pop();
+    auto value1 = from_value<T>(read_reg<tos_in>(frame, code, pc, tos));
+    auto value2 = from_value<T>(read_reg(frame, code, pc));
+    return op_branch(frame, eval(op, value1, value2), code, pc);
+}
+
+osr_entry_t op_iinc_if_icmp(frame& frame, cmpop op, const char* code, uint16_t& pc, value_t& tos)
+{
+    auto idx   = read_const<uint8_t>(code, pc);
+    auto value = read_const<jint>(code, pc);
+    op_iinc(frame, idx, value);
+    return op_if_cmp<jint>(frame, op, code, pc, tos);
+}
+
+osr_entry_t op_goto(frame& frame, const char* code, uint16_t& pc)
+{
+    auto target = read_const<uint16_t>(code, pc);
+    auto target_bci = read_const<uint16_t>(code, pc);
+    auto* counter = read_const<branch_counter*>(code, pc);
+    counter->taken++;
+    osr_entry_t osr = nullptr;
+    if (target < pc) {
+        osr = count_backedge(frame, target_bci, counter);
     }
-    auto result = hornet::_backend->execute(target, new_frame);
-    if (target->return_type != &jvm_void_klass) {
-        frame.ostack.push(result);
+    pc = target;
+    return osr;
+}
+
+//
+// Field accesses are quickened at translation time: static fields carry the
+// address of the value and instance fields the offset in the object.
+//
+template<bool tos_out = false>
+void op_getstatic(frame& frame, const char* code, uint16_t& pc, value_t& tos)
+{
+    auto& dst = read_reg<tos_out>(frame, code, pc, tos);
+    auto* addr = read_const<value_t*>(code, pc);
+    dst = *addr;
+}
+
+void op_putstatic(frame& frame, const char* code, uint16_t& pc)
+{
+    auto& src = read_reg(frame, code, pc);
+    auto* addr = read_const<value_t*>(code, pc);
+    *addr = src;
+}
+
+template<bool tos_out = false>
+void op_getfield(frame& frame, const char* code, uint16_t& pc, value_t& tos)
+{
+    auto& dst = read_reg<tos_out>(frame, code, pc, tos);
+    auto* obj = from_value<char*>(read_reg(frame, code, pc));
+    auto offset = read_const<uint32_t>(code, pc);
+    assert(obj != nullptr);
+    dst = *reinterpret_cast<value_t*>(obj + offset);
+}
+
+void op_putfield(frame& frame, const char* code, uint16_t& pc)
+{
+    auto* obj = from_value<char*>(read_reg(frame, code, pc));
+    auto& src = read_reg(frame, code, pc);
+    auto offset = read_const<uint32_t>(code, pc);
+    assert(obj != nullptr);
+    *reinterpret_cast<value_t*>(obj + offset) = src;
+}
+
+frame* op_invokestatic(method* target, frame* caller)
+{
+    auto* callee = frame::enter(target, caller);
+    callee->code = static_cast<const char*>(_backend->entry_point(target));
+    count_invocation(target);
+    return callee;
+}
+
+// Call a method that has been promoted to a compiled tier. The arguments
+// are already in place on the caller's operand stack.
+void op_invoke_compiled(method* target, compiled_code* compiled, frame* caller)
+{
+    count_invocation(target);
+    auto* callee = frame::enter(target, caller);
+    auto value = compiled->backend->run(target, compiled->entry_point, *callee);
+    callee->leave();
+    if (!target->returns_void()) {
+        *caller->sp = value;
     }
 }
 
-void op_new(frame& frame)
+frame* op_return(frame* callee)
 {
-    auto obj = gc_new_object(nullptr);
-    frame.ostack.push(to_value<object*>(obj));
+    auto* caller = callee->caller;
+    callee->leave();
+    return caller;
 }
 
-void op_arraylength(frame& frame)
+void op_new(frame& frame, const char* code, uint16_t& pc)
 {
-    auto* arrayref = from_value<array*>(frame.ostack.top());
-    frame.ostack.pop();
+    auto& dst = read_reg(frame, code, pc);
+    auto* klass = read_const<struct klass*>(code, pc);
+    auto obj = gc_new_object(klass);
+    dst = to_value<object*>(obj);
+}
+
+void op_arraylength(frame& frame, const char* code, uint16_t& pc)
+{
+    auto& dst = read_reg(frame, code, pc);
+    auto* arrayref = from_value<array*>(read_reg(frame, code, pc));
+    auto* range = read_const<array_length_range*>(code, pc);
     assert(arrayref != nullptr);
-    frame.ostack.push(arrayref->length);
+    range->record(arrayref->length);
+    dst = arrayref->length;
 }
 
 //
 // Instruction opcodes of the interpreter.
 //
+// The interpreter executes a three-address register form of the bytecode.
+// Operands are registers (see read_reg()) followed by immediates, with the
+// destination register first. The translator tracks the operand stack
+// statically, so JVM loads, stores and stack shuffles mostly disappear:
+//
+//   - xxx_imm:        binop with an immediate right-hand operand
+//   - iinc_if_icmpxx: iinc; if_icmpxx on loop back-edges
+//
+// The value that an instruction computes for the next one is passed in the
+// cached top of stack (see read_reg()). Instructions come in variants for
+// the cache state:
+//
+//   - xxx_tos:        the result is left in the cached top of stack
+//   - tos_xxx:        the first operand is taken from the cached top of stack
+//
+// Each group of binop variants is in the same order as the plain binops so
+// that the translator can map between them.
+//
+// count_block starts every basic block under -XX:+PrintBytecodeNgrams.
+//
 // This enumeration needs to be in the same order as labels in dispatch_table.
 //
 enum class opc : uint8_t {
     iconst,
     lconst,
 
-    load,
-    store,
-
-    pop,
-    dup,
-    dup_x1,
+    move,
     swap,
 
     iadd,
@@ -319,40 +493,202 @@ enum class opc : uint8_t {
     if_icmpgt,
     if_icmple,
 
+    if_acmpeq,
+    if_acmpne,
+
+    ifeq,
+    ifne,
+    iflt,
+    ifge,
+    ifgt,
+    ifle,
+
+    ifnull,
+    ifnonnull,
+
     goto_,
 
     ret,
     ret_void,
 
     getstatic,
+    putstatic,
+    getfield,
+    putfield,
 
     invokestatic,
 
     new_,
 
     arraylength,
-};
 
-template<typename T>
-T read_const(const char* code, uint16_t& pc)
-{
-    auto* src = reinterpret_cast<const T*>(code + pc);
-    pc += sizeof(T);
-    return *src;
-}
+    iadd_imm,
+    isub_imm,
+    imul_imm,
+    idiv_imm,
+    irem_imm,
+    iand_imm,
+    ior_imm,
+    ixor_imm,
+
+    ladd_imm,
+    lsub_imm,
+    lmul_imm,
+    ldiv_imm,
+    lrem_imm,
+    land_imm,
+    lor_imm,
+    lxor_imm,
+
+    iinc_if_icmpeq,
+    iinc_if_icmpne,
+    iinc_if_icmplt,
+    iinc_if_icmpge,
+    iinc_if_icmpgt,
+    iinc_if_icmple,
+
+    count_block,
+
+    iadd_tos,
+    isub_tos,
+    imul_tos,
+    idiv_tos,
+    irem_tos,
+    iand_tos,
+    ior_tos,
+    ixor_tos,
+
+    ladd_tos,
+    lsub_tos,
+    lmul_tos,
+    ldiv_tos,
+    lrem_tos,
+    land_tos,
+    lor_tos,
+    lxor_tos,
+
+    iadd_imm_tos,
+    isub_imm_tos,
+    imul_imm_tos,
+    idiv_imm_tos,
+    irem_imm_tos,
+    iand_imm_tos,
+    ior_imm_tos,
+    ixor_imm_tos,
+
+    ladd_imm_tos,
+    lsub_imm_tos,
+    lmul_imm_tos,
+    ldiv_imm_tos,
+    lrem_imm_tos,
+    land_imm_tos,
+    lor_imm_tos,
+    lxor_imm_tos,
+
+    tos_iadd,
+    tos_isub,
+    tos_imul,
+    tos_idiv,
+    tos_irem,
+    tos_iand,
+    tos_ior,
+    tos_ixor,
+
+    tos_ladd,
+    tos_lsub,
+    tos_lmul,
+    tos_ldiv,
+    tos_lrem,
+    tos_land,
+    tos_lor,
+    tos_lxor,
+
+    tos_iadd_imm,
+    tos_isub_imm,
+    tos_imul_imm,
+    tos_idiv_imm,
+    tos_irem_imm,
+    tos_iand_imm,
+    tos_ior_imm,
+    tos_ixor_imm,
+
+    tos_ladd_imm,
+    tos_lsub_imm,
+    tos_lmul_imm,
+    tos_ldiv_imm,
+    tos_lrem_imm,
+    tos_land_imm,
+    tos_lor_imm,
+    tos_lxor_imm,
+
+    tos_iadd_tos,
+    tos_isub_tos,
+    tos_imul_tos,
+    tos_idiv_tos,
+    tos_irem_tos,
+    tos_iand_tos,
+    tos_ior_tos,
+    tos_ixor_tos,
+
+    tos_ladd_tos,
+    tos_lsub_tos,
+    tos_lmul_tos,
+    tos_ldiv_tos,
+    tos_lrem_tos,
+    tos_land_tos,
+    tos_lor_tos,
+    tos_lxor_tos,
+
+    tos_iadd_imm_tos,
+    tos_isub_imm_tos,
+    tos_imul_imm_tos,
+    tos_idiv_imm_tos,
+    tos_irem_imm_tos,
+    tos_iand_imm_tos,
+    tos_ior_imm_tos,
+    tos_ixor_imm_tos,
+
+    tos_ladd_imm_tos,
+    tos_lsub_imm_tos,
+    tos_lmul_imm_tos,
+    tos_ldiv_imm_tos,
+    tos_lrem_imm_tos,
+    tos_land_imm_tos,
+    tos_lor_imm_tos,
+    tos_lxor_imm_tos,
+
+    getstatic_tos,
+    getfield_tos,
+
+    tos_ifeq,
+    tos_ifne,
+    tos_iflt,
+    tos_ifge,
+    tos_ifgt,
+    tos_ifle,
+
+    tos_if_icmpeq,
+    tos_if_icmpne,
+    tos_if_icmplt,
+    tos_if_icmpge,
+    tos_if_icmpgt,
+    tos_if_icmple,
+
+    tos_ret,
+};
 
-value_t interp(frame& frame, const char *code)
+//
+// The interpreter is stackless: Java-to-Java calls and returns push and pop
+// frames on the Java stack within the dispatch loop instead of recursing.
+// The loop returns to native code when the entry frame returns.
+//
+value_t interp(frame* fp)
 {
     static void* dispatch_table[] = {
         &&op_iconst,
         &&op_lconst,
 
-        &&op_load,
-        &&op_store,
-
-        &&op_pop,
-        &&op_dup,
-        &&op_dup_x1,
+        &&op_move,
         &&op_swap,
 
         &&op_iadd,
@@ -399,154 +735,507 @@ value_t interp(frame& frame, const char *code)
         &&op_if_icmpgt,
         &&op_if_icmple,
 
+        &&op_if_acmpeq,
+        &&op_if_acmpne,
+
+        &&op_ifeq,
+        &&op_ifne,
+        &&op_iflt,
+        &&op_ifge,
+        &&op_ifgt,
+        &&op_ifle,
+
+        &&op_ifnull,
+        &&op_ifnonnull,
+
         &&op_goto,
 
         &&op_ret,
         &&op_ret_void,
 
         &&op_getstatic,
+        &&op_putstatic,
+        &&op_getfield,
+        &&op_putfield,
 
         &&op_invokestatic,
 
         &&op_new,
 
         &&op_arraylength,
+
+        &&op_iadd_imm,
+        &&op_isub_imm,
+        &&op_imul_imm,
+        &&op_idiv_imm,
+        &&op_irem_imm,
+        &&op_iand_imm,
+        &&op_ior_imm,
+        &&op_ixor_imm,
+
+        &&op_ladd_imm,
+        &&op_lsub_imm,
+        &&op_lmul_imm,
+        &&op_ldiv_imm,
+        &&op_lrem_imm,
+        &&op_land_imm,
+        &&op_lor_imm,
+        &&op_lxor_imm,
+
+        &&op_iinc_if_icmpeq,
+        &&op_iinc_if_icmpne,
+        &&op_iinc_if_icmplt,
+        &&op_iinc_if_icmpge,
+        &&op_iinc_if_icmpgt,
+        &&op_iinc_if_icmple,
+
+        &&op_count_block,
+
+        &&op_iadd_tos,
+        &&op_isub_tos,
+        &&op_imul_tos,
+        &&op_idiv_tos,
+        &&op_irem_tos,
+        &&op_iand_tos,
+        &&op_ior_tos,
+        &&op_ixor_tos,
+
+        &&op_ladd_tos,
+        &&op_lsub_tos,
+        &&op_lmul_tos,
+        &&op_ldiv_tos,
+        &&op_lrem_tos,
+        &&op_land_tos,
+        &&op_lor_tos,
+        &&op_lxor_tos,
+
+        &&op_iadd_imm_tos,
+        &&op_isub_imm_tos,
+        &&op_imul_imm_tos,
+        &&op_idiv_imm_tos,
+        &&op_irem_imm_tos,
+        &&op_iand_imm_tos,
+        &&op_ior_imm_tos,
+        &&op_ixor_imm_tos,
+
+        &&op_ladd_imm_tos,
+        &&op_lsub_imm_tos,
+        &&op_lmul_imm_tos,
+        &&op_ldiv_imm_tos,
+        &&op_lrem_imm_tos,
+        &&op_land_imm_tos,
+        &&op_lor_imm_tos,
+        &&op_lxor_imm_tos,
+
+        &&op_tos_iadd,
+        &&op_tos_isub,
+        &&op_tos_imul,
+        &&op_tos_idiv,
+        &&op_tos_irem,
+        &&op_tos_iand,
+        &&op_tos_ior,
+        &&op_tos_ixor,
+
+        &&op_tos_ladd,
+        &&op_tos_lsub,
+        &&op_tos_lmul,
+        &&op_tos_ldiv,
+        &&op_tos_lrem,
+        &&op_tos_land,
+        &&op_tos_lor,
+        &&op_tos_lxor,
+
+        &&op_tos_iadd_imm,
+        &&op_tos_isub_imm,
+        &&op_tos_imul_imm,
+        &&op_tos_idiv_imm,
+        &&op_tos_irem_imm,
+        &&op_tos_iand_imm,
+        &&op_tos_ior_imm,
+        &&op_tos_ixor_imm,
+
+        &&op_tos_ladd_imm,
+        &&op_tos_lsub_imm,
+        &&op_tos_lmul_imm,
+        &&op_tos_ldiv_imm,
+        &&op_tos_lrem_imm,
+        &&op_tos_land_imm,
+        &&op_tos_lor_imm,
+        &&op_tos_lxor_imm,
+
+        &&op_tos_iadd_tos,
+        &&op_tos_isub_tos,
+        &&op_tos_imul_tos,
+        &&op_tos_idiv_tos,
+        &&op_tos_irem_tos,
+        &&op_tos_iand_tos,
+        &&op_tos_ior_tos,
+        &&op_tos_ixor_tos,
+
+        &&op_tos_ladd_tos,
+        &&op_tos_lsub_tos,
+        &&op_tos_lmul_tos,
+        &&op_tos_ldiv_tos,
+        &&op_tos_lrem_tos,
+        &&op_tos_land_tos,
+        &&op_tos_lor_tos,
+        &&op_tos_lxor_tos,
+
+        &&op_tos_iadd_imm_tos,
+        &&op_tos_isub_imm_tos,
+        &&op_tos_imul_imm_tos,
+        &&op_tos_idiv_imm_tos,
+        &&op_tos_irem_imm_tos,
+        &&op_tos_iand_imm_tos,
+        &&op_tos_ior_imm_tos,
+        &&op_tos_ixor_imm_tos,
+
+        &&op_tos_ladd_imm_tos,
+        &&op_tos_lsub_imm_tos,
+        &&op_tos_lmul_imm_tos,
+        &&op_tos_ldiv_imm_tos,
+        &&op_tos_lrem_imm_tos,
+        &&op_tos_land_imm_tos,
+        &&op_tos_lor_imm_tos,
+        &&op_tos_lxor_imm_tos,
+
+        &&op_getstatic_tos,
+        &&op_getfield_tos,
+
+        &&op_tos_ifeq,
+        &&op_tos_ifne,
+        &&op_tos_iflt,
+        &&op_tos_ifge,
+        &&op_tos_ifgt,
+        &&op_tos_ifle,
+
+        &&op_tos_if_icmpeq,
+        &&op_tos_if_icmpne,
+        &&op_tos_if_icmplt,
+        &&op_tos_if_icmpge,
+        &&op_tos_if_icmpgt,
+        &&op_tos_if_icmple,
+
+        &&op_tos_ret,
     };
 
-    #define dispatch() goto *dispatch_table[(int)code[frame.pc++]]
+    const char* code = fp->code;
+
+    #define dispatch() goto *dispatch_table[static_cast<uint8_t>(code[fp->pc++])]
+
+    #define branch(insn) \
+        do { \
+            osr = insn; \
+            if (osr) { \
+                goto osr_migrate; \
+            } \
+            dispatch(); \
+        } while (0)
 
-    frame.pc = 0;
+    osr_entry_t osr;
+    value_t tos = 0;
 
     dispatch();
 
     while (1) {
-        op_iconst: {
-            auto value = read_const<jint>(code, frame.pc);
-            op_const(frame, value);
-            dispatch();
-        }
-        op_lconst: {
-            auto value = read_const<jlong>(code, frame.pc);
-            op_const(frame, value);
-            dispatch();
-        }
-        op_load: {
-            auto value = read_const<uint16_t>(code, frame.pc);
-            op_load(frame, value);
-            dispatch();
-        }
-        op_store: {
-            auto value = read_const<uint16_t>(code, frame.pc);
-            op_store(frame, value);
+        op_iconst: op_const<jint> (*fp, code, fp->pc); dispatch();
+        op_lconst: op_const<jlong>(*fp, code, fp->pc); dispatch();
+
+        op_move: op_move(*fp, code, fp->pc); dispatch();
+        op_swap: op_swap(*fp, code, fp->pc); dispatch();
+
+        op_iadd: op_binary<jint>   (*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_isub: op_binary<jint>   (*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_imul: op_binary<jint>   (*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_idiv: op_binary<jint>   (*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_irem: op_binary<jint>   (*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_iand: op_binary<jint>   (*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_ior:  op_binary<jint>   (*fp, binop::op_or,  code, fp->pc, tos); dispatch();
+        op_ixor: op_binary<jint>   (*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_ladd: op_binary<jlong>  (*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_lsub: op_binary<jlong>  (*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_lmul: op_binary<jlong>  (*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_ldiv: op_binary<jlong>  (*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_lrem: op_binary<jlong>  (*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_land: op_binary<jlong>  (*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_lor:  op_binary<jlong>  (*fp, binop::op_or,  code, fp->pc, tos); dispatch();
+        op_lxor: op_binary<jlong>  (*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_fadd: op_binary<jfloat> (*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_fsub: op_binary<jfloat> (*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_fmul: op_binary<jfloat> (*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_fdiv: op_binary<jfloat> (*fp, binop::op_div, code, fp->pc, tos); dispatch();
+
+        op_dadd: op_binary<jdouble>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_dsub: op_binary<jdouble>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_dmul: op_binary<jdouble>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_ddiv: op_binary<jdouble>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+
+        op_ishl: op_shift<jint> (*fp, shiftop::op_shl, 0x1f, code, fp->pc); dispatch();
+        op_lshl: op_shift<jlong>(*fp, shiftop::op_shl, 0x3f, code, fp->pc); dispatch();
+
+        op_ishr: op_shift<jint> (*fp, shiftop::op_shr, 0x1f, code, fp->pc); dispatch();
+        op_lshr: op_shift<jlong>(*fp, shiftop::op_shr, 0x3f, code, fp->pc); dispatch();
+
+        op_ineg: op_unary<jint>(*fp, unop::op_neg, code, fp->pc); dispatch();
+
+        op_ret_void: {
+            if (!fp->caller) {
+                return to_value<jobject>(nullptr);
+            }
+            fp = op_return(fp);
+            code = fp->code;
             dispatch();
         }
 
-        op_pop: {
-            op_pop(frame);
-            dispatch();
-        }
-        op_dup: {
-            op_dup(frame);
-            dispatch();
-        }
-        op_dup_x1: {
-            op_dup_x1(frame);
-            dispatch();
-        }
-        op_swap: {
-            op_swap(frame);
+        op_iinc: {
+            auto idx = read_const<uint8_t>(code, fp->pc);
+            auto value = read_const<jint>(code, fp->pc);
+            op_iinc(*fp, idx, value);
             dispatch();
         }
 
-        op_iadd: op_binary<jint>   (frame, binop::op_add); dispatch();
-        op_isub: op_binary<jint>   (frame, binop::op_sub); dispatch();
-        op_imul: op_binary<jint>   (frame, binop::op_mul); dispatch();
-        op_idiv: op_binary<jint>   (frame, binop::op_div); dispatch();
-        op_irem: op_binary<jint>   (frame, binop::op_rem); dispatch();
-        op_iand: op_binary<jint>   (frame, binop::op_and); dispatch();
-        op_ior:  op_binary<jint>   (frame, binop::op_or);  dispatch();
-        op_ixor: op_binary<jint>   (frame, binop::op_xor); dispatch();
-
-        op_ladd: op_binary<jlong>  (frame, binop::op_add); dispatch();
-        op_lsub: op_binary<jlong>  (frame, binop::op_sub); dispatch();
-        op_lmul: op_binary<jlong>  (frame, binop::op_mul); dispatch();
-        op_ldiv: op_binary<jlong>  (frame, binop::op_div); dispatch();
-        op_lrem: op_binary<jlong>  (frame, binop::op_rem); dispatch();
-        op_land: op_binary<jlong>  (frame, binop::op_and); dispatch();
-        op_lor:  op_binary<jlong>  (frame, binop::op_or);  dispatch();
-        op_lxor: op_binary<jlong>  (frame, binop::op_xor); dispatch();
-
-        op_fadd: op_binary<jfloat> (frame, binop::op_add); dispatch();
-        op_fsub: op_binary<jfloat> (frame, binop::op_sub); dispatch();
-        op_fmul: op_binary<jfloat> (frame, binop::op_mul); dispatch();
-        op_fdiv: op_binary<jfloat> (frame, binop::op_div); dispatch();
-
-        op_dadd: op_binary<jdouble>(frame, binop::op_add); dispatch();
-        op_dsub: op_binary<jdouble>(frame, binop::op_sub); dispatch();
-        op_dmul: op_binary<jdouble>(frame, binop::op_mul); dispatch();
-        op_ddiv: op_binary<jdouble>(frame, binop::op_div); dispatch();
-
-        op_ishl: op_shift<jint> (frame, shiftop::op_shl, 0x1f); dispatch();
-        op_lshl: op_shift<jlong>(frame, shiftop::op_shl, 0x3f); dispatch();
-
-        op_ishr: op_shift<jint> (frame, shiftop::op_shr, 0x1f); dispatch();
-        op_lshr: op_shift<jlong>(frame, shiftop::op_shr, 0x3f); dispatch();
-
-        op_ineg: op_unary<jint>(frame, unop::op_neg); dispatch();
-
-        op_ret_void:
-            return to_value<jobject>(nullptr);
-
-        op_iinc: {
-            auto idx = read_const<uint8_t>(code, frame.pc);
-            auto value = read_const<jint>(code, frame.pc);
-            op_iinc(frame, idx, value);
+        op_if_icmpeq: branch(op_if_cmp<jint>(*fp, cmpop::op_cmpeq, code, fp->pc, tos));
+        op_if_icmpne: branch(op_if_cmp<jint>(*fp, cmpop::op_cmpne, code, fp->pc, tos));
+        op_if_icmplt: branch(op_if_cmp<jint>(*fp, cmpop::op_cmplt, code, fp->pc, tos));
+        op_if_icmpge: branch(op_if_cmp<jint>(*fp, cmpop::op_cmpge, code, fp->pc, tos));
+        op_if_icmpgt: branch(op_if_cmp<jint>(*fp, cmpop::op_cmpgt, code, fp->pc, tos));
+        op_if_icmple: branch(op_if_cmp<jint>(*fp, cmpop::op_cmple, code, fp->pc, tos));
+
+        op_if_acmpeq: branch(op_if_cmp<value_t>(*fp, cmpop::op_cmpeq, code, fp->pc, tos));
+        op_if_acmpne: branch(op_if_cmp<value_t>(*fp, cmpop::op_cmpne, code, fp->pc, tos));
+
+        op_ifeq: branch(op_if<jint>(*fp, cmpop::op_cmpeq, code, fp->pc, tos));
+        op_ifne: branch(op_if<jint>(*fp, cmpop::op_cmpne, code, fp->pc, tos));
+        op_iflt: branch(op_if<jint>(*fp, cmpop::op_cmplt, code, fp->pc, tos));
+        op_ifge: branch(op_if<jint>(*fp, cmpop::op_cmpge, code, fp->pc, tos));
+        op_ifgt: branch(op_if<jint>(*fp, cmpop::op_cmpgt, code, fp->pc, tos));
+        op_ifle: branch(op_if<jint>(*fp, cmpop::op_cmple, code, fp->pc, tos));
+
+        op_ifnull:    branch(op_if<value_t>(*fp, cmpop::op_cmpeq, code, fp->pc, tos));
+        op_ifnonnull: branch(op_if<value_t>(*fp, cmpop::op_cmpne, code, fp->pc, tos));
+
+        op_goto: branch(op_goto(*fp, code, fp->pc));
+
+        // Leave the interpreter in the middle of a loop. The compiled code
+        // finishes the method and its result is returned to the caller.
+        osr_migrate: {
+            auto* method = fp->method;
+            auto value = osr(fp->locals);
+            if (!fp->caller) {
+                return value;
+            }
+            fp = op_return(fp);
+            code = fp->code;
+            if (!method->returns_void()) {
+                *fp->sp = value;
+            }
             dispatch();
         }
 
-        op_if_icmpeq:
-            assert(0);
-
-        op_if_icmpne:
-            assert(0);
-
-        op_if_icmplt:
-            assert(0);
-
-        op_if_icmpge:
-            assert(0);
-
-        op_if_icmpgt:
-            assert(0);
-
-        op_if_icmple:
-            assert(0);
-
-        op_goto:
-            auto offset = read_const<uint16_t>(code, frame.pc);
-            frame.pc = offset;
+        op_ret: {
+            auto value = read_reg(*fp, code, fp->pc);
+            if (!fp->caller) {
+                return value;
+            }
+            // The return value replaces the arguments on the caller's
+            // operand stack.
+            fp = op_return(fp);
+            code = fp->code;
+            *fp->sp = value;
             dispatch();
+        }
 
-        op_ret:
-            auto value = frame.ostack.top();
-            frame.ostack.pop();
-            return value;
-
-        op_getstatic:
-            assert(0);
+        op_getstatic: op_getstatic(*fp, code, fp->pc, tos); dispatch();
+        op_putstatic: op_putstatic(*fp, code, fp->pc); dispatch();
+        op_getfield:  op_getfield (*fp, code, fp->pc, tos); dispatch();
+        op_putfield:  op_putfield (*fp, code, fp->pc); dispatch();
 
         op_invokestatic: {
-            auto* target = read_const<method*>(code, frame.pc);
-            op_invokestatic(target, frame);
+            auto base = read_const<uint16_t>(code, fp->pc);
+            auto* target = read_const<method*>(code, fp->pc);
+            fp->sp = fp->locals + base + target->args_count;
+            auto* compiled = target->compiled.load(std::memory_order_acquire);
+            if (compiled) {
+                op_invoke_compiled(target, compiled, fp);
+                dispatch();
+            }
+            fp = op_invokestatic(target, fp);
+            code = fp->code;
             dispatch();
         }
         op_new:
-            op_new(frame);
+            op_new(*fp, code, fp->pc);
             dispatch();
 
         op_arraylength:
-            op_arraylength(frame);
+            op_arraylength(*fp, code, fp->pc);
+            dispatch();
+
+        op_iadd_imm: op_binary_imm<jint> (*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_isub_imm: op_binary_imm<jint> (*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_imul_imm: op_binary_imm<jint> (*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_idiv_imm: op_binary_imm<jint> (*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_irem_imm: op_binary_imm<jint> (*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_iand_imm: op_binary_imm<jint> (*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_ior_imm:  op_binary_imm<jint> (*fp, binop::op_or,  code, fp->pc, tos); dispatch();
+        op_ixor_imm: op_binary_imm<jint> (*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_ladd_imm: op_binary_imm<jlong>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_lsub_imm: op_binary_imm<jlong>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_lmul_imm: op_binary_imm<jlong>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_ldiv_imm: op_binary_imm<jlong>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_lrem_imm: op_binary_imm<jlong>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_land_imm: op_binary_imm<jlong>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_lor_imm:  op_binary_imm<jlong>(*fp, binop::op_or,  code, fp->pc, tos); dispatch();
+        op_lxor_imm: op_binary_imm<jlong>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_iinc_if_icmpeq: branch(op_iinc_if_icmp(*fp, cmpop::op_cmpeq, code, fp->pc, tos));
+        op_iinc_if_icmpne: branch(op_iinc_if_icmp(*fp, cmpop::op_cmpne, code, fp->pc, tos));
+        op_iinc_if_icmplt: branch(op_iinc_if_icmp(*fp, cmpop::op_cmplt, code, fp->pc, tos));
+        op_iinc_if_icmpge: branch(op_iinc_if_icmp(*fp, cmpop::op_cmpge, code, fp->pc, tos));
+        op_iinc_if_icmpgt: branch(op_iinc_if_icmp(*fp, cmpop::op_cmpgt, code, fp->pc, tos));
+        op_iinc_if_icmple: branch(op_iinc_if_icmp(*fp, cmpop::op_cmple, code, fp->pc, tos));
+
+        op_count_block:
+            (*read_const<uint64_t*>(code, fp->pc))++;
             dispatch();
+
+        op_iadd_tos: op_binary<jint, false, true>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_isub_tos: op_binary<jint, false, true>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_imul_tos: op_binary<jint, false, true>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_idiv_tos: op_binary<jint, false, true>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_irem_tos: op_binary<jint, false, true>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_iand_tos: op_binary<jint, false, true>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_ior_tos:  op_binary<jint, false, true>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_ixor_tos: op_binary<jint, false, true>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_ladd_tos: op_binary<jlong, false, true>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_lsub_tos: op_binary<jlong, false, true>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_lmul_tos: op_binary<jlong, false, true>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_ldiv_tos: op_binary<jlong, false, true>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_lrem_tos: op_binary<jlong, false, true>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_land_tos: op_binary<jlong, false, true>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_lor_tos:  op_binary<jlong, false, true>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_lxor_tos: op_binary<jlong, false, true>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_iadd_imm_tos: op_binary_imm<jint, false, true>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_isub_imm_tos: op_binary_imm<jint, false, true>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_imul_imm_tos: op_binary_imm<jint, false, true>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_idiv_imm_tos: op_binary_imm<jint, false, true>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_irem_imm_tos: op_binary_imm<jint, false, true>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_iand_imm_tos: op_binary_imm<jint, false, true>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_ior_imm_tos:  op_binary_imm<jint, false, true>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_ixor_imm_tos: op_binary_imm<jint, false, true>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_ladd_imm_tos: op_binary_imm<jlong, false, true>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_lsub_imm_tos: op_binary_imm<jlong, false, true>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_lmul_imm_tos: op_binary_imm<jlong, false, true>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_ldiv_imm_tos: op_binary_imm<jlong, false, true>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_lrem_imm_tos: op_binary_imm<jlong, false, true>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_land_imm_tos: op_binary_imm<jlong, false, true>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_lor_imm_tos:  op_binary_imm<jlong, false, true>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_lxor_imm_tos: op_binary_imm<jlong, false, true>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_tos_iadd: op_binary<jint, true, false>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_tos_isub: op_binary<jint, true, false>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_tos_imul: op_binary<jint, true, false>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_tos_idiv: op_binary<jint, true, false>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_tos_irem: op_binary<jint, true, false>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_tos_iand: op_binary<jint, true, false>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_tos_ior:  op_binary<jint, true, false>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_tos_ixor: op_binary<jint, true, false>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_tos_ladd: op_binary<jlong, true, false>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_tos_lsub: op_binary<jlong, true, false>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_tos_lmul: op_binary<jlong, true, false>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_tos_ldiv: op_binary<jlong, true, false>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_tos_lrem: op_binary<jlong, true, false>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_tos_land: op_binary<jlong, true, false>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_tos_lor:  op_binary<jlong, true, false>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_tos_lxor: op_binary<jlong, true, false>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_tos_iadd_imm: op_binary_imm<jint, true, false>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_tos_isub_imm: op_binary_imm<jint, true, false>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_tos_imul_imm: op_binary_imm<jint, true, false>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_tos_idiv_imm: op_binary_imm<jint, true, false>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_tos_irem_imm: op_binary_imm<jint, true, false>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_tos_iand_imm: op_binary_imm<jint, true, false>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_tos_ior_imm:  op_binary_imm<jint, true, false>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_tos_ixor_imm: op_binary_imm<jint, true, false>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_tos_ladd_imm: op_binary_imm<jlong, true, false>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_tos_lsub_imm: op_binary_imm<jlong, true, false>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_tos_lmul_imm: op_binary_imm<jlong, true, false>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_tos_ldiv_imm: op_binary_imm<jlong, true, false>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_tos_lrem_imm: op_binary_imm<jlong, true, false>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_tos_land_imm: op_binary_imm<jlong, true, false>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_tos_lor_imm:  op_binary_imm<jlong, true, false>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_tos_lxor_imm: op_binary_imm<jlong, true, false>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_tos_iadd_tos: op_binary<jint, true, true>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_tos_isub_tos: op_binary<jint, true, true>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_tos_imul_tos: op_binary<jint, true, true>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_tos_idiv_tos: op_binary<jint, true, true>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_tos_irem_tos: op_binary<jint, true, true>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_tos_iand_tos: op_binary<jint, true, true>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_tos_ior_tos:  op_binary<jint, true, true>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_tos_ixor_tos: op_binary<jint, true, true>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_tos_ladd_tos: op_binary<jlong, true, true>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_tos_lsub_tos: op_binary<jlong, true, true>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_tos_lmul_tos: op_binary<jlong, true, true>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_tos_ldiv_tos: op_binary<jlong, true, true>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_tos_lrem_tos: op_binary<jlong, true, true>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_tos_land_tos: op_binary<jlong, true, true>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_tos_lor_tos:  op_binary<jlong, true, true>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_tos_lxor_tos: op_binary<jlong, true, true>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_tos_iadd_imm_tos: op_binary_imm<jint, true, true>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_tos_isub_imm_tos: op_binary_imm<jint, true, true>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_tos_imul_imm_tos: op_binary_imm<jint, true, true>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_tos_idiv_imm_tos: op_binary_imm<jint, true, true>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_tos_irem_imm_tos: op_binary_imm<jint, true, true>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_tos_iand_imm_tos: op_binary_imm<jint, true, true>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_tos_ior_imm_tos:  op_binary_imm<jint, true, true>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_tos_ixor_imm_tos: op_binary_imm<jint, true, true>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_tos_ladd_imm_tos: op_binary_imm<jlong, true, true>(*fp, binop::op_add, code, fp->pc, tos); dispatch();
+        op_tos_lsub_imm_tos: op_binary_imm<jlong, true, true>(*fp, binop::op_sub, code, fp->pc, tos); dispatch();
+        op_tos_lmul_imm_tos: op_binary_imm<jlong, true, true>(*fp, binop::op_mul, code, fp->pc, tos); dispatch();
+        op_tos_ldiv_imm_tos: op_binary_imm<jlong, true, true>(*fp, binop::op_div, code, fp->pc, tos); dispatch();
+        op_tos_lrem_imm_tos: op_binary_imm<jlong, true, true>(*fp, binop::op_rem, code, fp->pc, tos); dispatch();
+        op_tos_land_imm_tos: op_binary_imm<jlong, true, true>(*fp, binop::op_and, code, fp->pc, tos); dispatch();
+        op_tos_lor_imm_tos:  op_binary_imm<jlong, true, true>(*fp, binop::op_or, code, fp->pc, tos); dispatch();
+        op_tos_lxor_imm_tos: op_binary_imm<jlong, true, true>(*fp, binop::op_xor, code, fp->pc, tos); dispatch();
+
+        op_getstatic_tos: op_getstatic<true>(*fp, code, fp->pc, tos); dispatch();
+        op_getfield_tos:  op_getfield<true> (*fp, code, fp->pc, tos); dispatch();
+
+        op_tos_ifeq: branch((op_if<jint, true>(*fp, cmpop::op_cmpeq, code, fp->pc, tos)));
+        op_tos_ifne: branch((op_if<jint, true>(*fp, cmpop::op_cmpne, code, fp->pc, tos)));
+        op_tos_iflt: branch((op_if<jint, true>(*fp, cmpop::op_cmplt, code, fp->pc, tos)));
+        op_tos_ifge: branch((op_if<jint, true>(*fp, cmpop::op_cmpge, code, fp->pc, tos)));
+        op_tos_ifgt: branch((op_if<jint, true>(*fp, cmpop::op_cmpgt, code, fp->pc, tos)));
+        op_tos_ifle: branch((op_if<jint, true>(*fp, cmpop::op_cmple, code, fp->pc, tos)));
+
+        op_tos_if_icmpeq: branch((op_if_cmp<jint, true>(*fp, cmpop::op_cmpeq, code, fp->pc, tos)));
+        op_tos_if_icmpne: branch((op_if_cmp<jint, true>(*fp, cmpop::op_cmpne, code, fp->pc, tos)));
+        op_tos_if_icmplt: branch((op_if_cmp<jint, true>(*fp, cmpop::op_cmplt, code, fp->pc, tos)));
+        op_tos_if_icmpge: branch((op_if_cmp<jint, true>(*fp, cmpop::op_cmpge, code, fp->pc, tos)));
+        op_tos_if_icmpgt: branch((op_if_cmp<jint, true>(*fp, cmpop::op_cmpgt, code, fp->pc, tos)));
+        op_tos_if_icmple: branch((op_if_cmp<jint, true>(*fp, cmpop::op_cmple, code, fp->pc, tos)));
+
+        op_tos_ret: {
+            if (!fp->caller) {
+                return tos;
+            }
+            fp = op_return(fp);
+            code = fp->code;
+            *fp->sp = tos;
+            dispatch();
+        }
     }
 }
 
@@ -558,6 +1247,10 @@ public:
     template<typename T>
     T trampoline();
 
+    size_t code_size() const {
+        return _code.size();
+    }
+
     virtual void prologue () override;
     virtual void begin(std::shared_ptr<basic_block> bblock) override;
     virtual void op_const (type t, int64_t value) override;
@@ -569,37 +1262,115 @@ public:
     virtual void op_swap() override;
     virtual void op_binary(type t, binop op) override;
     virtual void op_iinc(uint8_t idx, jint value) override;
+    virtual void op_if(type t, cmpop op, std::shared_ptr<basic_block> bblock) override;
     virtual void op_if_cmp(type t, cmpop op, std::shared_ptr<basic_block> bblock) override;
     virtual void op_goto(std::shared_ptr<basic_block> bblock) override;
     virtual void op_ret() override;
     virtual void op_ret_void() override;
+    virtual void op_getstatic(type t, field* field) override;
+    virtual void op_putstatic(type t, field* field) override;
+    virtual void op_getfield(type t, field* field) override;
+    virtual void op_putfield(type t, field* field) override;
     virtual void op_invokestatic(method* target) override;
-    virtual void op_new() override;
+    virtual void op_new(klass* klass) override;
     virtual void op_arraylength() override;
 
 private:
+    //
+    // An operand stack entry. The translator defers loads and constants:
+    // an entry refers either to a local variable, to its own operand stack
+    // slot or to an immediate that has not been materialized yet.
+    //
+    struct operand {
+        bool     imm;
+        type     t;
+        uint16_t reg;
+        int64_t  value;
+    };
+
+    static constexpr uint16_t no_insn = UINT16_MAX;
+
+    uint16_t stack_reg(size_t depth) const {
+        return _stack_base + depth;
+    }
+    bool in_stack(const operand& x) const {
+        return !x.imm && x.reg >= _stack_base;
+    }
+    void push_reg(type t, uint16_t reg) {
+        _stack.push_back(operand{false, t, reg, 0});
+    }
+    operand pop() {
+        auto x = _stack.back();
+        _stack.pop_back();
+        return x;
+    }
+    uint16_t materialize(operand& x, size_t depth);
+    void materialize(size_t depth) {
+        materialize(_stack[depth], depth);
+    }
+    void materialize_local(uint16_t idx);
+    void flush();
+    bool cache_tos(const operand& x);
+    void put_def(opc x, uint16_t dst) {
+        put_opc(x);
+        _def_pos = _pc;
+        put_const(dst);
+    }
+    void put_target(std::shared_ptr<basic_block> bblock);
+    // Branch targets and frame::pc are 16-bit offsets into the code.
+    void reserve(size_t size) {
+      assert(_code.size() + size <= UINT16_MAX);
+      _code.resize(_code.size() + size);
+    }
     void put_opc(opc x) {
-      _code.resize(_code.size() + sizeof(opc));
+      reserve(sizeof(opc));
       auto* code = _code.data();
       code[_pc++] = static_cast<uint8_t>(x);
     }
     template<typename T>
     void put_const(T x) {
-      _code.resize(_code.size() + sizeof(T));
+      reserve(sizeof(T));
       auto* code = _code.data() + _pc;
       auto* dst = reinterpret_cast<T*>(code);
       *dst = x;
       _pc += sizeof(T);
     }
     std::map<std::shared_ptr<basic_block>, uint16_t> _bblock_map;
+    // Branch target operands to patch when a forward branch target is reached.
+    std::multimap<std::shared_ptr<basic_block>, uint16_t> _fixups;
+    // Operand stack depth on entry to basic blocks that are branch targets.
+    std::map<std::shared_ptr<basic_block>, size_t> _bblock_depth;
     std::vector<uint8_t> _code;
     uint16_t _pc;
+    uint16_t _stack_base;
+    std::vector<operand> _stack;
+    // Can the current instruction be reached from the previous one?
+    bool _reachable;
+    // Destination operand of the last instruction, if it was a definition,
+    // so that a following store can retarget it to a local variable and a
+    // following use can take it from the cached top of stack.
+    uint16_t _def_pos;
+    uint16_t _def_end;
+    // Last iinc, for fusing it with a following if_icmp.
+    uint16_t _iinc_pos;
+    uint16_t _iinc_end;
+    uint8_t  _iinc_idx;
+    jint     _iinc_value;
 };
 
 interp_translator::interp_translator(method* method)
     : translator(method)
     , _pc(0)
+    , _stack_base(frame::ostack_offset(method))
+    , _reachable(true)
+    , _def_pos(0)
+    , _def_end(no_insn)
+    , _iinc_pos(0)
+    , _iinc_end(no_insn)
+    , _iinc_idx(0)
+    , _iinc_value(0)
 {
+    assert(_stack_base + method->max_stack < no_insn);
 }
 
 interp_translator::~interp_translator()
@@ -611,25 +1382,186 @@ template<typename T> T interp_translator::trampoline()
     return reinterpret_cast<T>(_code.data());
 }
 
+uint16_t interp_translator::materialize(operand& x, size_t depth)
+{
+    auto dst = stack_reg(depth);
+    if (x.imm) {
+        switch (x.t) {
+        case type::t_int:
+            put_def(opc::iconst, dst);
+            put_const<jint>(x.value);
+            break;
+        case type::t_long:
+        case type::t_ref:
+            put_def(opc::lconst, dst);
+            put_const<jlong>(x.value);
+            break;
+        default: assert(0);
+        }
+        _def_end = _pc;
+    } else if (x.reg != dst) {
+        put_def(opc::move, dst);
+        put_const(x.reg);
+        _def_end = _pc;
+    }
+    x = operand{false, x.t, dst, 0};
+    return dst;
+}
+
+// Materialize deferred loads of a local variable before it is written.
+void interp_translator::materialize_local(uint16_t idx)
+{
+    for (size_t depth = 0; depth < _stack.size(); depth++) {
+        auto& x = _stack[depth];
+        if (!x.imm && x.reg == idx) {
+            materialize(x, depth);
+        }
+    }
+}
+
+// Move every operand stack entry to its own slot. This is the state that
+// basic blocks are entered and left with.
+void interp_translator::flush()
+{
+    for (size_t depth = 0; depth < _stack.size(); depth++) {
+        materialize(depth);
+    }
+}
+
+static opc opc_offset(opc x, opc from, opc to)
+{
+    return static_cast<opc>(static_cast<int>(x) - static_cast<int>(from) + static_cast<int>(to));
+}
+
+static bool opc_in(opc x, opc first, opc last)
+{
+    return x >= first && x <= last;
+}
+
+// Variant of a definition that leaves its result in the cached top of
+// stack, or the definition itself if it has none.
+static opc tos_out_opc(opc x)
+{
+    if (opc_in(x, opc::iadd, opc::lxor)) {
+        return opc_offset(x, opc::iadd, opc::iadd_tos);
+    }
+    if (opc_in(x, opc::iadd_imm, opc::lxor_imm)) {
+        return opc_offset(x, opc::iadd_imm, opc::iadd_imm_tos);
+    }
+    if (opc_in(x, opc::tos_iadd, opc::tos_lxor)) {
+        return opc_offset(x, opc::tos_iadd, opc::tos_iadd_tos);
+    }
+    if (opc_in(x, opc::tos_iadd_imm, opc::tos_lxor_imm)) {
+        return opc_offset(x, opc::tos_iadd_imm, opc::tos_iadd_imm_tos);
+    }
+    switch (x) {
+    case opc::getstatic: return opc::getstatic_tos;
+    case opc::getfield:  return opc::getfield_tos;
+    default:             return x;
+    }
+}
+
+// Variant of a binop that takes its first operand from the cached top of
+// stack.
+static opc tos_in_opc(opc x)
+{
+    if (opc_in(x, opc::iadd, opc::lxor)) {
+        return opc_offset(x, opc::iadd, opc::tos_iadd);
+    }
+    assert(opc_in(x, opc::iadd_imm, opc::lxor_imm));
+    return opc_offset(x, opc::iadd_imm, opc::tos_iadd_imm);
+}
+
+//
+// If the last instruction computed 'x' into its operand stack slot, make it
+// leave the value in the cached top of stack instead and return true. The
+// caller then emits the tos_ variant of the instruction that uses 'x'.
+//
+bool interp_translator::cache_tos(const operand& x)
+{
+    if (!in_stack(x) || _def_end != _pc) {
+        return false;
+    }
+    auto* dst = reinterpret_cast<uint16_t*>(_code.data() + _def_pos);
+    if (*dst != x.reg) {
+        return false;
+    }
+    auto def = static_cast<opc>(_code[_def_pos - sizeof(opc)]);
+    auto cached = tos_out_opc(def);
+    if (cached == def) {
+        return false;
+    }
+    _code[_def_pos - sizeof(opc)] = static_cast<uint8_t>(cached);
+    _code.erase(_code.begin() + _def_pos, _code.begin() + _def_pos + sizeof(uint16_t));
+    _pc -= sizeof(uint16_t);
+    _def_end = no_insn;
+    return true;
+}
+
+void interp_translator::put_target(std::shared_ptr<basic_block> bblock)
+{
+    _bblock_depth[bblock] = _stack.size();
+
+    auto it = _bblock_map.find(bblock);
+
+    if (it == _bblock_map.end()) {
+        _fixups.insert(std::make_pair(bblock, _pc));
+        put_const<uint16_t>(0);
+        put_const<uint16_t>(no_osr_bci);
+        return;
+    }
+
+    uint16_t offset = it->second;
+
+    put_const(offset);
+    put_const<uint16_t>(_stack.empty() ? bblock->start : no_osr_bci);
+}
+
 void interp_translator::prologue()
 {
 }
 
 void interp_translator::begin(std::shared_ptr<basic_block> bblock)
 {
+    size_t depth;
+    if (_reachable) {
+        flush();
+        depth = _stack.size();
+    } else {
+        // A block that is only reached by a backward branch has not been
+        // seen yet. javac leaves the operand stack empty there.
+        auto it = _bblock_depth.find(bblock);
+        depth = it != _bblock_depth.end() ? it->second : 0;
+    }
+    _stack.clear();
+    for (size_t i = 0; i < depth; i++) {
+        push_reg(type::t_int, stack_reg(i));
+    }
+    _reachable = true;
+    _def_end = no_insn;
+    _iinc_end = no_insn;
+
     _bblock_map.insert(std::make_pair(bblock, _pc));
+
+    auto fixups = _fixups.equal_range(bblock);
+    for (auto it = fixups.first; it != fixups.second; it++) {
+        *reinterpret_cast<uint16_t*>(_code.data() + it->second) = _pc;
+    }
+    _fixups.erase(fixups.first, fixups.second);
+
+    if (print_bytecode_ngrams) {
+        put_opc(opc::count_block);
+        put_const(ngram_counter(_method, *bblock));
+    }
 }
 
 void interp_translator::op_const(type t, int64_t value)
 {
     switch (t) {
     case type::t_int:
-        put_opc(opc::iconst);
-        put_const<jint>(value);
-        break;
     case type::t_long:
-        put_opc(opc::lconst);
-        put_const<jlong>(value);
+    case type::t_ref:
+        _stack.push_back(operand{true, t, 0, value});
         break;
     default: assert(0);
     }
@@ -637,153 +1569,495 @@ void interp_translator::op_const(type t, int64_t value)
 
 void interp_translator::op_load(type t, uint16_t idx)
 {
-    put_opc(opc::load);
-    put_const(idx);
+    push_reg(t, idx);
 }
 
 void interp_translator::op_store(type t, uint16_t idx)
 {
-    put_opc(opc::store);
+    auto x = pop();
+
+    materialize_local(idx);
+
+    if (x.imm) {
+        switch (t) {
+        case type::t_int:  put_opc(opc::iconst); put_const(idx); put_const<jint>(x.value);  break;
+        case type::t_long:
+        case type::t_ref:  put_opc(opc::lconst); put_const(idx); put_const<jlong>(x.value); break;
+        default:           assert(0);
+        }
+        return;
+    }
+    if (x.reg == idx) {
+        return;
+    }
+    if (in_stack(x) && _def_end == _pc) {
+        // The value was just computed into the operand stack. Store it
+        // directly into the local variable instead.
+        auto* dst = reinterpret_cast<uint16_t*>(_code.data() + _def_pos);
+        if (*dst == x.reg) {
+            *dst = idx;
+            _def_end = no_insn;
+            return;
+        }
+    }
+    put_opc(opc::move);
     put_const(idx);
+    put_const(x.reg);
 }
 
 void interp_translator::op_pop()
 {
-    put_opc(opc::pop);
+    pop();
 }
 
 void interp_translator::op_dup()
 {
-    put_opc(opc::dup);
+    auto x = _stack.back();
+    _stack.push_back(x);
+    if (in_stack(x)) {
+        materialize(_stack.size() - 1);
+    }
 }
 
 void interp_translator::op_dup_x1()
 {
-    put_opc(opc::dup_x1);
+    auto depth = _stack.size() - 2;
+    auto value1 = _stack[depth + 1];
+    auto value2 = _stack[depth];
+    if (!in_stack(value1) && !in_stack(value2)) {
+        _stack[depth] = value1;
+        _stack[depth + 1] = value2;
+        _stack.push_back(value1);
+        return;
+    }
+    materialize(depth);
+    materialize(depth + 1);
+    _stack.push_back(operand{false, value1.t, stack_reg(depth + 2), 0});
+    put_opc(opc::move);
+    put_const(stack_reg(depth + 2));
+    put_const(stack_reg(depth + 1));
+    put_opc(opc::swap);
+    put_const(stack_reg(depth));
+    put_const(stack_reg(depth + 1));
+    std::swap(_stack[depth].t, _stack[depth + 1].t);
 }
 
 void interp_translator::op_swap()
 {
+    auto depth = _stack.size() - 2;
+    auto value1 = _stack[depth + 1];
+    auto value2 = _stack[depth];
+    if (!in_stack(value1) && !in_stack(value2)) {
+        _stack[depth] = value1;
+        _stack[depth + 1] = value2;
+        return;
+    }
+    materialize(depth);
+    materialize(depth + 1);
     put_opc(opc::swap);
+    put_const(stack_reg(depth));
+    put_const(stack_reg(depth + 1));
+    std::swap(_stack[depth].t, _stack[depth + 1].t);
 }
 
-void interp_translator::op_binary(type t, binop op)
+static opc binary_opc(type t, binop op)
 {
     switch (t) {
     case type::t_int: {
         switch (op) {
-        case binop::op_add: put_opc(opc::iadd); break;
-        case binop::op_sub: put_opc(opc::isub); break;
-        case binop::op_mul: put_opc(opc::imul); break;
-        case binop::op_div: put_opc(opc::idiv); break;
-        case binop::op_rem: put_opc(opc::irem); break;
-        case binop::op_and: put_opc(opc::iand); break;
-        case binop::op_or:  put_opc(opc::ior);  break;
-        case binop::op_xor: put_opc(opc::ixor); break;
-        default: assert(0);
+        case binop::op_add: return opc::iadd;
+        case binop::op_sub: return opc::isub;
+        case binop::op_mul: return opc::imul;
+        case binop::op_div: return opc::idiv;
+        case binop::op_rem: return opc::irem;
+        case binop::op_and: return opc::iand;
+        case binop::op_or:  return opc::ior;
+        case binop::op_xor: return opc::ixor;
+        default:            assert(0);
         }
-        break;
     }
     case type::t_long: {
         switch (op) {
-        case binop::op_add: put_opc(opc::ladd); break;
-        case binop::op_sub: put_opc(opc::lsub); break;
-        case binop::op_mul: put_opc(opc::lmul); break;
-        case binop::op_div: put_opc(opc::ldiv); break;
-        case binop::op_rem: put_opc(opc::lrem); break;
-        case binop::op_and: put_opc(opc::land); break;
-        case binop::op_or:  put_opc(opc::lor);  break;
-        case binop::op_xor: put_opc(opc::lxor); break;
-        default: assert(0);
+        case binop::op_add: return opc::ladd;
+        case binop::op_sub: return opc::lsub;
+        case binop::op_mul: return opc::lmul;
+        case binop::op_div: return opc::ldiv;
+        case binop::op_rem: return opc::lrem;
+        case binop::op_and: return opc::land;
+        case binop::op_or:  return opc::lor;
+        case binop::op_xor: return opc::lxor;
+        default:            assert(0);
         }
-        break;
     }
     default: assert(0);
     }
 }
 
-void interp_translator::op_iinc(uint8_t idx, jint value)
+static opc binary_imm_opc(type t, binop op)
 {
-    put_opc(opc::iinc);
-    put_const(idx);
-    put_const(value);
+    switch (t) {
+    case type::t_int: {
+        switch (op) {
+        case binop::op_add: return opc::iadd_imm;
+        case binop::op_sub: return opc::isub_imm;
+        case binop::op_mul: return opc::imul_imm;
+        case binop::op_div: return opc::idiv_imm;
+        case binop::op_rem: return opc::irem_imm;
+        case binop::op_and: return opc::iand_imm;
+        case binop::op_or:  return opc::ior_imm;
+        case binop::op_xor: return opc::ixor_imm;
+        default:            assert(0);
+        }
+    }
+    case type::t_long: {
+        switch (op) {
+        case binop::op_add: return opc::ladd_imm;
+        case binop::op_sub: return opc::lsub_imm;
+        case binop::op_mul: return opc::lmul_imm;
+        case binop::op_div: return opc::ldiv_imm;
+        case binop::op_rem: return opc::lrem_imm;
+        case binop::op_and: return opc::land_imm;
+        case binop::op_or:  return opc::lor_imm;
+        case binop::op_xor: return opc::lxor_imm;
+        default:            assert(0);
+        }
+    }
+    default: assert(0);
+    }
 }
 
-void interp_translator::op_if_cmp(type t, cmpop op, std::shared_ptr<basic_block> bblock)
+static opc if_opc(type t, cmpop op)
 {
     switch (t) {
     case type::t_int: {
         switch (op) {
-        case cmpop::op_cmpeq: put_opc(opc::if_icmpeq); break;
-        case cmpop::op_cmpne: put_opc(opc::if_icmpne); break;
-        case cmpop::op_cmplt: put_opc(opc::if_icmplt); break;
-        case cmpop::op_cmpge: put_opc(opc::if_icmpge); break;
-        case cmpop::op_cmpgt: put_opc(opc::if_icmpgt); break;
-        case cmpop::op_cmple: put_opc(opc::if_icmple); break;
+        case cmpop::op_cmpeq: return opc::ifeq;
+        case cmpop::op_cmpne: return opc::ifne;
+        case cmpop::op_cmplt: return opc::iflt;
+        case cmpop::op_cmpge: return opc::ifge;
+        case cmpop::op_cmpgt: return opc::ifgt;
+        case cmpop::op_cmple: return opc::ifle;
+        default:              assert(0);
+        }
+    }
+    case type::t_ref: {
+        switch (op) {
+        case cmpop::op_cmpeq: return opc::ifnull;
+        case cmpop::op_cmpne: return opc::ifnonnull;
         default:              assert(0);
         }
-        break;
     }
     default: assert(0);
     }
+}
 
-    auto it = _bblock_map.find(bblock);
+static opc if_cmp_opc(type t, cmpop op)
+{
+    if (t == type::t_ref) {
+        switch (op) {
+        case cmpop::op_cmpeq: return opc::if_acmpeq;
+        case cmpop::op_cmpne: return opc::if_acmpne;
+        default:              assert(0);
+        }
+    }
+    switch (op) {
+    case cmpop::op_cmpeq: return opc::if_icmpeq;
+    case cmpop::op_cmpne: return opc::if_icmpne;
+    case cmpop::op_cmplt: return opc::if_icmplt;
+    case cmpop::op_cmpge: return opc::if_icmpge;
+    case cmpop::op_cmpgt: return opc::if_icmpgt;
+    case cmpop::op_cmple: return opc::if_icmple;
+    default:              assert(0);
+    }
+}
+
+static opc tos_if_opc(cmpop op)
+{
+    switch (op) {
+    case cmpop::op_cmpeq: return opc::tos_ifeq;
+    case cmpop::op_cmpne: return opc::tos_ifne;
+    case cmpop::op_cmplt: return opc::tos_iflt;
+    case cmpop::op_cmpge: return opc::tos_ifge;
+    case cmpop::op_cmpgt: return opc::tos_ifgt;
+    case cmpop::op_cmple: return opc::tos_ifle;
+    default:              assert(0);
+    }
+}
 
-    assert(it != _bblock_map.end());
+static opc tos_if_cmp_opc(cmpop op)
+{
+    switch (op) {
+    case cmpop::op_cmpeq: return opc::tos_if_icmpeq;
+    case cmpop::op_cmpne: return opc::tos_if_icmpne;
+    case cmpop::op_cmplt: return opc::tos_if_icmplt;
+    case cmpop::op_cmpge: return opc::tos_if_icmpge;
+    case cmpop::op_cmpgt: return opc::tos_if_icmpgt;
+    case cmpop::op_cmple: return opc::tos_if_icmple;
+    default:              assert(0);
+    }
+}
 
-    uint16_t offset = it->second;
+static opc iinc_if_icmp_opc(cmpop op)
+{
+    switch (op) {
+    case cmpop::op_cmpeq: return opc::iinc_if_icmpeq;
+    case cmpop::op_cmpne: return opc::iinc_if_icmpne;
+    case cmpop::op_cmplt: return opc::iinc_if_icmplt;
+    case cmpop::op_cmpge: return opc::iinc_if_icmpge;
+    case cmpop::op_cmpgt: return opc::iinc_if_icmpgt;
+    case cmpop::op_cmple: return opc::iinc_if_icmple;
+    default:              assert(0);
+    }
+}
 
-    put_const(offset);
+void interp_translator::op_binary(type t, binop op)
+{
+    auto value2 = pop();
+    auto value1 = pop();
+    auto depth = _stack.size();
+    auto tos = !value1.imm && cache_tos(value1);
+    auto src1 = value1.imm ? materialize(value1, depth) : value1.reg;
+    auto dst = stack_reg(depth);
+    if (value2.imm) {
+        auto x = binary_imm_opc(t, op);
+        put_def(tos ? tos_in_opc(x) : x, dst);
+        if (!tos) {
+            put_const(src1);
+        }
+        switch (t) {
+        case type::t_int:  put_const<jint>(value2.value);  break;
+        case type::t_long: put_const<jlong>(value2.value); break;
+        default:           assert(0);
+        }
+    } else {
+        auto x = binary_opc(t, op);
+        put_def(tos ? tos_in_opc(x) : x, dst);
+        if (!tos) {
+            put_const(src1);
+        }
+        put_const(value2.reg);
+    }
+    _def_end = _pc;
+    push_reg(t, dst);
 }
 
-void interp_translator::op_goto(std::shared_ptr<basic_block> bblock)
+void interp_translator::op_iinc(uint8_t idx, jint value)
 {
-    put_opc(opc::goto_);
+    materialize_local(idx);
 
-    auto it = _bblock_map.find(bblock);
+    _iinc_pos = _pc;
+    put_opc(opc::iinc);
+    put_const(idx);
+    put_const(value);
+    _iinc_end = _pc;
+    _iinc_idx = idx;
+    _iinc_value = value;
+}
+
+void interp_translator::op_if(type t, cmpop op, std::shared_ptr<basic_block> bblock)
+{
+    auto value = pop();
+    auto depth = _stack.size();
 
-    assert(it != _bblock_map.end());
+    flush();
 
-    uint16_t offset = it->second;
+    if (t == type::t_int && cache_tos(value)) {
+        put_opc(tos_if_opc(op));
+        put_target(bblock);
+        put_const(_method->profile()->lookup_branch(_bci));
+        return;
+    }
 
-    put_const(offset);
+    auto src = value.imm ? materialize(value, depth) : value.reg;
+
+    put_opc(if_opc(t, op));
+    put_const(src);
+    put_target(bblock);
+    put_const(_method->profile()->lookup_branch(_bci));
+}
+
+void interp_translator::op_if_cmp(type t, cmpop op, std::shared_ptr<basic_block> bblock)
+{
+    auto value2 = pop();
+    auto value1 = pop();
+    auto depth = _stack.size();
+
+    flush();
+
+    if (t == type::t_int && !value2.imm && cache_tos(value1)) {
+        put_opc(tos_if_cmp_opc(op));
+        put_const(value2.reg);
+        put_target(bblock);
+        put_const(_method->profile()->lookup_branch(_bci));
+        return;
+    }
+
+    auto src1 = value1.imm ? materialize(value1, depth) : value1.reg;
+    auto src2 = value2.imm ? materialize(value2, depth + 1) : value2.reg;
+
+    if (t == type::t_int && _iinc_end == _pc) {
+        // iinc; if_icmpxx
+        _code.resize(_iinc_pos);
+        _pc = _iinc_pos;
+        put_opc(iinc_if_icmp_opc(op));
+        put_const(_iinc_idx);
+        put_const(_iinc_value);
+    } else {
+        put_opc(if_cmp_opc(t, op));
+    }
+    put_const(src1);
+    put_const(src2);
+    put_target(bblock);
+    put_const(_method->profile()->lookup_branch(_bci));
+}
+
+void interp_translator::op_goto(std::shared_ptr<basic_block> bblock)
+{
+    flush();
+
+    put_opc(opc::goto_);
+
+    put_target(bblock);
+    put_const(_method->profile()->lookup_branch(_bci));
+
+    _reachable = false;
 }
 
 void interp_translator::op_ret()
 {
+    auto value = pop();
+    auto depth = _stack.size();
+
+    _reachable = false;
+
+    if (cache_tos(value)) {
+        put_opc(opc::tos_ret);
+        return;
+    }
+
+    auto src = value.imm ? materialize(value, depth) : value.reg;
+
     put_opc(opc::ret);
+    put_const(src);
 }
 
 void interp_translator::op_ret_void()
 {
     put_opc(opc::ret_void);
+
+    _reachable = false;
+}
+
+void interp_translator::op_getstatic(type t, field* field)
+{
+    auto dst = stack_reg(_stack.size());
+    put_def(opc::getstatic, dst);
+    put_const(&field->value);
+    _def_end = _pc;
+    push_reg(t, dst);
+}
+
+void interp_translator::op_putstatic(type t, field* field)
+{
+    auto value = pop();
+    auto depth = _stack.size();
+    auto src = value.imm ? materialize(value, depth) : value.reg;
+    put_opc(opc::putstatic);
+    put_const(src);
+    put_const(&field->value);
+}
+
+void interp_translator::op_getfield(type t, field* field)
+{
+    auto objectref = pop();
+    auto depth = _stack.size();
+    auto src = objectref.imm ? materialize(objectref, depth) : objectref.reg;
+    auto dst = stack_reg(depth);
+    put_def(opc::getfield, dst);
+    put_const(src);
+    put_const(field->offset);
+    _def_end = _pc;
+    push_reg(t, dst);
+}
+
+void interp_translator::op_putfield(type t, field* field)
+{
+    auto value = pop();
+    auto objectref = pop();
+    auto depth = _stack.size();
+    auto obj = objectref.imm ? materialize(objectref, depth) : objectref.reg;
+    auto src = value.imm ? materialize(value, depth + 1) : value.reg;
+    put_opc(opc::putfield);
+    put_const(obj);
+    put_const(src);
+    put_const(field->offset);
 }
 
 void interp_translator::op_invokestatic(method* target)
 {
+    // Arguments are passed in the operand stack slots that become the
+    // callee's locals.
+    auto base = _stack.size() - target->args_count;
+    for (auto depth = base; depth < _stack.size(); depth++) {
+        materialize(depth);
+    }
+    _stack.resize(base);
     put_opc(opc::invokestatic);
+    put_const(stack_reg(base));
     put_const(target);
+    if (!target->returns_void()) {
+        push_reg(return_type(target), stack_reg(base));
+    }
 }
 
-void interp_translator::op_new()
+void interp_translator::op_new(klass* klass)
 {
-    put_opc(opc::new_);
+    auto dst = stack_reg(_stack.size());
+    put_def(opc::new_, dst);
+    put_const(klass);
+    _def_end = _pc;
+    push_reg(type::t_ref, dst);
 }
 
 void interp_translator::op_arraylength()
 {
-    put_opc(opc::arraylength);
+    auto arrayref = pop();
+    auto depth = _stack.size();
+    auto src = arrayref.imm ? materialize(arrayref, depth) : arrayref.reg;
+    auto dst = stack_reg(depth);
+    put_def(opc::arraylength, dst);
+    put_const(src);
+    put_const(_method->profile()->lookup_array_length(_bci));
+    _def_end = _pc;
+    push_reg(type::t_int, dst);
 }
 
-value_t interp_backend::execute(method* method, frame& frame)
+void* interp_backend::compile(method* method)
 {
+    method->profile();
+
     interp_translator translator(method);
 
     translator.translate();
 
-    const char* code = translator.trampoline<const char*>();
+    auto size = translator.code_size();
+
+    std::unique_ptr<char[]> code{new char[size]};
+
+    memcpy(code.get(), translator.trampoline<const char*>(), size);
+
+    _code.push_back(std::move(code));
+
+    return _code.back().get();
+}
+
+value_t interp_backend::run(method* method, void* entry_point, frame& frame)
+{
+    frame.code = static_cast<const char*>(entry_point);
+
+    count_invocation(method);
 
-    return interp(frame, code);
+    return interp(&frame);
 }
 
 }
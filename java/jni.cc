@@ -1,6 +1,9 @@
 #include "hornet/jni.hh"
 
+#include "hornet/aot.hh"
 #include "hornet/java.hh"
+#include "hornet/perf.hh"
+#include "hornet/safepoint.hh"
 #include "hornet/vm.hh"
 
 #include <cassert>
@@ -15,10 +18,20 @@
 
 static jint HORNET_JNI(DestroyJavaVM)(JavaVM *vm)
 {
+    hornet::safepoint_stop();
+
+    hornet::thread::current()->detach();
+
     delete hornet::_backend;
 
     hornet::verifier_stats();
 
+    hornet::bytecode_ngram_stats();
+
+    hornet::method_data_stats();
+
+    hornet::safepoint_stats();
+
     delete hornet::_jvm;
 
     return JNI_OK;
@@ -81,6 +94,41 @@ static JavaVM HORNET_JNI(JavaVM) = {
     &HORNET_JNI(JNIInvokeInterface),
 };
 
+// Parse a size with an optional k, m or g suffix.
+static size_t parse_size(const char* str)
+{
+    char* end;
+    size_t size = strtoull(str, &end, 10);
+    switch (*end) {
+    case 'g': case 'G': return size << 30;
+    case 'm': case 'M': return size << 20;
+    case 'k': case 'K': return size << 10;
+    default:            return size;
+    }
+}
+
+// Parse -XX:Tier<N>InvocationThreshold=<count> and
+// -XX:Tier<N>BackEdgeThreshold=<count>.
+static bool parse_tier_threshold(const char* opt)
+{
+    for (uint8_t tier = 1; tier <= hornet::max_tier; tier++) {
+        auto& threshold = hornet::tier_thresholds[tier];
+        char name[64];
+
+        snprintf(name, sizeof(name), "-XX:Tier%dInvocationThreshold=", tier);
+        if (!strncmp(opt, name, strlen(name))) {
+            threshold.invocations = strtoull(opt + strlen(name), nullptr, 10);
+            return true;
+        }
+        snprintf(name, sizeof(name), "-XX:Tier%dBackEdgeThreshold=", tier);
+        if (!strncmp(opt, name, strlen(name))) {
+            threshold.backedges = strtoull(opt + strlen(name), nullptr, 10);
+            return true;
+        }
+    }
+    return false;
+}
+
 jint JNI_CreateJavaVM(JavaVM **vm, void **penv, void *args)
 {
     auto vm_args = reinterpret_cast<JavaVMInitArgs*>(args);
@@ -90,6 +138,8 @@ jint JNI_CreateJavaVM(JavaVM **vm, void **penv, void *args)
 
     auto backend = hornet::backend_type::interp;
 
+    const char* aot_library = nullptr;
+
     for (auto i = 0; i < vm_args->nOptions; i++) {
         const char *opt = vm_args->options[i].optionString;
 
@@ -101,6 +151,89 @@ jint JNI_CreateJavaVM(JavaVM **vm, void **penv, void *args)
             hornet::verbose_verifier = true;
             continue;
         }
+        if (!strcmp(opt, "-XX:+PrintMethodData")) {
+            hornet::print_method_data = true;
+            continue;
+        }
+        if (!strcmp(opt, "-XX:+PrintBytecodeNgrams")) {
+            hornet::print_bytecode_ngrams = true;
+            continue;
+        }
+        if (!strcmp(opt, "-XX:+TieredCompilation")) {
+            backend = hornet::backend_type::tiered;
+            continue;
+        }
+        if (!strcmp(opt, "-XX:+PrintCompilation")) {
+            hornet::print_compilation = true;
+            continue;
+        }
+        if (!strcmp(opt, "-XX:+PrintCodeCache")) {
+            hornet::print_code_cache = true;
+            continue;
+        }
+        if (!strncmp(opt, "-XX:LLVMOptLevel=", strlen("-XX:LLVMOptLevel="))) {
+            hornet::llvm_opt_level = strtoul(opt + strlen("-XX:LLVMOptLevel="), nullptr, 10);
+            if (hornet::llvm_opt_level > 3) {
+                fprintf(stderr, "error: -XX:LLVMOptLevel must be between 0 and 3.\n");
+                return JNI_ERR;
+            }
+            continue;
+        }
+        if (!strcmp(opt, "-XX:+PrintLLVMTiming")) {
+            hornet::print_llvm_timing = true;
+            continue;
+        }
+        if (!strcmp(opt, "-XX:+PerfMap")) {
+            hornet::perf_map = true;
+            continue;
+        }
+        if (!strcmp(opt, "-XX:+PerfJitDump")) {
+            hornet::perf_jitdump = true;
+            continue;
+        }
+        if (!strncmp(opt, "-XX:ReservedCodeCacheSize=", strlen("-XX:ReservedCodeCacheSize="))) {
+            hornet::reserved_code_cache_size = parse_size(opt + strlen("-XX:ReservedCodeCacheSize="));
+            if (hornet::reserved_code_cache_size > hornet::max_code_cache_size) {
+                fprintf(stderr, "error: -XX:ReservedCodeCacheSize must be at most 2g.\n");
+                return JNI_ERR;
+            }
+            continue;
+        }
+        if (!strcmp(opt, "-XX:-BackgroundCompilation")) {
+            hornet::background_compilation = false;
+            continue;
+        }
+        if (!strcmp(opt, "-XX:-BlockOnCompilation")) {
+            hornet::thread::current()->block_on_compilation = false;
+            continue;
+        }
+        if (!strncmp(opt, "-XX:CICompilerCount=", strlen("-XX:CICompilerCount="))) {
+            hornet::compiler_count = strtoul(opt + strlen("-XX:CICompilerCount="), nullptr, 10);
+            if (!hornet::compiler_count) {
+                fprintf(stderr, "error: -XX:CICompilerCount must be at least 1.\n");
+                return JNI_ERR;
+            }
+            continue;
+        }
+        if (!strncmp(opt, "-XX:OnStackReplaceThreshold=", strlen("-XX:OnStackReplaceThreshold="))) {
+            hornet::osr_threshold = strtoull(opt + strlen("-XX:OnStackReplaceThreshold="), nullptr, 10);
+            continue;
+        }
+        if (!strncmp(opt, "-XX:GuaranteedSafepointInterval=", strlen("-XX:GuaranteedSafepointInterval="))) {
+            hornet::guaranteed_safepoint_interval = strtoul(opt + strlen("-XX:GuaranteedSafepointInterval="), nullptr, 10);
+            continue;
+        }
+        if (!strcmp(opt, "-XX:+PrintSafepointStatistics")) {
+            hornet::print_safepoint_statistics = true;
+            continue;
+        }
+        if (!strncmp(opt, "-XX:AOTLibrary=", strlen("-XX:AOTLibrary="))) {
+            aot_library = opt + strlen("-XX:AOTLibrary=");
+            continue;
+        }
+        if (parse_tier_threshold(opt)) {
+            continue;
+        }
         if (!strcmp(opt, "-XX:+DynASM")) {
 #ifdef CONFIG_HAVE_DYNASM
             backend = hornet::backend_type::dynasm;
@@ -138,9 +271,16 @@ jint JNI_CreateJavaVM(JavaVM **vm, void **penv, void *args)
         hornet::_backend = new hornet::llvm_backend();
         break;
 #endif
+    case hornet::backend_type::tiered:
+        hornet::tiered_compilation = true;
+        hornet::_backend = new hornet::tiered_backend();
+        break;
     default:
         assert(0);
     }
+    if (aot_library && !hornet::aot_load(aot_library)) {
+        return JNI_ERR;
+    }
     std::istringstream buf(classpath);
     for (std::string entry; getline(buf, entry, ':'); ) {
         hornet::system_loader::get()->register_entry(entry);
@@ -148,6 +288,8 @@ jint JNI_CreateJavaVM(JavaVM **vm, void **penv, void *args)
 
     hornet::_jvm = new hornet::jvm();
 
+    hornet::thread::current()->attach();
+
     auto env = reinterpret_cast<JNIEnv **>(penv);
 
     *vm	= &HORNET_JNI(JavaVM);
@@ -155,6 +297,8 @@ jint JNI_CreateJavaVM(JavaVM **vm, void **penv, void *args)
 
     hornet::system_loader::init();
 
+    hornet::safepoint_start();
+
     return JNI_OK;
 }
 
@@ -189,13 +333,23 @@ static void HORNET_JNI(CallStaticVoidMethodV)(JNIEnv *env, jclass clazz, jmethod
 {
     auto* method = hornet::from_jmethodID(methodID);
 
-    hornet::frame frame(method->max_locals);
+    assert(hornet::thread::current()->is_attached());
+
+    auto* frame = hornet::frame::enter(method);
 
     for (int i = 0; i < method->args_count; i++) {
-        frame.locals[i] = va_arg(args, uint64_t);
+        frame->locals[i] = va_arg(args, uint64_t);
     }
 
-    hornet::_backend->execute(method, frame);
+    method->spread_args(frame->locals);
+
+    hornet::_backend->execute(method, *frame);
+
+    frame->leave();
+
+    if (hornet::thread::current()->stack.empty()) {
+        hornet::_backend->quiesce();
+    }
 }
 
 static void HORNET_JNI(CallStaticVoidMethod)(JNIEnv *env, jclass clazz, jmethodID methodID, ...)
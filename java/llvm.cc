@@ -1,19 +1,61 @@
 #include "hornet/java.hh"
 
+#include "hornet/aot.hh"
 #include "hornet/translator.hh"
+#include "hornet/perf.hh"
+#include "hornet/safepoint.hh"
 #include "hornet/vm.hh"
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <sstream>
+
+#include <sys/wait.h>
+#include <spawn.h>
+#include <unistd.h>
 
 #include <classfile_constants.h>
 #include <jni.h>
 
-#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Analysis/BasicAliasAnalysis.h"
+#include "llvm/Analysis/TypeBasedAliasAnalysis.h"
+#include "llvm/DebugInfo/DWARF/DWARFContext.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/Support/TargetSelect.h"
-#include "llvm/ExecutionEngine/JIT.h"
-#include "llvm/Analysis/Verifier.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Utils.h"
 #include "llvm/IR/Module.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+
+// GCC does not see that LLVM values such as GlobalVariable have operator
+// new and delete of their own.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
 
 using namespace std;
 
@@ -21,15 +63,69 @@ namespace hornet {
 
 using namespace llvm;
 
-Module*          module;
-ExecutionEngine* engine;
+// Context of the JIT and of AOT compilation. Compilations are serialized by
+// the tier lock, so no two threads use it at once.
+orc::ThreadSafeContext thread_safe_context(std::make_unique<LLVMContext>());
+
+static LLVMContext& global_context()
+{
+    return *thread_safe_context.getContext();
+}
+
+std::unique_ptr<orc::LLJIT> jit;
+// Names of the functions that have been added to the JIT.
+std::set<std::string> jit_functions;
+
+// Hands code emitted by the JIT over to perf. Translators tag instructions
+// with debug locations whose file is the class and whose line is the
+// bytecode index plus one, which come back from the line table of the
+// object.
+class perf_listener : public JITEventListener {
+public:
+    virtual void notifyObjectLoaded(ObjectKey key, const llvm::object::ObjectFile& obj, const RuntimeDyld::LoadedObjectInfo& info) override {
+        auto debug_obj = info.getObjectForDebug(obj);
+        if (!debug_obj.getBinary()) {
+            return;
+        }
+        auto& object = *debug_obj.getBinary();
+        auto dwarf = DWARFContext::create(object);
+        for (auto& sym_size : llvm::object::computeSymbolSizes(object)) {
+            auto type = sym_size.first.getType();
+            auto name = sym_size.first.getName();
+            auto addr = sym_size.first.getAddress();
+            auto section = sym_size.first.getSection();
+            if (!type || !name || !addr || !section) {
+                consumeError(type.takeError());
+                consumeError(name.takeError());
+                consumeError(addr.takeError());
+                consumeError(section.takeError());
+                continue;
+            }
+            if (*type != llvm::object::SymbolRef::ST_Function || *section == object.section_end()) {
+                continue;
+            }
+            std::vector<perf_line> lines;
+            std::string source;
+            llvm::object::SectionedAddress start{*addr, (*section)->getIndex()};
+            for (auto& line : dwarf->getLineInfoForAddressRange(start, sym_size.second)) {
+                if (line.second.Line) {
+                    source = line.second.FileName;
+                    lines.push_back(perf_line{reinterpret_cast<void*>(line.first), static_cast<uint16_t>(line.second.Line - 1)});
+                }
+            }
+            perf_register_code(name->str(), reinterpret_cast<void*>(*addr), sym_size.second, source, lines);
+        }
+    }
+};
+
+perf_listener    listener;
 
 Type* typeof(type t)
 {
     switch (t) {
-    case type::t_int:  return Type::getInt32Ty(getGlobalContext());
-    case type::t_long: return Type::getInt64Ty(getGlobalContext());
-    case type::t_ref:  return PointerType::get(Type::getInt8Ty(getGlobalContext()), 0);
+    case type::t_int:  return Type::getInt32Ty(global_context());
+    case type::t_long: return Type::getInt64Ty(global_context());
+    case type::t_ref:  return PointerType::get(Type::getInt8Ty(global_context()), 0);
     default:           assert(0);
     }
 }
@@ -49,16 +145,140 @@ Instruction::BinaryOps to_binary_op(binop op)
     }
 }
 
+//
+// Module of an ahead-of-time compilation. Relocations are collected for one
+// class at a time and taken when the class is done. See hornet/aot.hh.
+//
+struct aot_relocation {
+    aot_reloc_kind  kind;
+    uint32_t        value;
+    std::string     klass;
+    std::string     name;
+    std::string     descriptor;
+    GlobalVariable* slot;
+};
+
+class aot_module {
+public:
+    aot_module()
+        : _module(new Module("AOT", global_context()))
+    { }
+
+    Module* module() const {
+        return _module.get();
+    }
+
+    // Slot that the VM fills in with the address of a VM object.
+    GlobalVariable* slot(aot_reloc_kind kind, const std::string& klass, const std::string& name, const std::string& descriptor);
+
+    // Record a value that the code depends on.
+    void check(aot_reloc_kind kind, const std::string& klass, uint32_t value,
+               const std::string& name = std::string(), const std::string& descriptor = std::string());
+
+    // c2i adapters use the slots of the class that calls them, so every
+    // class gets its own.
+    Function* c2i_adapter(method* method);
+
+    std::vector<aot_relocation> take_relocations() {
+        auto relocs = std::move(_relocs);
+        _relocs.clear();
+        _c2i_adapters.clear();
+        return relocs;
+    }
+
+private:
+    aot_relocation* lookup(aot_reloc_kind kind, const std::string& klass, const std::string& name, const std::string& descriptor);
+
+    std::unique_ptr<Module> _module;
+    std::vector<aot_relocation> _relocs;
+    std::map<method*, Function*> _c2i_adapters;
+};
+
+aot_relocation* aot_module::lookup(aot_reloc_kind kind, const std::string& klass, const std::string& name, const std::string& descriptor)
+{
+    for (auto& reloc : _relocs) {
+        if (reloc.kind == kind && reloc.klass == klass && reloc.name == name && reloc.descriptor == descriptor) {
+            return &reloc;
+        }
+    }
+    return nullptr;
+}
+
+GlobalVariable* aot_module::slot(aot_reloc_kind kind, const std::string& klass, const std::string& name, const std::string& descriptor)
+{
+    auto reloc = lookup(kind, klass, name, descriptor);
+    if (reloc) {
+        return reloc->slot;
+    }
+    auto type = Type::getInt8PtrTy(global_context());
+    auto slot = new GlobalVariable(*_module, type, false, GlobalValue::InternalLinkage, ConstantPointerNull::get(type), "aot_slot");
+    _relocs.push_back(aot_relocation{kind, 0, klass, name, descriptor, slot});
+    return slot;
+}
+
+void aot_module::check(aot_reloc_kind kind, const std::string& klass, uint32_t value, const std::string& name, const std::string& descriptor)
+{
+    if (lookup(kind, klass, name, descriptor)) {
+        return;
+    }
+    _relocs.push_back(aot_relocation{kind, value, klass, name, descriptor, nullptr});
+}
+
+// Address of a VM object as a value of 'type'. JIT-compiled code embeds the
+// address and AOT-compiled code loads it from a slot.
+static Value* vm_address(IRBuilder<>& builder, aot_module* aot, Type* type, const void* addr, aot_reloc_kind kind,
+                         const std::string& klass, const std::string& name = std::string(), const std::string& descriptor = std::string())
+{
+    if (!aot) {
+        return builder.CreateIntToPtr(builder.getInt64(reinterpret_cast<uintptr_t>(addr)), type);
+    }
+    return builder.CreateBitCast(builder.CreateLoad(builder.getInt8PtrTy(), aot->slot(kind, klass, name, descriptor)), type);
+}
+
+static FunctionType* call_interpreter_type()
+{
+    auto value_type = Type::getInt64Ty(global_context());
+    Type* params[] = { Type::getInt8PtrTy(global_context()), PointerType::get(value_type, 0) };
+    return FunctionType::get(value_type, params, false);
+}
+
+static FunctionType* gc_new_object_type()
+{
+    auto ref_type = Type::getInt8PtrTy(global_context());
+    return FunctionType::get(ref_type, ref_type, false);
+}
+
+// Callee of a call into the runtime. The JIT resolves it by name.
+static FunctionCallee runtime_function(IRBuilder<>& builder, aot_module* aot, FunctionType* type, const char* name)
+{
+    if (!aot) {
+        return builder.GetInsertBlock()->getModule()->getOrInsertFunction(name, type);
+    }
+    return FunctionCallee(type, vm_address(builder, aot, PointerType::getUnqual(type), nullptr, aot_reloc_runtime, "", name));
+}
+
+CmpInst::Predicate to_cmp_predicate(cmpop op)
+{
+    switch (op) {
+    case cmpop::op_cmpeq: return CmpInst::ICMP_EQ;
+    case cmpop::op_cmpne: return CmpInst::ICMP_NE;
+    case cmpop::op_cmplt: return CmpInst::ICMP_SLT;
+    case cmpop::op_cmpge: return CmpInst::ICMP_SGE;
+    case cmpop::op_cmpgt: return CmpInst::ICMP_SGT;
+    case cmpop::op_cmple: return CmpInst::ICMP_SLE;
+    default:              assert(0);
+    }
+}
+
 class llvm_translator : public translator {
 public:
-    llvm_translator(method* method);
+    llvm_translator(Module* module, method* method, uint16_t osr_bci = no_osr_bci, aot_module* aot = nullptr);
     ~llvm_translator();
 
-    template<typename T>
-    T trampoline();
-
     virtual void prologue () override;
+    virtual void osr_prologue(std::shared_ptr<basic_block> bblock) override;
     virtual void begin(std::shared_ptr<basic_block> bblock) override;
+    virtual void begin_insn() override;
     virtual void op_const (type t, int64_t value) override;
     virtual void op_load  (type t, uint16_t idx) override;
     virtual void op_store (type t, uint16_t idx) override;
@@ -68,79 +288,283 @@ public:
     virtual void op_swap() override;
     virtual void op_binary(type t, binop op) override;
     virtual void op_iinc(uint8_t idx, jint value) override;
+    virtual void op_if(type t, cmpop op, std::shared_ptr<basic_block> bblock) override;
     virtual void op_if_cmp(type t, cmpop op, std::shared_ptr<basic_block> bblock) override;
     virtual void op_goto(std::shared_ptr<basic_block> bblock) override;
     virtual void op_ret() override;
     virtual void op_ret_void() override;
-    virtual void op_new() override;
+    virtual void op_new(klass* klass) override;
+    virtual void op_getstatic(type t, field* field) override;
+    virtual void op_putstatic(type t, field* field) override;
+    virtual void op_getfield(type t, field* field) override;
+    virtual void op_putfield(type t, field* field) override;
     virtual void op_invokestatic(method* target) override;
     virtual void op_arraylength() override;
 
+    Function* func() const {
+        return _func;
+    }
+
+    // Finish the debug info and verify the function once it is translated.
+    // Returns false if the function is broken.
+    bool finish();
+
+    // Callers that were compiled before keep a declaration.
+    void erase() {
+        _func->deleteBody();
+        if (_func->use_empty()) {
+            _func->eraseFromParent();
+        }
+    }
+
 private:
     AllocaInst* lookup_local(unsigned int idx, Type* type);
+    BasicBlock* lookup_block(std::shared_ptr<basic_block> bblock);
+    MDNode* branch_weights();
+    void branch(cmpop op, Value* lhs, Value* rhs, std::shared_ptr<basic_block> target);
+    Value* field_addr(Value* objectref, field* field);
+    Value* static_addr(field* field);
+    Value* load_value(type t, Value* addr, MDNode* tbaa);
+    void store_value(type t, Value* addr, Value* value, MDNode* tbaa);
+    void poll();
+    BasicBlock* jump_target(std::shared_ptr<basic_block> target);
+    void flow(std::shared_ptr<basic_block> target, BasicBlock* pred);
 
     std::stack<Value*> _mimic_stack;
-    std::vector<AllocaInst*> _locals;
+    std::map<std::pair<unsigned int, Type*>, AllocaInst*> _locals;
+    std::map<uint16_t, BasicBlock*> _blocks;
+    // Operand stack on entry to a bytecode block, bottom first.
+    std::map<uint16_t, std::vector<PHINode*>> _entry_stacks;
+    std::shared_ptr<basic_block> _bblock;
     IRBuilder<> _builder;
     Function* _func;
+    std::unique_ptr<DIBuilder> _debug_info;
+    DISubprogram* _scope;
     method* _method;
+    aot_module* _aot;
 };
 
-FunctionType* function_type(IRBuilder<>& builder, method* method)
+// Convert a value_t to a value of type 'type'.
+static Value* narrow(IRBuilder<>& builder, Type* type, Value* value)
+{
+    if (type->isPointerTy()) {
+        return builder.CreateIntToPtr(value, type);
+    }
+    return builder.CreateTrunc(value, type);
+}
+
+// Convert a value to a value_t.
+static Value* widen(IRBuilder<>& builder, Value* value)
 {
-    return FunctionType::get(builder.getVoidTy(), false);
+    if (value->getType()->isPointerTy()) {
+        return builder.CreatePtrToInt(value, builder.getInt64Ty());
+    }
+    return builder.CreateSExt(value, builder.getInt64Ty());
 }
 
-Function* function(IRBuilder<>& builder, method* method)
+static Type* return_type(IRBuilder<>& builder, method* method)
 {
-    auto func_type = function_type(builder, method);
-    auto func = Function::Create(func_type, Function::ExternalLinkage, method->name, module);
+    if (method->returns_void()) {
+        return builder.getVoidTy();
+    }
+    return typeof(return_type(method));
+}
+
+//
+// Compiled methods have native signatures that follow their descriptors:
+// ints are i32, longs i64 and references pointers. OSR entries receive the
+// interpreter's locals and return a value_t.
+//
+FunctionType* function_type(IRBuilder<>& builder, method* method, bool osr)
+{
+    auto value_type = builder.getInt64Ty();
+    if (osr) {
+        Type* locals = PointerType::get(value_type, 0);
+        return FunctionType::get(value_type, locals, false);
+    }
+    // Methods with arguments that cannot be parsed bail out in the prologue.
+    std::vector<argument> args;
+    parse_args(method, args);
+    std::vector<Type*> params;
+    for (auto& arg : args) {
+        params.push_back(typeof(arg.t));
+    }
+    return FunctionType::get(return_type(builder, method), params, false);
+}
+
+Function* function(Module* module, IRBuilder<>& builder, method* method, bool osr)
+{
+    auto name = perf_symbol(method) + (osr ? "_osr" : "");
+    // Calls that precede the translation of a method leave a declaration.
+    auto func = module->getFunction(name);
+    if (!func || !func->isDeclaration()) {
+        func = Function::Create(function_type(builder, method, osr), Function::ExternalLinkage, name, module);
+    }
     auto entry = BasicBlock::Create(builder.getContext(), "entry", func);
     builder.SetInsertPoint(entry);
     return func;
 }
 
-llvm_translator::llvm_translator(method* method)
-    : translator(method)
-    , _locals(method->max_locals)
+//
+// With -XX:+PerfJitDump JIT-compiled functions get debug info whose file is
+// the class and whose lines are bytecode indices plus one.
+//
+llvm_translator::llvm_translator(Module* module, method* method, uint16_t osr_bci, aot_module* aot)
+    : translator(method, osr_bci)
     , _builder(module->getContext())
+    , _scope(nullptr)
     , _method(method)
+    , _aot(aot)
 {
-    _func = function(_builder, _method);
+    _func = function(module, _builder, _method, osr_bci != no_osr_bci);
+    if (perf_jitdump && !aot) {
+        module->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+        _debug_info.reset(new DIBuilder(*module));
+        auto file = _debug_info->createFile(perf_source(method), "");
+        _debug_info->createCompileUnit(dwarf::DW_LANG_Java, file, "hornet", true, "", 0);
+        auto type = _debug_info->createSubroutineType(_debug_info->getOrCreateTypeArray(None));
+        _scope = _debug_info->createFunction(file, _func->getName(), StringRef(), file, 1, type, 1,
+                                             DINode::FlagZero, DISubprogram::SPFlagDefinition);
+        _func->setSubprogram(_scope);
+    }
 }
 
 llvm_translator::~llvm_translator()
 {
 }
 
-template<typename T> T llvm_translator::trampoline()
+bool llvm_translator::finish()
 {
-    verifyFunction(*_func, PrintMessageAction);
-    return reinterpret_cast<T>(engine->getPointerToFunction(_func));
+    if (_debug_info) {
+        _debug_info->finalize();
+        _debug_info.reset();
+    }
+    return !verifyFunction(*_func, &errs());
 }
 
+//
+// javac reuses local slots for variables of different types, so every slot
+// has a stack slot per type it is used with.
+//
 AllocaInst* llvm_translator::lookup_local(unsigned int idx, Type* type)
 {
-    if (_locals[idx]) {
-        return _locals[idx];
+    auto key = std::make_pair(idx, type);
+    auto it = _locals.find(key);
+    if (it != _locals.end()) {
+        return it->second;
     }
     IRBuilder<> builder(&_func->getEntryBlock(), _func->getEntryBlock().begin());
     auto ret = builder.CreateAlloca(type, nullptr, "");
-    _locals[idx] = ret;
+    if (_osr_bci != no_osr_bci) {
+        // Start out with the value from the interpreter frame.
+        auto addr = builder.CreateGEP(builder.getInt64Ty(), _func->arg_begin(), builder.getInt32(idx));
+        builder.CreateStore(narrow(builder, type, builder.CreateLoad(builder.getInt64Ty(), addr)), ret);
+    }
+    _locals.insert(std::make_pair(key, ret));
     return ret;
 }
 
 void llvm_translator::prologue()
 {
+    std::vector<argument> args;
+    if (!parse_args(_method, args)) {
+        bailout();
+        return;
+    }
+    auto value = _func->arg_begin();
+    for (auto& arg : args) {
+        auto local = lookup_local(arg.slot, typeof(arg.t));
+        _builder.CreateStore(value++, local);
+    }
 }
 
+void llvm_translator::osr_prologue(std::shared_ptr<basic_block> bblock)
+{
+    op_goto(bblock);
+}
+
+BasicBlock* llvm_translator::lookup_block(std::shared_ptr<basic_block> bblock)
+{
+    auto it = _blocks.find(bblock->start);
+    if (it != _blocks.end()) {
+        return it->second;
+    }
+    auto block = BasicBlock::Create(global_context(), "bci_" + std::to_string(bblock->start), _func);
+    _blocks.insert(std::make_pair(bblock->start, block));
+    return block;
+}
+
+//
+// Pass the mimic stack along the edge from 'pred' to the block of 'target'.
+// The first edge that is translated creates a phi per stack slot at the
+// start of the block, and every edge adds its values to them. A block that
+// is translated before any edge into it starts with an empty stack.
+//
+void llvm_translator::flow(std::shared_ptr<basic_block> target, BasicBlock* pred)
+{
+    std::vector<Value*> values;
+    for (auto stack = _mimic_stack; !stack.empty(); stack.pop()) {
+        values.insert(values.begin(), stack.top());
+    }
+    auto it = _entry_stacks.find(target->start);
+    if (it == _entry_stacks.end()) {
+        auto block = lookup_block(target);
+        std::vector<PHINode*> phis;
+        for (auto value : values) {
+            phis.push_back(PHINode::Create(value->getType(), 2, "", block));
+        }
+        it = _entry_stacks.insert(std::make_pair(target->start, phis)).first;
+    }
+    auto& phis = it->second;
+    if (phis.size() != values.size()) {
+        bailout();
+        return;
+    }
+    for (size_t i = 0; i < values.size(); i++) {
+        if (phis[i]->getType() != values[i]->getType()) {
+            bailout();
+            return;
+        }
+        phis[i]->addIncoming(values[i], pred);
+    }
+}
+
+//
+// Every bytecode block gets an LLVM block, whose operand stack is merged
+// from its predecessors (see flow()).
+//
 void llvm_translator::begin(std::shared_ptr<basic_block> bblock)
 {
+    auto block = lookup_block(bblock);
+    if (!_builder.GetInsertBlock()->getTerminator()) {
+        flow(bblock, _builder.GetInsertBlock());
+        _builder.CreateBr(block);
+    }
+    _builder.SetInsertPoint(block);
+    _bblock = bblock;
+
+    auto& phis = _entry_stacks[bblock->start];
+    _mimic_stack = std::stack<Value*>();
+    for (auto phi : phis) {
+        _mimic_stack.push(phi);
+    }
+}
+
+void llvm_translator::begin_insn()
+{
+    if (_scope) {
+        _builder.SetCurrentDebugLocation(DILocation::get(global_context(), _bci + 1, 0, _scope));
+    }
 }
 
 void llvm_translator::op_const(type t, int64_t value)
 {
-    auto c = ConstantInt::get(typeof(t), value, 0);
+    Constant* c;
+    if (t == type::t_ref) {
+        c = Constant::getNullValue(typeof(t));
+    } else {
+        c = ConstantInt::get(typeof(t), value, 0);
+    }
 
     _mimic_stack.push(c);
 }
@@ -149,7 +573,7 @@ void llvm_translator::op_load(type t, uint16_t idx)
 {
     auto local = lookup_local(idx, typeof(t));
 
-    auto value = _builder.CreateLoad(local);
+    auto value = _builder.CreateLoad(local->getAllocatedType(), local);
 
     _mimic_stack.push(value);
 }
@@ -162,24 +586,38 @@ void llvm_translator::op_store(type t, uint16_t idx)
     _builder.CreateStore(value, local);
 }
 
+//
+// Stack manipulation only moves values around on the mimic stack.
+//
 void llvm_translator::op_pop()
 {
-    assert(0);
+    _mimic_stack.pop();
 }
 
 void llvm_translator::op_dup()
 {
-    assert(0);
+    _mimic_stack.push(_mimic_stack.top());
 }
 
 void llvm_translator::op_dup_x1()
 {
-    assert(0);
+    auto value1 = _mimic_stack.top();
+    _mimic_stack.pop();
+    auto value2 = _mimic_stack.top();
+    _mimic_stack.pop();
+    _mimic_stack.push(value1);
+    _mimic_stack.push(value2);
+    _mimic_stack.push(value1);
 }
 
 void llvm_translator::op_swap()
 {
-    assert(0);
+    auto value1 = _mimic_stack.top();
+    _mimic_stack.pop();
+    auto value2 = _mimic_stack.top();
+    _mimic_stack.pop();
+    _mimic_stack.push(value1);
+    _mimic_stack.push(value2);
 }
 
 void llvm_translator::op_binary(type t, binop op)
@@ -194,77 +632,850 @@ void llvm_translator::op_binary(type t, binop op)
 
 void llvm_translator::op_iinc(uint8_t idx, jint value)
 {
-    assert(0);
+    auto local = lookup_local(idx, typeof(type::t_int));
+    auto result = _builder.CreateAdd(_builder.CreateLoad(local->getAllocatedType(), local), _builder.getInt32(value));
+    _builder.CreateStore(result, local);
+}
+
+// Scale a profile count down to a 32-bit branch weight.
+static uint32_t branch_weight(uint64_t count, unsigned int shift)
+{
+    return static_cast<uint32_t>(count >> shift);
+}
+
+//
+// Weights of the conditional branch at the current bytecode index from the
+// interpreter's profile, so that LLVM lays out the likely successor as the
+// fall-through and moves the other one out of line. Returns nullptr if the
+// branch has not been profiled.
+//
+MDNode* llvm_translator::branch_weights()
+{
+    auto* data = _method->data.load(std::memory_order_relaxed);
+    if (!data) {
+        return nullptr;
+    }
+    auto* counter = data->lookup_branch(_bci);
+    if (!counter || counter->taken + counter->not_taken == 0) {
+        return nullptr;
+    }
+    unsigned int shift = 0;
+    while (std::max(counter->taken, counter->not_taken) >> shift > UINT32_MAX) {
+        shift++;
+    }
+    MDBuilder md(global_context());
+    return md.createBranchWeights(branch_weight(counter->taken, shift), branch_weight(counter->not_taken, shift));
+}
+
+// Block to jump to for 'target'. A back-edge goes through a block of its
+// own that polls for a safepoint, so that a thread in a loop can be stopped
+// and only the taken path pays for the poll.
+BasicBlock* llvm_translator::jump_target(std::shared_ptr<basic_block> target)
+{
+    if (target->start > _bci) {
+        flow(target, _builder.GetInsertBlock());
+        return lookup_block(target);
+    }
+    auto block = BasicBlock::Create(global_context(), "backedge_" + std::to_string(_bci), _func);
+    flow(target, block);
+    IRBuilderBase::InsertPointGuard guard(_builder);
+    _builder.SetInsertPoint(block);
+    poll();
+    _builder.CreateBr(lookup_block(target));
+    return block;
+}
+
+void llvm_translator::branch(cmpop op, Value* lhs, Value* rhs, std::shared_ptr<basic_block> target)
+{
+    auto cond = _builder.CreateICmp(to_cmp_predicate(op), lhs, rhs);
+    auto fallthrough = lookup(_bblock->end);
+    flow(fallthrough, _builder.GetInsertBlock());
+    _builder.CreateCondBr(cond, jump_target(target), lookup_block(fallthrough), branch_weights());
+}
+
+void llvm_translator::op_if(type t, cmpop op, std::shared_ptr<basic_block> bblock)
+{
+    auto value = _mimic_stack.top();
+    _mimic_stack.pop();
+    branch(op, value, Constant::getNullValue(typeof(t)), bblock);
 }
 
 void llvm_translator::op_if_cmp(type t, cmpop op, std::shared_ptr<basic_block> bblock)
 {
-    assert(0);
+    auto rhs = _mimic_stack.top();
+    _mimic_stack.pop();
+    auto lhs = _mimic_stack.top();
+    _mimic_stack.pop();
+    branch(op, lhs, rhs, bblock);
 }
 
 void llvm_translator::op_goto(std::shared_ptr<basic_block> bblock)
 {
-    assert(0);
+    _builder.CreateBr(jump_target(bblock));
+}
+
+//
+// Safepoint poll: a volatile load from the poll page. LLVM-compiled code has
+// no stack maps, so a thread parked in it, or called from it, reports its
+// roots as incomplete (see safepoint_visit_roots()). The polls only make
+// sure that the thread stops. Tiered compilation keeps methods that can hold
+// references out of LLVM.
+//
+void llvm_translator::poll()
+{
+    auto page = vm_address(_builder, _aot, _builder.getInt8PtrTy(), safepoint_poll_page(), aot_reloc_runtime, "", "poll_page");
+    _builder.CreateLoad(_builder.getInt8Ty(), page, true);
 }
 
 void llvm_translator::op_ret()
 {
-    assert(0);
+    auto value = _mimic_stack.top();
+    _mimic_stack.pop();
+    poll();
+    if (_osr_bci != no_osr_bci) {
+        value = widen(_builder, value);
+    }
+    _builder.CreateRet(value);
 }
 
 void llvm_translator::op_ret_void()
 {
-    _builder.CreateRetVoid();
+    poll();
+    // OSR entries return a value_t even for void methods.
+    if (_func->getReturnType()->isVoidTy()) {
+        _builder.CreateRetVoid();
+    } else {
+        _builder.CreateRet(_builder.getInt64(0));
+    }
+}
+
+static void build_c2i_adapter(method* method, Function* func, aot_module* aot);
+
+// c2i adapter of 'method' for calls from 'module'. JIT-compiled code shares
+// the adapters, so one that is in the JIT already is only declared.
+static Function* c2i_function(Module* module, method* method, aot_module* aot)
+{
+    if (aot) {
+        return aot->c2i_adapter(method);
+    }
+    auto name = perf_symbol(method) + "_c2i";
+    auto func = module->getFunction(name);
+    if (func) {
+        return func;
+    }
+    IRBuilder<> builder(module->getContext());
+    func = Function::Create(function_type(builder, method, false), Function::ExternalLinkage, name, module);
+    if (!jit_functions.count(name)) {
+        build_c2i_adapter(method, func, nullptr);
+    }
+    return func;
 }
 
+Function* aot_module::c2i_adapter(method* method)
+{
+    auto it = _c2i_adapters.find(method);
+    if (it != _c2i_adapters.end()) {
+        return it->second;
+    }
+    IRBuilder<> builder(global_context());
+    auto func = Function::Create(function_type(builder, method, false), Function::ExternalLinkage, perf_symbol(method) + "_c2i", _module.get());
+    build_c2i_adapter(method, func, this);
+    _c2i_adapters.insert(std::make_pair(method, func));
+    return func;
+}
+
+//
+// Static calls use the native signature of the callee. A callee that the
+// JIT has compiled, the method itself included, is called directly and
+// other callees through their c2i adapter. AOT-compiled code
+// calls methods of its own class directly, compiled or not yet, because
+// the other classes may not be bound.
+//
 void llvm_translator::op_invokestatic(method* target)
 {
-    assert(0);
+    std::vector<argument> args;
+    if (!parse_args(target, args)) {
+        bailout();
+        return;
+    }
+    Function* callee;
+    if (_aot && target->klass == _method->klass) {
+        callee = _func->getParent()->getFunction(perf_symbol(target));
+        if (!callee) {
+            callee = Function::Create(function_type(_builder, target, false), Function::ExternalLinkage, perf_symbol(target), _func->getParent());
+        }
+    } else if (_aot) {
+        callee = c2i_function(_func->getParent(), target, _aot);
+    } else {
+        auto module = _func->getParent();
+        callee = module->getFunction(perf_symbol(target));
+        if (!callee && jit_functions.count(perf_symbol(target))) {
+            callee = Function::Create(function_type(_builder, target, false), Function::ExternalLinkage, perf_symbol(target), module);
+        } else if (!callee) {
+            callee = c2i_function(module, target, nullptr);
+        }
+    }
+    std::vector<Value*> values(args.size());
+    for (size_t i = args.size(); i-- > 0; ) {
+        values[i] = _mimic_stack.top();
+        _mimic_stack.pop();
+    }
+    auto result = _builder.CreateCall(callee, values);
+    if (!target->returns_void()) {
+        _mimic_stack.push(result);
+    }
+}
+
+//
+// Fields hold values in 64-bit slots like the interpreter's value_t.
+//
+Value* llvm_translator::static_addr(field* field)
+{
+    auto type = PointerType::get(Type::getInt64Ty(global_context()), 0);
+    return vm_address(_builder, _aot, type, &field->value, aot_reloc_static_field, field->klass->name, field->name, field->descriptor);
 }
 
-void llvm_translator::op_new()
+Value* llvm_translator::field_addr(Value* objectref, field* field)
 {
-    assert(0);
+    if (_aot) {
+        _aot->check(aot_reloc_field_offset, field->klass->name, field->offset, field->name, field->descriptor);
+    }
+    auto idx = ConstantInt::get(Type::getInt32Ty(global_context()), field->offset, 0);
+    auto gep = _builder.CreateGEP(_builder.getInt8Ty(), objectref, idx);
+    return _builder.CreateBitCast(gep, PointerType::get(Type::getInt64Ty(global_context()), 0));
 }
 
+//
+// Type-based alias analysis metadata for memory that compiled code accesses.
+// Every field is a type of its own under a common root, because a store to
+// one field never changes another. Accesses are tagged with the scalar type
+// as both base and access type.
+//
+static MDNode* tbaa_node(const std::string& name, bool constant = false)
+{
+    MDBuilder md(global_context());
+    auto type = md.createTBAAScalarTypeNode(name, md.createTBAARoot("hornet heap"));
+    return md.createTBAAStructTagNode(type, type, 0, constant);
+}
+
+static MDNode* field_tbaa(field* field)
+{
+    return tbaa_node(field->klass->name + "." + field->name + ":" + field->descriptor);
+}
+
+Value* llvm_translator::load_value(type t, Value* addr, MDNode* tbaa)
+{
+    auto value = _builder.CreateLoad(_builder.getInt64Ty(), addr);
+    value->setMetadata(LLVMContext::MD_tbaa, tbaa);
+    return narrow(_builder, typeof(t), value);
+}
+
+void llvm_translator::store_value(type t, Value* addr, Value* value, MDNode* tbaa)
+{
+    auto store = _builder.CreateStore(widen(_builder, value), addr);
+    store->setMetadata(LLVMContext::MD_tbaa, tbaa);
+}
+
+void llvm_translator::op_getstatic(type t, field* field)
+{
+    _mimic_stack.push(load_value(t, static_addr(field), field_tbaa(field)));
+}
+
+void llvm_translator::op_putstatic(type t, field* field)
+{
+    auto value = _mimic_stack.top();
+    _mimic_stack.pop();
+    store_value(t, static_addr(field), value, field_tbaa(field));
+}
+
+void llvm_translator::op_getfield(type t, field* field)
+{
+    auto objectref = _mimic_stack.top();
+    _mimic_stack.pop();
+    _mimic_stack.push(load_value(t, field_addr(objectref, field), field_tbaa(field)));
+}
+
+void llvm_translator::op_putfield(type t, field* field)
+{
+    auto value = _mimic_stack.top();
+    _mimic_stack.pop();
+    auto objectref = _mimic_stack.top();
+    _mimic_stack.pop();
+    store_value(t, field_addr(objectref, field), value, field_tbaa(field));
+}
+
+//
+// Bump-allocate from the thread's allocation buffer and call gc_new_object()
+// only when the buffer is full. Java code runs on a single thread, so the
+// address of its buffer pointer is a constant (see thread::current()). The
+// slow path is cold and laid out of line.
+//
+static constexpr uint32_t alloc_fast_weight = 2000;
+
+void llvm_translator::op_new(klass* klass)
+{
+    auto& context = global_context();
+    auto value_type = _builder.getInt64Ty();
+    auto value_ptr_type = PointerType::get(value_type, 0);
+
+    if (_aot) {
+        _aot->check(aot_reloc_instance_size, klass->name, klass->instance_size);
+    }
+    auto klass_ptr = vm_address(_builder, _aot, _builder.getInt8PtrTy(), klass, aot_reloc_klass, klass->name);
+    assert(thread::current()->single_threaded());
+    auto buffer_addr = vm_address(_builder, _aot, value_ptr_type, thread::current()->alloc_buffer(), aot_reloc_runtime, "", "alloc_buffer");
+    auto buffer_tbaa = tbaa_node("allocation buffer");
+    auto buffer = _builder.CreateLoad(value_type, buffer_addr);
+    buffer->setMetadata(LLVMContext::MD_tbaa, buffer_tbaa);
+    auto next_addr = _builder.CreateIntToPtr(_builder.CreateAdd(buffer, _builder.getInt64(memory_block::next_offset())), value_ptr_type);
+    auto end_addr = _builder.CreateIntToPtr(_builder.CreateAdd(buffer, _builder.getInt64(memory_block::end_offset())), value_ptr_type);
+    auto next = _builder.CreateLoad(value_type, next_addr);
+    next->setMetadata(LLVMContext::MD_tbaa, buffer_tbaa);
+    auto end = _builder.CreateLoad(value_type, end_addr);
+    end->setMetadata(LLVMContext::MD_tbaa, buffer_tbaa);
+    auto new_next = _builder.CreateAdd(next, _builder.getInt64(klass->instance_size));
+    auto fits = _builder.CreateICmpULE(new_next, end);
+    MDBuilder md(context);
+
+    auto fast_path = BasicBlock::Create(context, "alloc", _func);
+    auto slow_path = BasicBlock::Create(context, "alloc_slow", _func);
+    auto done = BasicBlock::Create(context, "alloc_done", _func);
+    _builder.CreateCondBr(fits, fast_path, slow_path, md.createBranchWeights(alloc_fast_weight, 1));
+
+    _builder.SetInsertPoint(fast_path);
+    auto store_next = _builder.CreateStore(new_next, next_addr);
+    store_next->setMetadata(LLVMContext::MD_tbaa, buffer_tbaa);
+    auto klass_addr = _builder.CreateIntToPtr(_builder.CreateAdd(next, _builder.getInt64(offsetof(object, klass))), value_ptr_type);
+    auto store_klass = _builder.CreateStore(_builder.CreatePtrToInt(klass_ptr, value_type), klass_addr);
+    store_klass->setMetadata(LLVMContext::MD_tbaa, tbaa_node("object header"));
+    auto fast_obj = _builder.CreateIntToPtr(next, typeof(type::t_ref));
+    _builder.CreateBr(done);
+
+    _builder.SetInsertPoint(slow_path);
+    auto new_object = runtime_function(_builder, _aot, gc_new_object_type(), "gc_new_object");
+    auto slow_obj = _builder.CreateCall(new_object, klass_ptr);
+    slow_obj->addFnAttr(Attribute::Cold);
+    _builder.CreateBr(done);
+
+    _builder.SetInsertPoint(done);
+    auto obj = _builder.CreatePHI(typeof(type::t_ref), 2);
+    obj->addIncoming(fast_obj, fast_path);
+    obj->addIncoming(slow_obj, slow_path);
+    _mimic_stack.push(obj);
+}
+
+// The length of an array never changes, so the load is invariant.
 void llvm_translator::op_arraylength()
 {
     auto arrayref = _mimic_stack.top();
     _mimic_stack.pop();
-    auto idx = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), offsetof(array, length), 0);
-    auto gep = _builder.CreateGEP(arrayref, idx);
-    auto addr = _builder.CreateBitCast(gep, PointerType::get(Type::getInt32Ty(getGlobalContext()), 0));
-    auto len = _builder.CreateLoad(addr);
+    auto idx = ConstantInt::get(Type::getInt32Ty(global_context()), offsetof(array, length), 0);
+    auto gep = _builder.CreateGEP(_builder.getInt8Ty(), arrayref, idx);
+    auto addr = _builder.CreateBitCast(gep, PointerType::get(Type::getInt32Ty(global_context()), 0));
+    auto len = _builder.CreateLoad(_builder.getInt32Ty(), addr);
+    len->setMetadata(LLVMContext::MD_tbaa, tbaa_node("array length", true));
+    len->setMetadata(LLVMContext::MD_invariant_load, MDNode::get(global_context(), None));
     _mimic_stack.push(len);
 }
 
+//
+// IR passes that run on every compiled method before code generation. Level
+// 1 promotes the locals, which the translator keeps in allocas, to SSA
+// values and cleans up. Level 2 adds scalar replacement, redundancy
+// elimination and loop-invariant code motion, and level 3 unrolls loops.
+//
+static legacy::FunctionPassManager* build_pass_manager(Module* module, unsigned int level)
+{
+    auto pm = new legacy::FunctionPassManager(module);
+
+    if (level >= 1) {
+        pm->add(createPromoteMemoryToRegisterPass());
+        pm->add(createInstructionCombiningPass());
+        pm->add(createCFGSimplificationPass());
+    }
+    if (level >= 2) {
+        pm->add(createTypeBasedAAWrapperPass());
+        pm->add(createBasicAAWrapperPass());
+        pm->add(createSROAPass());
+        pm->add(createEarlyCSEPass());
+        pm->add(createReassociatePass());
+        pm->add(createLoopSimplifyPass());
+        pm->add(createLoopRotatePass());
+        pm->add(createLICMPass());
+        pm->add(createGVNPass());
+    }
+    if (level >= 3) {
+        pm->add(createLoopUnrollPass());
+        pm->add(createInstructionCombiningPass());
+        pm->add(createGVNPass());
+    }
+    if (level >= 2) {
+        pm->add(createCFGSimplificationPass());
+    }
+
+    pm->doInitialization();
+
+    return pm;
+}
+
+// Wall-clock time of the phases of a compilation for -XX:+PrintLLVMTiming.
+class compile_timer {
+public:
+    compile_timer()
+        : _last(clock::now())
+    { }
+
+    // Milliseconds since the previous lap.
+    double lap() {
+        auto now = clock::now();
+        auto ms = std::chrono::duration<double, std::milli>(now - _last).count();
+        _last = now;
+        return ms;
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    clock::time_point _last;
+};
+
+static void print_timing(method* method, uint16_t osr_bci, double translate, double optimize, double codegen)
+{
+    if (!print_llvm_timing) {
+        return;
+    }
+    char osr[16] = "";
+    if (osr_bci != no_osr_bci) {
+        snprintf(osr, sizeof(osr), " @ %d", osr_bci);
+    }
+    fprintf(stderr, "llvm: %s%s: translate %.3f ms, optimize %.3f ms, codegen %.3f ms\n",
+            perf_symbol(method).c_str(), osr, translate, optimize, codegen);
+}
+
+//
+// Every compilation builds a module of its own and adds it to the JIT, which
+// generates code for it on the first lookup. Functions of other modules are
+// declared and resolved by name.
+//
 llvm_backend::llvm_backend()
 {
     InitializeNativeTarget();
-    module = new Module("JIT", getGlobalContext());
-    auto engine_builder = EngineBuilder(module);
-    std::string error_str;
-    engine_builder.setErrorStr(&error_str);
-    engine = engine_builder.create();
-    if (!engine) {
-        throw std::runtime_error(error_str);
+    InitializeNativeTargetAsmPrinter();
+
+    auto machine = orc::JITTargetMachineBuilder::detectHost();
+    if (!machine) {
+        throw std::runtime_error(toString(machine.takeError()));
+    }
+    machine->setCodeGenOptLevel(static_cast<CodeGenOpt::Level>(llvm_opt_level));
+
+    orc::LLJITBuilder builder;
+    builder.setJITTargetMachineBuilder(std::move(*machine));
+    builder.setObjectLinkingLayerCreator([](orc::ExecutionSession& session, const Triple&) {
+        auto layer = std::make_unique<orc::RTDyldObjectLinkingLayer>(session, [] {
+            return std::make_unique<SectionMemoryManager>();
+        });
+        if (perf_map || perf_jitdump) {
+            layer->registerJITEventListener(listener);
+        }
+        return std::unique_ptr<orc::ObjectLayer>(std::move(layer));
+    });
+    auto created = builder.create();
+    if (!created) {
+        throw std::runtime_error(toString(created.takeError()));
+    }
+    jit = std::move(*created);
+
+    orc::SymbolMap runtime;
+    runtime[jit->mangleAndIntern("call_interpreter")] =
+        JITEvaluatedSymbol(pointerToJITTargetAddress(&call_interpreter), JITSymbolFlags::Exported);
+    runtime[jit->mangleAndIntern("gc_new_object")] =
+        JITEvaluatedSymbol(pointerToJITTargetAddress(&gc_new_object), JITSymbolFlags::Exported);
+    if (auto err = jit->getMainJITDylib().define(orc::absoluteSymbols(runtime))) {
+        throw std::runtime_error(toString(std::move(err)));
     }
 }
 
 llvm_backend::~llvm_backend()
 {
-    delete engine;
+    jit.reset();
+    jit_functions.clear();
+}
+
+static std::unique_ptr<Module> jit_module()
+{
+    std::unique_ptr<Module> module(new Module("JIT", global_context()));
+    module->setDataLayout(jit->getDataLayout());
+    module->setTargetTriple(jit->getTargetTriple().str());
+    return module;
+}
+
+static void* jit_lookup(const std::string& name)
+{
+    auto symbol = jit->lookup(name);
+    if (!symbol) {
+        logAllUnhandledErrors(symbol.takeError(), errs(), "llvm: ");
+        return nullptr;
+    }
+    return jitTargetAddressToPointer<void*>(symbol->getAddress());
+}
+
+// Add 'module' to the JIT and return the code of its function 'name'.
+static void* jit_link(std::unique_ptr<Module> module, const std::string& name)
+{
+    std::vector<std::string> defined;
+    for (auto& func : *module) {
+        if (!func.isDeclaration()) {
+            defined.push_back(func.getName().str());
+        }
+    }
+    if (auto err = jit->addIRModule(orc::ThreadSafeModule(std::move(module), thread_safe_context))) {
+        logAllUnhandledErrors(std::move(err), errs(), "llvm: ");
+        return nullptr;
+    }
+    jit_functions.insert(defined.begin(), defined.end());
+    return jit_lookup(name);
+}
+
+//
+// i2c adapter: value_t adapter(value_t* locals)
+//
+static Function* build_i2c_adapter(method* method, Function* target)
+{
+    IRBuilder<> builder(target->getContext());
+    auto value_type = builder.getInt64Ty();
+    auto func_type = FunctionType::get(value_type, PointerType::get(value_type, 0), false);
+    auto func = Function::Create(func_type, Function::ExternalLinkage, perf_symbol(method) + "_i2c", target->getParent());
+    builder.SetInsertPoint(BasicBlock::Create(builder.getContext(), "entry", func));
+
+    std::vector<argument> args;
+    parse_args(method, args);
+
+    std::vector<Value*> values;
+    for (auto& arg : args) {
+        auto addr = builder.CreateGEP(value_type, func->arg_begin(), builder.getInt32(arg.slot));
+        values.push_back(narrow(builder, typeof(arg.t), builder.CreateLoad(value_type, addr)));
+    }
+    auto result = builder.CreateCall(target, values);
+    if (method->returns_void()) {
+        builder.CreateRet(builder.getInt64(0));
+    } else {
+        builder.CreateRet(widen(builder, result));
+    }
+    verifyFunction(*func, &errs());
+    return func;
+}
+
+//
+// c2i adapter: stores the arguments to an array and passes it to
+// call_interpreter(). Builds the body of 'func', which has the native
+// signature of the method.
+//
+static void build_c2i_adapter(method* method, Function* func, aot_module* aot)
+{
+    IRBuilder<> builder(func->getContext());
+    auto value_type = builder.getInt64Ty();
+    builder.SetInsertPoint(BasicBlock::Create(builder.getContext(), "entry", func));
+
+    auto array = builder.CreateAlloca(value_type, builder.getInt32(std::max<uint16_t>(method->args_count, 1)));
+    unsigned int idx = 0;
+    for (auto arg = func->arg_begin(); arg != func->arg_end(); arg++) {
+        builder.CreateStore(widen(builder, arg), builder.CreateGEP(value_type, array, builder.getInt32(idx++)));
+    }
+    auto addr = vm_address(builder, aot, builder.getInt8PtrTy(), method, aot_reloc_method, method->klass->name, method->name, method->descriptor);
+    auto callee = runtime_function(builder, aot, call_interpreter_type(), "call_interpreter");
+    auto result = builder.CreateCall(callee, { addr, array });
+    if (method->returns_void()) {
+        builder.CreateRetVoid();
+    } else {
+        builder.CreateRet(narrow(builder, func->getReturnType(), result));
+    }
+    verifyFunction(*func, &errs());
+}
+
+void* llvm_backend::compile(method* method)
+{
+    compile_timer timer;
+
+    auto module = jit_module();
+
+    llvm_translator translator(module.get(), method);
+
+    if (!translator.translate() || !translator.finish()) {
+        return nullptr;
+    }
+
+    auto translate = timer.lap();
+
+    std::unique_ptr<legacy::FunctionPassManager> pm(build_pass_manager(module.get(), llvm_opt_level));
+    pm->run(*translator.func());
+
+    auto optimize = timer.lap();
+
+    auto adapter = build_i2c_adapter(method, translator.func());
+
+    auto code = jit_link(std::move(module), adapter->getName().str());
+
+    print_timing(method, no_osr_bci, translate, optimize, timer.lap());
+
+    return code;
+}
+
+void* llvm_backend::c2i_adapter(method* method)
+{
+    auto it = _c2i_adapters.find(method);
+    if (it != _c2i_adapters.end()) {
+        return it->second;
+    }
+
+    std::vector<argument> args;
+    if (!parse_args(method, args)) {
+        return nullptr;
+    }
+
+    auto module = jit_module();
+    auto name = c2i_function(module.get(), method, nullptr)->getName().str();
+    auto adapter = jit_link(std::move(module), name);
+
+    _c2i_adapters.insert(std::make_pair(method, adapter));
+
+    return adapter;
+}
+
+void* llvm_backend::compile_osr(method* method, uint16_t bci)
+{
+    compile_timer timer;
+
+    auto module = jit_module();
+
+    llvm_translator translator(module.get(), method, bci);
+
+    if (!translator.translate() || !translator.finish()) {
+        return nullptr;
+    }
+
+    auto translate = timer.lap();
+
+    std::unique_ptr<legacy::FunctionPassManager> pm(build_pass_manager(module.get(), llvm_opt_level));
+    pm->run(*translator.func());
+
+    auto optimize = timer.lap();
+
+    auto code = jit_link(std::move(module), translator.func()->getName().str());
+
+    print_timing(method, bci, translate, optimize, timer.lap());
+
+    return code;
+}
+
+value_t llvm_backend::run(method* method, void* entry_point, frame& frame)
+{
+    auto i2c = reinterpret_cast<i2c_adapter_t>(entry_point);
+
+    return i2c(frame.locals);
+}
+
+//
+// Ahead-of-time compilation emits the module to an object file and links it
+// into a shared object with the system compiler driver, $CC or cc.
+//
+static StructType* struct_type(std::initializer_list<Type*> elements)
+{
+    return StructType::get(global_context(), std::vector<Type*>(elements));
+}
+
+static Constant* struct_constant(StructType* type, std::initializer_list<Constant*> elements)
+{
+    return ConstantStruct::get(type, std::vector<Constant*>(elements));
+}
+
+static Constant* string_constant(Module* module, const std::string& str)
+{
+    auto type = Type::getInt8PtrTy(global_context());
+    if (str.empty()) {
+        return ConstantPointerNull::get(type);
+    }
+    auto init = ConstantDataArray::getString(global_context(), str);
+    auto var = new GlobalVariable(*module, init->getType(), true, GlobalValue::PrivateLinkage, init, "aot_str");
+    return ConstantExpr::getBitCast(var, type);
+}
+
+// Pointer to a constant array, or null if it is empty.
+static Constant* array_constant(Module* module, StructType* type, const std::vector<Constant*>& elements)
+{
+    auto ptr_type = PointerType::getUnqual(type);
+    if (elements.empty()) {
+        return ConstantPointerNull::get(ptr_type);
+    }
+    auto array_type = ArrayType::get(type, elements.size());
+    auto var = new GlobalVariable(*module, array_type, true, GlobalValue::PrivateLinkage, ConstantArray::get(array_type, elements), "aot_table");
+    return ConstantExpr::getBitCast(var, ptr_type);
+}
+
+static bool emit_object(Module* module, TargetMachine* machine, const std::string& path)
+{
+    std::error_code error;
+    ToolOutputFile out(path, error, sys::fs::OF_None);
+    if (error) {
+        fprintf(stderr, "error: %s: %s\n", path.c_str(), error.message().c_str());
+        return false;
+    }
+    legacy::PassManager pm;
+    if (machine->addPassesToEmitFile(pm, out.os(), nullptr, CGFT_ObjectFile)) {
+        fprintf(stderr, "error: target cannot emit object files\n");
+        return false;
+    }
+    pm.run(*module);
+    out.keep();
+    return true;
 }
 
-value_t llvm_backend::execute(method* method, frame& frame)
+//
+// Link the object file with $CC. The command is split at whitespace, so
+// that $CC can carry options, but it does not go through a shell and the
+// file names are passed as they are.
+//
+static bool link_shared_object(const std::string& object, const std::string& output)
 {
-    llvm_translator translator(method);
+    auto cc = getenv("CC");
+    std::istringstream command(cc && *cc ? cc : "cc");
+    std::vector<std::string> words;
+    for (std::string word; command >> word; ) {
+        words.push_back(word);
+    }
+    words.insert(words.end(), { "-shared", "-o", output, object });
 
-    translator.translate();
+    std::vector<char*> argv;
+    for (auto& word : words) {
+        argv.push_back(&word[0]);
+    }
+    argv.push_back(nullptr);
 
-    auto fp = translator.trampoline<value_t (*)()>();
+    pid_t pid;
+    auto err = posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ);
+    if (err) {
+        fprintf(stderr, "error: %s: %s\n", argv[0], strerror(err));
+        return false;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            return false;
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "error: %s: linking '%s' failed\n", argv[0], output.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool aot_compile(const std::vector<std::shared_ptr<klass>>& klasses, const std::string& output)
+{
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+
+    auto triple = sys::getDefaultTargetTriple();
+    std::string error;
+    auto target = TargetRegistry::lookupTarget(triple, error);
+    if (!target) {
+        fprintf(stderr, "error: %s\n", error.c_str());
+        return false;
+    }
+    std::unique_ptr<TargetMachine> machine(target->createTargetMachine(triple, sys::getHostCPUName(), "", TargetOptions(),
+            Reloc::PIC_, None, static_cast<CodeGenOpt::Level>(llvm_opt_level)));
+
+    aot_module aot;
+    auto module = aot.module();
+    module->setTargetTriple(triple);
+    module->setDataLayout(machine->createDataLayout());
+
+    std::unique_ptr<legacy::FunctionPassManager> pm(build_pass_manager(module, llvm_opt_level));
+
+    auto& context = global_context();
+    auto i32 = Type::getInt32Ty(context);
+    auto i64 = Type::getInt64Ty(context);
+    auto ptr = Type::getInt8PtrTy(context);
+    auto reloc_type  = struct_type({ i32, i32, ptr, ptr, ptr, PointerType::getUnqual(ptr) });
+    auto method_type = struct_type({ ptr, ptr, ptr });
+    auto class_type  = struct_type({ ptr, i64, i32, i32, PointerType::getUnqual(method_type), PointerType::getUnqual(reloc_type) });
+    auto lib_type    = struct_type({ i32, i32, PointerType::getUnqual(class_type) });
+
+    std::vector<Constant*> classes;
+    for (auto& klass : klasses) {
+        std::vector<Constant*> methods;
+        for (auto& method : klass->methods()) {
+            if (!method->code_length) {
+                continue;
+            }
+            llvm_translator translator(module, method.get(), no_osr_bci, &aot);
+            if (!translator.translate() || !translator.finish()) {
+                translator.erase();
+                continue;
+            }
+            pm->run(*translator.func());
+            auto adapter = build_i2c_adapter(method.get(), translator.func());
+            methods.push_back(struct_constant(method_type, {
+                    string_constant(module, method->name),
+                    string_constant(module, method->descriptor),
+                    ConstantExpr::getBitCast(adapter, ptr) }));
+            if (print_compilation) {
+                fprintf(stderr, "aot: %s\n", perf_symbol(method.get()).c_str());
+            }
+        }
+        // Methods of the class that are called directly but could not be
+        // compiled run in the interpreter.
+        for (auto& method : klass->methods()) {
+            auto func = module->getFunction(perf_symbol(method.get()));
+            if (func && func->isDeclaration()) {
+                build_c2i_adapter(method.get(), func, &aot);
+            }
+        }
+        std::vector<Constant*> relocs;
+        for (auto& reloc : aot.take_relocations()) {
+            Constant* slot = reloc.slot;
+            if (!slot) {
+                slot = ConstantPointerNull::get(PointerType::getUnqual(ptr));
+            }
+            relocs.push_back(struct_constant(reloc_type, {
+                    ConstantInt::get(i32, reloc.kind),
+                    ConstantInt::get(i32, reloc.value),
+                    string_constant(module, reloc.klass),
+                    string_constant(module, reloc.name),
+                    string_constant(module, reloc.descriptor),
+                    slot }));
+        }
+        if (methods.empty()) {
+            continue;
+        }
+        classes.push_back(struct_constant(class_type, {
+                string_constant(module, klass->name),
+                ConstantInt::get(i64, klass->hash),
+                ConstantInt::get(i32, methods.size()),
+                ConstantInt::get(i32, relocs.size()),
+                array_constant(module, method_type, methods),
+                array_constant(module, reloc_type, relocs) }));
+    }
+    auto library = struct_constant(lib_type, {
+            ConstantInt::get(i32, aot_version),
+            ConstantInt::get(i32, classes.size()),
+            array_constant(module, class_type, classes) });
+    new GlobalVariable(*module, lib_type, true, GlobalValue::ExternalLinkage, library, "hornet_aot_library");
+
+    // Only the table is exported.
+    for (auto& func : *module) {
+        if (!func.isDeclaration()) {
+            func.setLinkage(GlobalValue::InternalLinkage);
+        }
+    }
+    if (verifyModule(*module, &errs())) {
+        return false;
+    }
 
-    return fp();
+    auto object = output + ".o";
+    auto ok = emit_object(module, machine.get(), object) && link_shared_object(object, output);
+    unlink(object.c_str());
+    return ok;
 }
 
 }
@@ -1,5 +1,6 @@
 #include "hornet/java.hh"
 
+#include "hornet/aot.hh"
 #include "hornet/system_error.hh"
 #include "hornet/vm.hh"
 
@@ -28,9 +29,38 @@ void loader::register_entry(std::string path)
     }
 }
 
+std::shared_ptr<klass> loader::lookup_class(const char *class_name)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _klasses.find(class_name);
+    if (it == _klasses.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+// Record a loaded class unless another thread got there first. The loader
+// must hand out one klass per name so that resolved fields and methods are
+// shared by everyone.
+std::shared_ptr<klass> loader::define_class(const char *class_name, std::shared_ptr<klass> klass)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _klasses.insert(std::make_pair(std::string{class_name}, klass));
+
+    return it.first->second;
+}
+
 std::shared_ptr<klass> loader::load_class(const char *class_name)
 {
-    auto klass = try_to_load_class(class_name);
+    auto klass = lookup_class(class_name);
+
+    if (klass) {
+        return klass;
+    }
+
+    klass = try_to_load_class(class_name);
 
     if (!klass) {
         hornet::throw_exception(java_lang_NoClassDefFoundError);
@@ -42,9 +72,14 @@ std::shared_ptr<klass> loader::load_class(const char *class_name)
         return nullptr;
     }
 
-    hornet::_jvm->register_klass(klass);
+    auto defined = define_class(class_name, klass);
 
-    return klass;
+    if (defined == klass) {
+        hornet::_jvm->register_klass(klass);
+        aot_bind(klass.get());
+    }
+
+    return defined;
 }
 
 std::shared_ptr<klass> loader::try_to_load_class(const char *class_name)
@@ -0,0 +1,304 @@
+#include "hornet/java.hh"
+
+#include "hornet/translator.hh"
+#include "hornet/safepoint.hh"
+#include "hornet/vm.hh"
+
+#include <cstdio>
+#include <set>
+
+namespace hornet {
+
+bool tiered_compilation;
+bool background_compilation = true;
+unsigned int compiler_count = 2;
+bool print_compilation;
+
+tier_threshold tier_thresholds[max_tier + 1] = {
+    {      0,      0 },
+    {   1000,  10000 },
+    {  10000, 100000 },
+};
+
+uint64_t osr_threshold = 50000;
+
+tiered_backend::tiered_backend()
+    : _reclaim_retries(0)
+    , _shutdown(false)
+{
+#ifdef CONFIG_HAVE_DYNASM
+    _tiers[1].reset(new dynasm_backend());
+#endif
+#ifdef CONFIG_HAVE_LLVM
+    _tiers[2].reset(new llvm_backend());
+#endif
+    for (unsigned int i = 0; i < compiler_count; i++) {
+        _compiler_threads.emplace_back(&tiered_backend::compiler_thread, this);
+    }
+    safepoint_add_operation([this] { reclaim(); });
+}
+
+tiered_backend::~tiered_backend()
+{
+    {
+        std::lock_guard<std::mutex> lock(_queue_mutex);
+        _shutdown = true;
+    }
+    _queue_cv.notify_all();
+
+    for (auto& thread : _compiler_threads) {
+        thread.join();
+    }
+}
+
+value_t tiered_backend::run(method* method, void* entry_point, frame& frame)
+{
+    auto* compiled = method->compiled.load(std::memory_order_acquire);
+    if (compiled) {
+        return compiled->backend->run(method, compiled->entry_point, frame);
+    }
+    return interp_backend::run(method, entry_point, frame);
+}
+
+static uint64_t hotness(method* method)
+{
+    auto* data = method->data.load(std::memory_order_relaxed);
+
+    return data->invocation_count + data->backedge_count;
+}
+
+void tiered_backend::promote(method* method, uint8_t tier)
+{
+    // Claim the promotion so that it is requested only once. A promotion
+    // whose compilation fails is not retried.
+    auto current = method->tier.load(std::memory_order_relaxed);
+    do {
+        if (current >= tier) {
+            return;
+        }
+    } while (!method->tier.compare_exchange_weak(current, tier, std::memory_order_relaxed));
+
+    submit(std::make_shared<compile_task>(method, tier, nullptr, hotness(method)));
+}
+
+static osr_code* lookup_osr(osr_code* osr, uint16_t bci)
+{
+    for (; osr; osr = osr->next) {
+        if (osr->bci == bci) {
+            return osr;
+        }
+    }
+    return nullptr;
+}
+
+//
+// An OSR entry is requested once per loop. The interpreter keeps running
+// the loop until the compiler thread has filled in the entry point.
+//
+osr_entry_t tiered_backend::osr_entry(method* method, uint16_t bci)
+{
+    auto* osr = lookup_osr(method->osr.load(std::memory_order_acquire), bci);
+    if (osr) {
+        return osr->entry_point.load(std::memory_order_acquire);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_code_mutex);
+
+        auto* head = method->osr.load(std::memory_order_relaxed);
+        osr = lookup_osr(head, bci);
+        if (osr) {
+            return osr->entry_point.load(std::memory_order_acquire);
+        }
+        _osr.emplace_back(new osr_code(bci, head));
+        osr = _osr.back().get();
+        method->osr.store(osr, std::memory_order_release);
+    }
+
+    submit(std::make_shared<compile_task>(method, max_tier, osr, hotness(method)));
+
+    return osr->entry_point.load(std::memory_order_acquire);
+}
+
+void tiered_backend::submit(std::shared_ptr<compile_task> task)
+{
+    std::unique_lock<std::mutex> lock(_queue_mutex);
+
+    task->blocking = !background_compilation && thread::current()->block_on_compilation;
+
+    _queue.push(task);
+    _queue_cv.notify_one();
+
+    if (!task->blocking) {
+        return;
+    }
+    _done_cv.wait(lock, [&] { return task->done; });
+}
+
+//
+// At shutdown the queued tasks are dropped: they are marked done without
+// being compiled, so that threads blocked in submit() return. The methods
+// and loops keep running their current code.
+//
+void tiered_backend::compiler_thread()
+{
+    for (;;) {
+        std::shared_ptr<compile_task> task;
+        {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            _queue_cv.wait(lock, [&] { return _shutdown || !_queue.empty(); });
+            if (_shutdown) {
+                for (; !_queue.empty(); _queue.pop()) {
+                    _queue.top()->done = true;
+                }
+                _done_cv.notify_all();
+                return;
+            }
+            task = _queue.top();
+            _queue.pop();
+        }
+
+        compile(*task);
+
+        {
+            std::lock_guard<std::mutex> lock(_queue_mutex);
+            task->done = true;
+        }
+        _done_cv.notify_all();
+    }
+}
+
+void tiered_backend::compile(compile_task& task)
+{
+    auto* method = task.method;
+
+    auto references = holds_references(method);
+
+    if (task.osr) {
+        // OSR entries are compiled with the most optimizing backend
+        // available.
+        void* entry_point = nullptr;
+        for (auto tier = task.tier; tier > 0 && !entry_point; tier--) {
+            if (_tiers[tier] && (!references || _tiers[tier]->has_stack_maps())) {
+                std::lock_guard<std::mutex> lock(_tier_locks[tier]);
+                entry_point = _tiers[tier]->compile_osr(method, task.osr->bci);
+            }
+        }
+        task.osr->entry_point.store(reinterpret_cast<osr_entry_t>(entry_point), std::memory_order_release);
+
+        if (print_compilation) {
+            fprintf(stderr, "%% %s.%s%s @ %d%s%s\n",
+                    method->klass->name.c_str(), method->name.c_str(), method->descriptor.c_str(),
+                    task.osr->bci, entry_point ? "" : " (bailout)", task.blocking ? " (blocking)" : "");
+        }
+        return;
+    }
+
+    auto* backend = _tiers[task.tier].get();
+    auto refused = backend && references && !backend->has_stack_maps();
+    void* entry_point = nullptr;
+    if (backend && !refused) {
+        std::lock_guard<std::mutex> lock(_tier_locks[task.tier]);
+        entry_point = backend->compile(method);
+        if (entry_point && !install(method, backend, entry_point, task.tier)) {
+            backend->release(entry_point);
+        }
+    }
+
+    if (print_compilation) {
+        fprintf(stderr, "%d %s.%s%s%s%s\n", task.tier,
+                method->klass->name.c_str(), method->name.c_str(), method->descriptor.c_str(),
+                !backend ? " (skipped)" : refused ? " (references)" : !entry_point ? " (bailout)" : "",
+                task.blocking ? " (blocking)" : "");
+    }
+}
+
+// Publish compiled code unless code from a higher tier, compiled by another
+// thread, has already been installed. Returns false if the code was not
+// published.
+//
+// The code that is replaced may still be running or be called directly
+// from other compiled code, so it is retired and freed by reclaim() at the
+// next safepoint, or by quiesce().
+bool tiered_backend::install(method* method, backend* backend, void* entry_point, uint8_t tier)
+{
+    compiled_code* compiled;
+    {
+        std::lock_guard<std::mutex> lock(_code_mutex);
+
+        compiled = method->compiled.load(std::memory_order_relaxed);
+        if (compiled && compiled->tier > tier) {
+            return false;
+        }
+        _compiled.emplace_back(new compiled_code{backend, entry_point, tier});
+        method->compiled.store(_compiled.back().get(), std::memory_order_release);
+        if (compiled) {
+            _retired.push_back(compiled);
+            _reclaim_retries = 0;
+        }
+    }
+    if (compiled) {
+        safepoint_request();
+    }
+    return true;
+}
+
+//
+// Runs at a safepoint and frees the retired code that no frame of the
+// parked Java thread is running. Direct calls to the code are unpatched by
+// release(). Code stays retired while a frame is running it or if its
+// frames cannot be found, because the walk is incomplete or the code has
+// no stack maps. The thread is somewhere else at its next poll, so reclaim()
+// asks for a few more safepoints before it leaves the code to the next
+// install() or to quiesce().
+//
+static constexpr unsigned int max_reclaim_retries = 16;
+
+void tiered_backend::reclaim()
+{
+    std::set<const void*> running;
+    bool complete = safepoint_visit_code([&](const void* code) { running.insert(code); });
+    std::vector<compiled_code*> unused;
+    bool retry;
+    {
+        std::lock_guard<std::mutex> lock(_code_mutex);
+
+        for (auto it = _retired.begin(); complete && it != _retired.end(); ) {
+            auto* code = (*it)->backend->code((*it)->entry_point);
+            if (code && !running.count(code)) {
+                unused.push_back(*it);
+                it = _retired.erase(it);
+            } else {
+                it++;
+            }
+        }
+        retry = !_retired.empty() && _reclaim_retries++ < max_reclaim_retries;
+    }
+    for (auto* compiled : unused) {
+        std::lock_guard<std::mutex> lock(_tier_locks[compiled->tier]);
+        compiled->backend->release(compiled->entry_point);
+    }
+    if (retry) {
+        safepoint_request();
+    }
+}
+
+//
+// The VM runs Java code on a single thread (see thread::current()), so once
+// its stack is empty no frame can be running retired code. The compiled_code
+// records stay around because the interpreter may still hold a pointer to
+// one; only the code is freed.
+//
+void tiered_backend::quiesce()
+{
+    std::vector<compiled_code*> retired;
+    {
+        std::lock_guard<std::mutex> lock(_code_mutex);
+        retired.swap(_retired);
+    }
+    for (auto* compiled : retired) {
+        compiled->backend->release(compiled->entry_point);
+    }
+}
+
+}
@@ -6,21 +6,276 @@
 #include <classfile_constants.h>
 #include <jni.h>
 
+#include <algorithm>
+#include <cinttypes>
+#include <deque>
+#include <iterator>
 #include <cstdio>
+#include <mutex>
+#include <set>
 
 using namespace std;
 
 namespace hornet {
 
-void translator::translate()
+bool print_bytecode_ngrams;
+
+//
+// Bytecode n-gram statistics. The interpreter counts how many times every
+// basic block is entered and the n-grams of a block are weighted by that
+// count, so the statistics reflect the bytecode that is executed rather than
+// the bytecode that is loaded. Sequences are counted within basic blocks
+// only because those are the candidates for superinstructions.
+//
+static constexpr size_t ngram_min = 2;
+static constexpr size_t ngram_max = 4;
+static constexpr size_t ngram_top = 20;
+
+static const char* opcode_names[JVM_OPC_MAX+1] = {
+    "nop", "aconst_null", "iconst_m1", "iconst_0", "iconst_1", "iconst_2",
+    "iconst_3", "iconst_4", "iconst_5", "lconst_0", "lconst_1", "fconst_0",
+    "fconst_1", "fconst_2", "dconst_0", "dconst_1", "bipush", "sipush", "ldc",
+    "ldc_w", "ldc2_w", "iload", "lload", "fload", "dload", "aload", "iload_0",
+    "iload_1", "iload_2", "iload_3", "lload_0", "lload_1", "lload_2", "lload_3",
+    "fload_0", "fload_1", "fload_2", "fload_3", "dload_0", "dload_1", "dload_2",
+    "dload_3", "aload_0", "aload_1", "aload_2", "aload_3", "iaload", "laload",
+    "faload", "daload", "aaload", "baload", "caload", "saload", "istore",
+    "lstore", "fstore", "dstore", "astore", "istore_0", "istore_1", "istore_2",
+    "istore_3", "lstore_0", "lstore_1", "lstore_2", "lstore_3", "fstore_0",
+    "fstore_1", "fstore_2", "fstore_3", "dstore_0", "dstore_1", "dstore_2",
+    "dstore_3", "astore_0", "astore_1", "astore_2", "astore_3", "iastore",
+    "lastore", "fastore", "dastore", "aastore", "bastore", "castore", "sastore",
+    "pop", "pop2", "dup", "dup_x1", "dup_x2", "dup2", "dup2_x1", "dup2_x2",
+    "swap", "iadd", "ladd", "fadd", "dadd", "isub", "lsub", "fsub", "dsub",
+    "imul", "lmul", "fmul", "dmul", "idiv", "ldiv", "fdiv", "ddiv", "irem",
+    "lrem", "frem", "drem", "ineg", "lneg", "fneg", "dneg", "ishl", "lshl",
+    "ishr", "lshr", "iushr", "lushr", "iand", "land", "ior", "lor", "ixor",
+    "lxor", "iinc", "i2l", "i2f", "i2d", "l2i", "l2f", "l2d", "f2i", "f2l",
+    "f2d", "d2i", "d2l", "d2f", "i2b", "i2c", "i2s", "lcmp", "fcmpl", "fcmpg",
+    "dcmpl", "dcmpg", "ifeq", "ifne", "iflt", "ifge", "ifgt", "ifle",
+    "if_icmpeq", "if_icmpne", "if_icmplt", "if_icmpge", "if_icmpgt",
+    "if_icmple", "if_acmpeq", "if_acmpne", "goto", "jsr", "ret", "tableswitch",
+    "lookupswitch", "ireturn", "lreturn", "freturn", "dreturn", "areturn",
+    "return", "getstatic", "putstatic", "getfield", "putfield", "invokevirtual",
+    "invokespecial", "invokestatic", "invokeinterface", "invokedynamic", "new",
+    "newarray", "anewarray", "arraylength", "athrow", "checkcast", "instanceof",
+    "monitorenter", "monitorexit", "wide", "multianewarray", "ifnull",
+    "ifnonnull", "goto_w", "jsr_w",
+};
+
+struct ngram_block {
+    const struct method* method;
+    uint16_t      start;
+    uint16_t      end;
+    uint64_t      count;
+};
+
+static std::mutex ngram_mutex;
+static std::deque<ngram_block> ngram_blocks;
+
+uint64_t* ngram_counter(const method* method, const basic_block& bblock)
+{
+    std::lock_guard<std::mutex> lock(ngram_mutex);
+
+    ngram_blocks.push_back(ngram_block{method, bblock.start, bblock.end, 0});
+
+    return &ngram_blocks.back().count;
+}
+
+static void count_ngrams(const ngram_block& bblock, std::map<std::vector<uint8_t>, uint64_t>& ngram_counts)
+{
+    std::vector<uint8_t> opcodes;
+
+    for (uint16_t pc = bblock.start; pc < bblock.end; ) {
+        uint8_t opc = bblock.method->code[pc];
+        opcodes.push_back(opc);
+        pc += opcode_length[opc];
+    }
+
+    for (size_t n = ngram_min; n <= ngram_max; n++) {
+        for (size_t i = 0; i + n <= opcodes.size(); i++) {
+            std::vector<uint8_t> ngram(opcodes.begin() + i, opcodes.begin() + i + n);
+            ngram_counts[ngram] += bblock.count;
+        }
+    }
+}
+
+void bytecode_ngram_stats()
+{
+    if (!print_bytecode_ngrams) {
+        return;
+    }
+    std::map<std::vector<uint8_t>, uint64_t> ngram_counts;
+    {
+        std::lock_guard<std::mutex> lock(ngram_mutex);
+
+        for (auto& bblock : ngram_blocks) {
+            if (bblock.count) {
+                count_ngrams(bblock, ngram_counts);
+            }
+        }
+    }
+    for (size_t n = ngram_min; n <= ngram_max; n++) {
+        std::vector<std::pair<std::vector<uint8_t>, uint64_t>> ngrams;
+        for (auto& entry : ngram_counts) {
+            if (entry.first.size() == n) {
+                ngrams.push_back(entry);
+            }
+        }
+        std::sort(ngrams.begin(), ngrams.end(), [](const std::pair<std::vector<uint8_t>, uint64_t>& a,
+                                                   const std::pair<std::vector<uint8_t>, uint64_t>& b) {
+            return a.second > b.second;
+        });
+        if (ngrams.size() > ngram_top) {
+            ngrams.resize(ngram_top);
+        }
+        fprintf(stderr, "Bytecode %zu-grams:\n", n);
+        fprintf(stderr, "         #  opcodes\n");
+        for (auto& entry : ngrams) {
+            fprintf(stderr, "%10" PRIu64 " ", entry.second);
+            for (auto opc : entry.first) {
+                fprintf(stderr, " %s", opcode_names[opc]);
+            }
+            fprintf(stderr, "\n");
+        }
+    }
+}
+
+bool parse_args(const method* method, std::vector<argument>& args)
+{
+    auto& descriptor = method->descriptor;
+    uint16_t slot = 0;
+
+    if (!method->is_static()) {
+        args.push_back(argument{type::t_ref, slot++});
+    }
+    for (size_t pos = 1; descriptor[pos] != ')'; pos++) {
+        switch (descriptor[pos]) {
+        case 'B':
+        case 'C':
+        case 'I':
+        case 'S':
+        case 'Z':
+            args.push_back(argument{type::t_int, slot++});
+            break;
+        case 'J':
+            args.push_back(argument{type::t_long, slot});
+            slot += 2;
+            break;
+        case '[':
+            while (descriptor[pos] == '[')
+                pos++;
+            if (descriptor[pos] == 'L')
+                pos = descriptor.find(';', pos);
+            args.push_back(argument{type::t_ref, slot++});
+            break;
+        case 'L':
+            pos = descriptor.find(';', pos);
+            args.push_back(argument{type::t_ref, slot++});
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// Floating-point methods are never translated, so their return type does
+// not matter.
+type return_type(const method* method)
+{
+    switch (method->descriptor[method->descriptor.find(')') + 1]) {
+    case 'J':
+        return type::t_long;
+    case 'L':
+    case '[':
+        return type::t_ref;
+    default:
+        return type::t_int;
+    }
+}
+
+//
+// Reference arguments that are never loaded are dead on entry. Instructions
+// that take a reference, such as getfield, need one of these first.
+//
+bool holds_references(method* method)
+{
+    auto* code = method->code;
+    for (uint16_t pc = 0; pc < method->code_length; pc += opcode_length[static_cast<uint8_t>(code[pc])]) {
+        switch (static_cast<uint8_t>(code[pc])) {
+        case JVM_OPC_aload:
+        case JVM_OPC_aload_0:
+        case JVM_OPC_aload_1:
+        case JVM_OPC_aload_2:
+        case JVM_OPC_aload_3:
+        case JVM_OPC_aconst_null:
+        case JVM_OPC_new:
+        case JVM_OPC_newarray:
+        case JVM_OPC_anewarray:
+        case JVM_OPC_multianewarray:
+        case JVM_OPC_invokevirtual:
+        case JVM_OPC_invokeinterface:
+        case JVM_OPC_invokedynamic:
+            return true;
+        case JVM_OPC_getstatic: {
+            auto field = method->klass->resolve_field(read_opc_u2(code + pc));
+            if (!field || field->descriptor[0] == 'L' || field->descriptor[0] == '[') {
+                return true;
+            }
+            break;
+        }
+        case JVM_OPC_invokespecial:
+        case JVM_OPC_invokestatic: {
+            auto target = method->klass->resolve_method(read_opc_u2(code + pc));
+            if (!target || target->returns_reference()) {
+                return true;
+            }
+            break;
+        }
+        }
+    }
+    return false;
+}
+
+static type field_type(const field* field)
+{
+    switch (field->descriptor[0]) {
+    case 'B':
+    case 'C':
+    case 'I':
+    case 'S':
+    case 'Z':
+        return type::t_int;
+    case 'J':
+        return type::t_long;
+    case 'L':
+    case '[':
+        return type::t_ref;
+    default:
+        fprintf(stderr, "error: unsupported field type: %s\n", field->descriptor.c_str());
+        abort();
+    }
+}
+
+bool translator::translate()
 {
     scan();
 
-    prologue();
+    if (_osr_bci == no_osr_bci) {
+        prologue();
+    } else {
+        osr_prologue(lookup(_osr_bci));
+    }
 
     for (auto bblock : _bblock_list) {
+        if (_bailout) {
+            break;
+        }
         translate(bblock);
     }
+
+    return !_bailout;
 }
 
 void translator::translate(std::shared_ptr<basic_block> bblock)
@@ -30,10 +285,14 @@ void translator::translate(std::shared_ptr<basic_block> bblock)
     begin(bblock);
 
 next_insn:
-    if (pc >= bblock->end) {
+    if (pc >= bblock->end || _bailout) {
         return;
     }
 
+    _bci = pc;
+
+    begin_insn();
+
     uint8_t opc = _method->code[pc];
 
     switch (opc) {
@@ -245,10 +504,46 @@ next_insn:
     }
     case JVM_OPC_iinc: {
         auto idx   = read_opc_u1(_method->code + pc);
-        auto value = read_opc_u1(_method->code + pc + 1);
+        int8_t value = read_opc_u1(_method->code + pc + 1);
         op_iinc(idx, value);
         break;
     }
+    case JVM_OPC_ifeq: {
+        int16_t offset = read_opc_u2(_method->code + pc);
+        auto target = lookup(pc + offset);
+        op_if(type::t_int, cmpop::op_cmpeq, target);
+        break;
+    }
+    case JVM_OPC_ifne: {
+        int16_t offset = read_opc_u2(_method->code + pc);
+        auto target = lookup(pc + offset);
+        op_if(type::t_int, cmpop::op_cmpne, target);
+        break;
+    }
+    case JVM_OPC_iflt: {
+        int16_t offset = read_opc_u2(_method->code + pc);
+        auto target = lookup(pc + offset);
+        op_if(type::t_int, cmpop::op_cmplt, target);
+        break;
+    }
+    case JVM_OPC_ifge: {
+        int16_t offset = read_opc_u2(_method->code + pc);
+        auto target = lookup(pc + offset);
+        op_if(type::t_int, cmpop::op_cmpge, target);
+        break;
+    }
+    case JVM_OPC_ifgt: {
+        int16_t offset = read_opc_u2(_method->code + pc);
+        auto target = lookup(pc + offset);
+        op_if(type::t_int, cmpop::op_cmpgt, target);
+        break;
+    }
+    case JVM_OPC_ifle: {
+        int16_t offset = read_opc_u2(_method->code + pc);
+        auto target = lookup(pc + offset);
+        op_if(type::t_int, cmpop::op_cmple, target);
+        break;
+    }
     case JVM_OPC_if_icmpeq: {
         int16_t offset = read_opc_u2(_method->code + pc);
         auto target = lookup(pc + offset);
@@ -285,6 +580,30 @@ next_insn:
         op_if_cmp(type::t_int, cmpop::op_cmple, target);
         break;
     }
+    case JVM_OPC_if_acmpeq: {
+        int16_t offset = read_opc_u2(_method->code + pc);
+        auto target = lookup(pc + offset);
+        op_if_cmp(type::t_ref, cmpop::op_cmpeq, target);
+        break;
+    }
+    case JVM_OPC_if_acmpne: {
+        int16_t offset = read_opc_u2(_method->code + pc);
+        auto target = lookup(pc + offset);
+        op_if_cmp(type::t_ref, cmpop::op_cmpne, target);
+        break;
+    }
+    case JVM_OPC_ifnull: {
+        int16_t offset = read_opc_u2(_method->code + pc);
+        auto target = lookup(pc + offset);
+        op_if(type::t_ref, cmpop::op_cmpeq, target);
+        break;
+    }
+    case JVM_OPC_ifnonnull: {
+        int16_t offset = read_opc_u2(_method->code + pc);
+        auto target = lookup(pc + offset);
+        op_if(type::t_ref, cmpop::op_cmpne, target);
+        break;
+    }
     case JVM_OPC_goto: {
         int16_t offset = read_opc_u2(_method->code + pc);
         auto target = lookup(pc + offset);
@@ -302,15 +621,35 @@ next_insn:
     case JVM_OPC_invokespecial: {
         uint16_t idx = read_opc_u2(_method->code + pc);
         auto target = _method->klass->resolve_method(idx);
+        assert(target != nullptr);
+        // Calls to superclass methods other than constructors select the
+        // method from the superclass of the current class (JVMS 6.5).
+        auto super = _method->klass->super;
         if (_method->klass->access_flags & JVM_ACC_SUPER
-            && target->klass->is_subclass_of(_method->klass->super)
-            && target->is_init()) {
-           target = target->klass->super->lookup_method(target->name, target->descriptor);
+            && super && super->is_subclass_of(target->klass)
+            && !target->is_init()) {
+           target = super->lookup_method(target->name, target->descriptor);
         }
         assert(target != nullptr);
         op_invokestatic(target.get());
         break;
     }
+    case JVM_OPC_getstatic:
+    case JVM_OPC_putstatic:
+    case JVM_OPC_getfield:
+    case JVM_OPC_putfield: {
+        uint16_t idx = read_opc_u2(_method->code + pc);
+        auto field = _method->klass->resolve_field(idx);
+        assert(field != nullptr);
+        auto t = field_type(field.get());
+        switch (opc) {
+        case JVM_OPC_getstatic: op_getstatic(t, field.get()); break;
+        case JVM_OPC_putstatic: op_putstatic(t, field.get()); break;
+        case JVM_OPC_getfield:  op_getfield(t, field.get());  break;
+        case JVM_OPC_putfield:  op_putfield(t, field.get());  break;
+        }
+        break;
+    }
     case JVM_OPC_invokestatic: {
         uint16_t idx = read_opc_u2(_method->code + pc);
         auto target = _method->klass->resolve_method(idx);
@@ -324,7 +663,10 @@ next_insn:
         break;
     }
     case JVM_OPC_new: {
-        op_new();
+        uint16_t idx = read_opc_u2(_method->code + pc);
+        auto klass = _method->klass->resolve_class(idx);
+        assert(klass != nullptr);
+        op_new(klass.get());
         break;
     }
     case JVM_OPC_arraylength: {
@@ -411,24 +753,52 @@ static bool is_bblock_end(uint8_t opc)
     return is_branch(opc) || is_return(opc) || is_throw(opc);
 }
 
-void translator::scan()
+// Branch target offset of a branch instruction. Switches are not supported.
+static int32_t branch_offset(char* code, uint8_t opc)
 {
-    auto bblock = std::make_shared<basic_block>(0, _method->code_length);
+    switch (opc) {
+    case JVM_OPC_goto_w:
+    case JVM_OPC_jsr_w:
+        return static_cast<int32_t>(read_opc_u2(code) << 16 | read_opc_u2(code + 2));
+    case JVM_OPC_lookupswitch:
+    case JVM_OPC_tableswitch:
+        return 0;
+    default:
+        return static_cast<int16_t>(read_opc_u2(code));
+    }
+}
 
-    _bblock_map.insert({0, bblock});
-    _bblock_list.push_back(bblock);
+//
+// Split the method into basic blocks. Blocks start at the beginning of the
+// method, after every branch, return and throw, and at every branch target.
+//
+void translator::scan()
+{
+    std::set<uint16_t> leaders{0};
 
-    auto pos = bblock->start;
+    uint16_t pos = 0;
 
-    while (pos < bblock->end) {
+    while (pos < _method->code_length) {
         uint8_t opc = _method->code[pos];
+        if (is_branch(opc)) {
+            auto offset = branch_offset(_method->code + pos, opc);
+            if (offset) {
+                leaders.insert(pos + offset);
+            }
+        }
         pos += opcode_length[opc];
-        if (is_bblock_end(opc)) {
-            bblock = bblock->split_at(pos);
-            _bblock_map.insert({pos, bblock});
-            _bblock_list.push_back(bblock);
+        if (is_bblock_end(opc) && pos < _method->code_length) {
+            leaders.insert(pos);
         }
     }
+
+    for (auto it = leaders.begin(); it != leaders.end(); it++) {
+        auto next = std::next(it);
+        auto end = next != leaders.end() ? *next : _method->code_length;
+        auto bblock = std::make_shared<basic_block>(*it, end);
+        _bblock_map.insert({*it, bblock});
+        _bblock_list.push_back(bblock);
+    }
 }
 
 }
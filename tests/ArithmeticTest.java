@@ -1,4 +1,8 @@
 public class ArithmeticTest {
+  static long twice(long x) {
+    return x + x;
+  }
+
   public static void main(String[] args) {
     int i = 1;
     int j = 2;
@@ -23,5 +27,7 @@ public class ArithmeticTest {
     n = l & m;
     n = l | m;
     n = l ^ m;
+    n = twice(l);
+    n = twice(n) * m;
   }
 }
@@ -0,0 +1,34 @@
+public class CodeCacheTest {
+  static int zero;
+
+  // There are no exceptions yet, so a failed check divides by zero.
+  static void check(int actual, int expected) {
+    if (actual != expected)
+      zero = 1 / zero;
+  }
+
+  static int first(int x) {
+    int y = x * 3 + 1;
+    y ^= x * 5 - 7;
+    y += (x & 255) * 9;
+    return y - x;
+  }
+
+  static int second(int x) {
+    return x + 1;
+  }
+
+  // With tiered compilation the tier 1 code of first() is freed at a
+  // safepoint once tier 2 code replaces it, and second() is compiled into
+  // the block afterwards. main() keeps a reference in a local so that it
+  // stays in code with stack maps, where the safepoint can walk its frame.
+  public static void main(String[] args) {
+    Object[] keep = args;
+    int sum = 0;
+    for (int i = 0; i < 100000; i++)
+      sum += first(i);
+    check(sum, 609802656);
+    for (int i = 0; i < 100; i++)
+      check(second(i), i + 1);
+  }
+}
@@ -0,0 +1,22 @@
+public class FibTest {
+  static int zero;
+
+  // There are no exceptions yet, so a failed check divides by zero.
+  static void check(int actual, int expected) {
+    if (actual != expected)
+      zero = 1 / zero;
+  }
+
+  static int fib(int n) {
+    if (n < 2)
+      return n;
+    return fib(n - 1) + fib(n - 2);
+  }
+
+  public static void main(String[] args) {
+    check(fib(0), 0);
+    check(fib(1), 1);
+    check(fib(10), 55);
+    check(fib(25), 75025);
+  }
+}
@@ -0,0 +1,48 @@
+public class FieldTest {
+  static int zero;
+  static int counter;
+
+  int x;
+  int y;
+
+  FieldTest(int x, int y) {
+    this.x = x;
+    this.y = y;
+  }
+
+  // There are no exceptions yet, so a failed check divides by zero.
+  static void check(int actual, int expected) {
+    if (actual != expected)
+      zero = 1 / zero;
+  }
+
+  static void bump(int n) {
+    counter += n;
+  }
+
+  static int sum(FieldTest p) {
+    return p.x + p.y;
+  }
+
+  static void swap(FieldTest p) {
+    int t = p.x;
+    p.x = p.y;
+    p.y = t;
+  }
+
+  public static void main(String[] args) {
+    for (int i = 0; i < 20000; i++)
+      bump(i & 7);
+    check(counter, 70000);
+
+    FieldTest p = new FieldTest(3, 4);
+    check(sum(p), 7);
+    swap(p);
+    check(p.x, 4);
+    check(p.y, 3);
+    for (int i = 0; i < 20000; i++)
+      swap(p);
+    check(p.x, 4);
+    check(p.y, 3);
+  }
+}
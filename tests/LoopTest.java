@@ -0,0 +1,57 @@
+public class LoopTest {
+  static int zero;
+
+  // There are no exceptions yet, so a failed check divides by zero.
+  static void check(int actual, int expected) {
+    if (actual != expected)
+      zero = 1 / zero;
+  }
+
+  static int sum(int n) {
+    int sum = 0;
+    for (int i = 0; i < n; i++)
+      sum += i;
+    return sum;
+  }
+
+  static int nested(int n) {
+    int count = 0;
+    for (int i = 0; i < n; i++)
+      for (int j = i; j < n; j++)
+        count++;
+    return count;
+  }
+
+  static int countDown(int n) {
+    int steps = 0;
+    while (n != 0) {
+      n--;
+      steps += 2;
+    }
+    return steps;
+  }
+
+  static int gcd(int a, int b) {
+    while (b != 0) {
+      int t = a % b;
+      a = b;
+      b = t;
+    }
+    return a;
+  }
+
+  // The operand stack holds the result where the branches join.
+  static int max(int a, int b) {
+    return a > b ? a : b;
+  }
+
+  public static void main(String[] args) {
+    for (int i = 0; i < 20000; i++) {
+      check(max(i & 15, 7), (i & 15) > 7 ? i & 15 : 7);
+      check(sum(100), 4950);
+      check(nested(10), 55);
+      check(countDown(7), 14);
+      check(gcd(1071, 462), 21);
+    }
+  }
+}
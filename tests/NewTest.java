@@ -0,0 +1,53 @@
+public class NewTest {
+  static int zero;
+
+  int value;
+  NewTest next;
+
+  NewTest(int value, NewTest next) {
+    this.value = value;
+    this.next = next;
+  }
+
+  // There are no exceptions yet, so a failed check divides by zero.
+  static void check(int actual, int expected) {
+    if (actual != expected)
+      zero = 1 / zero;
+  }
+
+  static NewTest list(int n) {
+    NewTest head = null;
+    for (int i = 0; i < n; i++)
+      head = new NewTest(i, head);
+    return head;
+  }
+
+  static int length(NewTest list) {
+    int length = 0;
+    while (list != null) {
+      length++;
+      list = list.next;
+    }
+    return length;
+  }
+
+  static int sum(NewTest list) {
+    int sum = 0;
+    while (list != null) {
+      sum += list.value;
+      list = list.next;
+    }
+    return sum;
+  }
+
+  // Allocation blocks are recycled without a collector, so everything the
+  // test allocates has to fit in one block for 'list' to stay intact.
+  public static void main(String[] args) {
+    NewTest list = list(1000);
+    check(length(list), 1000);
+    check(sum(list), 499500);
+    for (int i = 0; i < 2000; i++)
+      check(length(list(10)), 10);
+    check(sum(list), 499500);
+  }
+}
@@ -0,0 +1,24 @@
+public class OsrTest {
+  static int zero;
+
+  // There are no exceptions yet, so a failed check divides by zero.
+  static void check(int actual, int expected) {
+    if (actual != expected)
+      zero = 1 / zero;
+  }
+
+  // The loops run once, so only on-stack replacement gets them out of the
+  // interpreter.
+  public static void main(String[] args) {
+    int sum = 0;
+    for (int i = 0; i < 1000000; i++)
+      sum += i % 7;
+    check(sum, 2999997);
+
+    int count = 0;
+    for (int i = 0; i < 1000; i++)
+      for (int j = 0; j < 1000; j++)
+        count += (i ^ j) & 1;
+    check(count, 500000);
+  }
+}
@@ -14,7 +14,7 @@ object* gc_new_object(klass* klass)
 {
     thread *current = thread::current();
 
-    auto p = current->alloc<object>();
+    auto p = current->alloc<object>(klass->instance_size - sizeof(object));
     if (!p) {
         out_of_memory();
     }
@@ -0,0 +1,370 @@
+#include "hornet/code_cache.hh"
+
+#include "hornet/system_error.hh"
+#include "hornet/compat.hh"
+#include "hornet/os.hh"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cassert>
+#include <cinttypes>
+
+namespace hornet {
+
+size_t reserved_code_cache_size = 64 * 1024 * 1024;
+bool print_code_cache;
+
+static constexpr size_t segment_size = hugepage_size;
+static constexpr size_t chunk_size   = 64 * 1024;
+
+// Every block starts with a header that records its size so that it can be
+// freed.
+static constexpr size_t header_size  = 16;
+static constexpr size_t min_block    = 64;
+
+static size_t align(size_t size)
+{
+    return (size + header_size - 1) & ~(header_size - 1);
+}
+
+// Caches are told apart by generation rather than by address because a
+// new cache can be created at the address of one that was destroyed.
+static std::atomic<uint64_t> next_generation{1};
+
+struct chunk {
+    uint64_t generation;
+    char*    next;
+    char*    end;
+};
+
+static thread_local chunk current_chunk;
+
+static int create_shared_memory(size_t size)
+{
+#ifdef CONFIG_NEED_SHM_OPEN
+    static std::atomic<unsigned int> seq;
+    char name[64];
+    snprintf(name, sizeof(name), "/hornet-code-%d-%u", getpid(), seq++);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        shm_unlink(name);
+    }
+#else
+    int fd = syscall(SYS_memfd_create, "hornet-code", 0);
+#endif
+    if (fd < 0)
+        THROW_ERRNO("shared memory");
+
+    if (ftruncate(fd, size) < 0)
+        THROW_ERRNO("ftruncate");
+
+    return fd;
+}
+
+//
+// Segments are backed by hugetlbfs pages when the system has reserved some.
+// Mapping such memory fails when the reserve is empty, so the caller falls
+// back to create_shared_memory(). Returns -1 where hugetlbfs memory is not
+// available.
+//
+static int create_hugetlb_memory(size_t size)
+{
+#if defined(CONFIG_NEED_SHM_OPEN) || !defined(MFD_HUGETLB)
+    return -1;
+#else
+    int fd = syscall(SYS_memfd_create, "hornet-code", MFD_HUGETLB);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#endif
+}
+
+code_cache::code_cache(size_t capacity)
+    : _generation(next_generation++)
+    , _capacity(capacity)
+    , _exec_base(nullptr)
+    , _nr_segments(0)
+    , _next(nullptr)
+    , _end(nullptr)
+    , _free_bytes(0)
+    , _used_bytes(0)
+    , _nr_allocs(0)
+    , _nr_reused(0)
+    , _nr_frees(0)
+{
+    // Segments are looked up without the lock, so the table never moves.
+    _segments.resize((capacity + segment_size - 1) / segment_size);
+
+    // Reserve the executable range aligned to the segment size.
+    auto size = _segments.size() * segment_size;
+    auto addr = mmap(0, size + segment_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+        THROW_ERRNO("mmap");
+
+    auto start = reinterpret_cast<uintptr_t>(addr);
+    auto base  = (start + segment_size - 1) & ~(segment_size - 1);
+    if (base != start) {
+        munmap(addr, base - start);
+    }
+    munmap(reinterpret_cast<char*>(base) + size, start + segment_size - base);
+
+    _exec_base = reinterpret_cast<char*>(base);
+}
+
+code_cache::~code_cache()
+{
+    if (print_code_cache) {
+        print_stats(stderr);
+    }
+    for (size_t i = 0; i < _nr_segments; i++) {
+        munmap(_segments[i].write, _segments[i].size);
+    }
+    munmap(_exec_base, _segments.size() * segment_size);
+}
+
+bool code_cache::add_segment()
+{
+    auto nr_segments = _nr_segments.load(std::memory_order_relaxed);
+    if (nr_segments == _segments.size()) {
+        return false;
+    }
+
+    auto fd = create_hugetlb_memory(segment_size);
+    auto write = MAP_FAILED;
+    if (fd >= 0) {
+        write = mmap(0, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (write == MAP_FAILED) {
+            close(fd);
+        }
+    }
+    if (write == MAP_FAILED) {
+        fd = create_shared_memory(segment_size);
+        write = mmap(0, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (write == MAP_FAILED)
+            THROW_ERRNO("mmap");
+    }
+
+    auto exec = mmap(_exec_base + nr_segments * segment_size, segment_size, PROT_READ | PROT_EXEC, MAP_SHARED | MAP_FIXED, fd, 0);
+    if (exec == MAP_FAILED)
+        THROW_ERRNO("mmap");
+
+    close(fd);
+
+    // Without hugetlbfs pages, transparent huge pages are best effort for
+    // shared memory.
+    posix_madvise(exec, segment_size, MADV_HUGEPAGE);
+
+    auto& seg = _segments[nr_segments];
+    seg.exec  = static_cast<char*>(exec);
+    seg.write = static_cast<char*>(write);
+    seg.size  = segment_size;
+
+    _nr_segments.store(nr_segments + 1, std::memory_order_release);
+
+    if (_next != _end) {
+        free_block(_next, _end - _next);
+    }
+    _next = seg.exec;
+    _end  = seg.exec + seg.size;
+
+    return true;
+}
+
+code_cache::segment* code_cache::lookup_segment(const void* code)
+{
+    auto addr = static_cast<const char*>(code);
+    auto nr_segments = _nr_segments.load(std::memory_order_acquire);
+
+    if (addr < _exec_base) {
+        return nullptr;
+    }
+    auto idx = static_cast<size_t>(addr - _exec_base) / segment_size;
+    if (idx >= nr_segments) {
+        return nullptr;
+    }
+    return &_segments[idx];
+}
+
+void* code_cache::writable(void* code)
+{
+    auto* seg = lookup_segment(code);
+    assert(seg != nullptr);
+    return seg->write + (static_cast<char*>(code) - seg->exec);
+}
+
+// Carve a block out of the current segment. Called with the lock held.
+char* code_cache::alloc_segment(size_t size)
+{
+    if (size > segment_size) {
+        return nullptr;
+    }
+    if (_next + size > _end && !add_segment()) {
+        return nullptr;
+    }
+    auto block = _next;
+    _next += size;
+    return block;
+}
+
+// Reuse the smallest free block that fits. Called with the lock held.
+char* code_cache::alloc_free(size_t size)
+{
+    auto it = _free_list.lower_bound(size);
+    if (it == _free_list.end()) {
+        return nullptr;
+    }
+    auto block_size = it->first;
+    auto block = it->second;
+    _free_list.erase(it);
+    _free_blocks.erase(block);
+    _free_bytes -= block_size;
+
+    if (block_size - size >= min_block) {
+        free_block(block + size, block_size - size);
+    } else {
+        size = block_size;
+    }
+    set_size(block, size);
+    return block;
+}
+
+// Remove a block that is known to be free from the free list. Called with
+// the lock held.
+void code_cache::unlink_free(char* block, size_t size)
+{
+    auto range = _free_list.equal_range(size);
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second == block) {
+            _free_list.erase(it);
+            break;
+        }
+    }
+    _free_blocks.erase(block);
+    _free_bytes -= size;
+}
+
+// Put a block on the free list, merged with the free blocks next to it in
+// the same segment. Called with the lock held.
+void code_cache::free_block(char* block, size_t size)
+{
+    auto segment_of = [this](const char* addr) {
+        return static_cast<size_t>(addr - _exec_base) / segment_size;
+    };
+
+    auto next = _free_blocks.find(block + size);
+    if (next != _free_blocks.end() && segment_of(next->first) == segment_of(block)) {
+        auto next_size = next->second;
+        unlink_free(next->first, next_size);
+        size += next_size;
+    }
+    auto prev = _free_blocks.lower_bound(block);
+    if (prev != _free_blocks.begin()) {
+        prev--;
+        if (prev->first + prev->second == block && segment_of(prev->first) == segment_of(block)) {
+            auto prev_block = prev->first;
+            auto prev_size = prev->second;
+            unlink_free(prev_block, prev_size);
+            block = prev_block;
+            size += prev_size;
+        }
+    }
+    if (size < min_block) {
+        return;
+    }
+    _free_list.insert(std::make_pair(size, block));
+    _free_blocks.insert(std::make_pair(block, size));
+    _free_bytes += size;
+}
+
+void code_cache::set_size(char* block, size_t size)
+{
+    *static_cast<size_t*>(writable(block)) = size;
+}
+
+void* code_cache::alloc(size_t size)
+{
+    size = align(size + header_size);
+
+    char* block = nullptr;
+
+    if (_free_bytes.load(std::memory_order_relaxed) >= size) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        block = alloc_free(size);
+        if (block) {
+            _nr_reused++;
+        }
+    }
+
+    auto& chunk = current_chunk;
+    if (!block && size <= chunk_size / 4) {
+        if (chunk.generation != _generation || chunk.next + size > chunk.end) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto* next = alloc_segment(chunk_size);
+            if (!next) {
+                return nullptr;
+            }
+            if (chunk.generation == _generation) {
+                free_block(chunk.next, chunk.end - chunk.next);
+            }
+            chunk.generation = _generation;
+            chunk.next  = next;
+            chunk.end   = next + chunk_size;
+        }
+        block = chunk.next;
+        chunk.next += size;
+        set_size(block, size);
+    } else if (!block) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        block = alloc_segment(size);
+        if (!block) {
+            return nullptr;
+        }
+        set_size(block, size);
+    }
+
+    _used_bytes += size;
+    _nr_allocs++;
+
+    return block + header_size;
+}
+
+size_t code_cache::size(const void* code)
+{
+    auto block = static_cast<const char*>(code) - header_size;
+
+    return *reinterpret_cast<const size_t*>(block) - header_size;
+}
+
+void code_cache::free(void* code)
+{
+    auto block = static_cast<char*>(code) - header_size;
+    auto size = *reinterpret_cast<size_t*>(block);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    free_block(block, size);
+    _used_bytes -= size;
+    _nr_frees++;
+}
+
+void code_cache::print_stats(FILE* out)
+{
+    auto nr_segments = _nr_segments.load();
+
+    fprintf(out, "Code cache:\n");
+    fprintf(out, "  capacity     %zu KiB\n", _capacity / 1024);
+    fprintf(out, "  segments     %zu (%zu KiB)\n", nr_segments, nr_segments * segment_size / 1024);
+    fprintf(out, "  used         %zu KiB\n", _used_bytes.load() / 1024);
+    fprintf(out, "  free list    %zu KiB\n", _free_bytes.load() / 1024);
+    fprintf(out, "  allocations  %" PRIu64 " (%" PRIu64 " from free list)\n", _nr_allocs.load(), _nr_reused.load());
+    fprintf(out, "  frees        %" PRIu64 "\n", _nr_frees.load());
+}
+
+}
@@ -3,6 +3,10 @@
 namespace hornet {
 
 field::field()
+    : klass(nullptr)
+    , value(0)
+    , offset(0)
+    , access_flags(0)
 {
 }
 
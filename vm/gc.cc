@@ -5,6 +5,8 @@
 #include "hornet/os.hh"
 
 #include <sys/mman.h>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <memory>
 #include <vector>
@@ -32,8 +34,10 @@ memory_block::memory_block(size_t size)
 
 memory_block::~memory_block()
 {
-    if (munmap(_addr, _size) < 0)
-        THROW_ERRNO("munmap");
+    if (munmap(_addr, _size) < 0) {
+        perror("munmap");
+        abort();
+    }
 }
 
 void memory_block::reset()
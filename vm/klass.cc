@@ -2,12 +2,15 @@
 
 #include "hornet/java.hh"
 
+#include <classfile_constants.h>
 #include <string>
 
 namespace hornet {
 
 klass::klass(loader *loader, std::shared_ptr<constant_pool> const_pool)
     : object(nullptr)
+    , instance_size(sizeof(struct object))
+    , hash(0)
     , _const_pool(const_pool)
     , _loader(loader)
 {
@@ -27,6 +30,21 @@ void klass::add(std::shared_ptr<method> method)
     _methods.push_back(method);
 }
 
+// Lay out instance fields after the fields of the superclass. Every field
+// takes one value slot.
+void klass::layout_fields()
+{
+    instance_size = super ? super->instance_size : sizeof(struct object);
+
+    for (auto field : _fields) {
+        if (field->access_flags & JVM_ACC_STATIC) {
+            continue;
+        }
+        field->offset = instance_size;
+        instance_size += sizeof(value_t);
+    }
+}
+
 std::shared_ptr<field> klass::lookup_field(std::string name, std::string descriptor)
 {
     klass* klass = this;
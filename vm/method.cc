@@ -1,19 +1,83 @@
 #include <hornet/vm.hh>
 
+#include <classfile_constants.h>
+
+#include <vector>
+
 namespace hornet {
 
 method::method()
+    : entry_point(nullptr)
+    , data(nullptr)
+    , tier(0)
+    , compiled(nullptr)
+    , osr(nullptr)
 {
 }
 
 method::~method()
 {
+    delete data.load();
     delete[] code;
 }
 
+method_data* method::alloc_profile()
+{
+    auto* data = new method_data(this);
+    method_data* expected = nullptr;
+    if (!this->data.compare_exchange_strong(expected, data, std::memory_order_acq_rel)) {
+        delete data;
+        return expected;
+    }
+    return data;
+}
+
 bool method::matches(std::string n, std::string d)
 {
     return name == n && descriptor == d;
 }
 
+bool method::is_static() const
+{
+    return access_flags & JVM_ACC_STATIC;
+}
+
+void method::spread_wide_args(value_t* locals) const
+{
+    std::vector<uint16_t> slots;
+    uint16_t slot = 0;
+
+    if (!is_static()) {
+        slots.push_back(slot++);
+    }
+    for (size_t pos = 1; descriptor[pos] != ')'; pos++) {
+        slots.push_back(slot);
+        switch (descriptor[pos]) {
+        case 'J':
+        case 'D':
+            slot += 2;
+            break;
+        case '[':
+            while (descriptor[pos] == '[')
+                pos++;
+            if (descriptor[pos] == 'L')
+                pos = descriptor.find(';', pos);
+            slot++;
+            break;
+        case 'L':
+            pos = descriptor.find(';', pos);
+            slot++;
+            break;
+        default:
+            slot++;
+            break;
+        }
+    }
+
+    // Arguments only ever move upwards so walk them from last to first.
+    for (auto i = args_count; i-- > 0; ) {
+        locals[slots[i]] = locals[i];
+    }
+}
+
 }
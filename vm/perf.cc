@@ -0,0 +1,222 @@
+#include "hornet/perf.hh"
+
+#include "hornet/system_error.hh"
+#include "hornet/vm.hh"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+
+namespace hornet {
+
+bool perf_map;
+bool perf_jitdump;
+
+//
+// The jitdump format is described in
+// tools/perf/Documentation/jitdump-specification.txt of the Linux tree.
+//
+static constexpr uint32_t jitdump_magic   = 0x4A695444;
+static constexpr uint32_t jitdump_version = 1;
+static constexpr uint32_t elf_mach_x86_64 = 62;
+
+enum jitdump_record_type : uint32_t {
+    jit_code_load       = 0,
+    jit_code_debug_info = 2,
+};
+
+struct jitdump_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct jitdump_record {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jitdump_code_load {
+    jitdump_record record;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+struct jitdump_debug_info {
+    jitdump_record record;
+    uint64_t code_addr;
+    uint64_t nr_entry;
+};
+
+struct jitdump_debug_entry {
+    uint64_t addr;
+    uint32_t lineno;
+    uint32_t discrim;
+};
+
+static std::mutex perf_mutex;
+static FILE* map_file;
+static FILE* jitdump_file;
+static uint64_t code_index;
+
+std::string perf_symbol(const method* method)
+{
+    return method->klass->name + "." + method->name + method->descriptor;
+}
+
+std::string perf_source(const method* method)
+{
+    return method->klass->name;
+}
+
+// perf samples are timestamped with the monotonic clock when recorded with
+// 'perf record -k mono'.
+static uint64_t timestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t current_tid()
+{
+#ifdef SYS_gettid
+    return syscall(SYS_gettid);
+#else
+    return getpid();
+#endif
+}
+
+static FILE* open_map()
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+    auto* file = fopen(path, "w");
+    if (!file)
+        THROW_ERRNO("fopen");
+    return file;
+}
+
+static FILE* open_jitdump()
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+    auto fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0)
+        THROW_ERRNO("open");
+
+    auto* file = fdopen(fd, "w+");
+    if (!file)
+        THROW_ERRNO("fdopen");
+
+    jitdump_header header = {};
+    header.magic      = jitdump_magic;
+    header.version    = jitdump_version;
+    header.total_size = sizeof(header);
+    header.elf_mach   = elf_mach_x86_64;
+    header.pid        = getpid();
+    header.timestamp  = timestamp();
+    fwrite(&header, sizeof(header), 1, file);
+    fflush(file);
+
+    // perf finds the dump through an executable mapping of it that shows up
+    // in the recorded mmap events. The mapping stays until exit.
+    auto marker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if (marker == MAP_FAILED)
+        THROW_ERRNO("mmap");
+
+    return file;
+}
+
+// Filename of a debug entry that refers to the same file as the one before.
+static const char same_filename[] = "\xff";
+
+//
+// The debug info of code has to precede its load record. Only the first
+// entry spells out the filename; the rest refer back to it.
+//
+static void write_debug_info(const std::string& source, const void* code, const std::vector<perf_line>& lines)
+{
+    jitdump_debug_info info = {};
+    info.record.id         = jit_code_debug_info;
+    info.record.total_size = sizeof(info) + lines.size() * (sizeof(jitdump_debug_entry) + sizeof(same_filename))
+                           + source.size() + 1 - sizeof(same_filename);
+    info.record.timestamp  = timestamp();
+    info.code_addr         = reinterpret_cast<uintptr_t>(code);
+    info.nr_entry          = lines.size();
+    fwrite(&info, sizeof(info), 1, jitdump_file);
+
+    for (auto& line : lines) {
+        jitdump_debug_entry entry = {};
+        entry.addr   = reinterpret_cast<uintptr_t>(line.addr);
+        entry.lineno = line.bci + 1;
+        fwrite(&entry, sizeof(entry), 1, jitdump_file);
+        if (&line == &lines.front()) {
+            fwrite(source.c_str(), source.size() + 1, 1, jitdump_file);
+        } else {
+            fwrite(same_filename, sizeof(same_filename), 1, jitdump_file);
+        }
+    }
+}
+
+static void write_code_load(const std::string& name, const void* code, size_t size)
+{
+    jitdump_code_load load = {};
+    load.record.id         = jit_code_load;
+    load.record.total_size = sizeof(load) + name.size() + 1 + size;
+    load.record.timestamp  = timestamp();
+    load.pid               = getpid();
+    load.tid               = current_tid();
+    load.vma               = reinterpret_cast<uintptr_t>(code);
+    load.code_addr         = reinterpret_cast<uintptr_t>(code);
+    load.code_size         = size;
+    load.code_index        = code_index++;
+    fwrite(&load, sizeof(load), 1, jitdump_file);
+    fwrite(name.c_str(), name.size() + 1, 1, jitdump_file);
+    fwrite(code, size, 1, jitdump_file);
+}
+
+void perf_register_code(const std::string& name, const void* code, size_t size,
+                        const std::string& source, const std::vector<perf_line>& lines)
+{
+    if (!perf_map && !perf_jitdump) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(perf_mutex);
+
+    if (perf_map) {
+        if (!map_file) {
+            map_file = open_map();
+        }
+        fprintf(map_file, "%lx %zx %s\n", reinterpret_cast<unsigned long>(code), size, name.c_str());
+        fflush(map_file);
+    }
+
+    if (perf_jitdump) {
+        if (!jitdump_file) {
+            jitdump_file = open_jitdump();
+        }
+        if (!lines.empty()) {
+            write_debug_info(source, code, lines);
+        }
+        write_code_load(name, code, size);
+        fflush(jitdump_file);
+    }
+}
+
+}
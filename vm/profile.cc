@@ -0,0 +1,117 @@
+#include <hornet/vm.hh>
+
+#include <hornet/java.hh>
+
+#include <classfile_constants.h>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+namespace hornet {
+
+bool print_method_data;
+
+static bool is_conditional_branch(uint8_t opc)
+{
+    switch (opc) {
+    case JVM_OPC_ifeq:
+    case JVM_OPC_ifne:
+    case JVM_OPC_iflt:
+    case JVM_OPC_ifge:
+    case JVM_OPC_ifgt:
+    case JVM_OPC_ifle:
+    case JVM_OPC_if_icmpeq:
+    case JVM_OPC_if_icmpne:
+    case JVM_OPC_if_icmplt:
+    case JVM_OPC_if_icmpge:
+    case JVM_OPC_if_icmpgt:
+    case JVM_OPC_if_icmple:
+    case JVM_OPC_if_acmpeq:
+    case JVM_OPC_if_acmpne:
+    case JVM_OPC_ifnull:
+    case JVM_OPC_ifnonnull:
+        return true;
+    default:
+        return false;
+    }
+}
+
+method_data::method_data(const method* method)
+    : invocation_count(0)
+    , backedge_count(0)
+{
+    uint32_t pos = 0;
+
+    while (pos < method->code_length) {
+        uint8_t opc = method->code[pos];
+        uint16_t bci = pos;
+        if (is_conditional_branch(opc) || opc == JVM_OPC_goto || opc == JVM_OPC_goto_w) {
+            branches.push_back(branch_counter{bci, 0, 0});
+        }
+        if (opc == JVM_OPC_arraylength) {
+            array_lengths.push_back(array_length_range{bci, 0, 0, 0});
+        }
+        pos += opcode_length[opc];
+    }
+}
+
+template<typename T>
+static T* lookup_site(std::vector<T>& sites, uint16_t bci)
+{
+    auto it = std::lower_bound(sites.begin(), sites.end(), bci,
+        [](const T& site, uint16_t bci) {
+            return site.bci < bci;
+        });
+    if (it == sites.end() || it->bci != bci) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+branch_counter* method_data::lookup_branch(uint16_t bci)
+{
+    return lookup_site(branches, bci);
+}
+
+array_length_range* method_data::lookup_array_length(uint16_t bci)
+{
+    return lookup_site(array_lengths, bci);
+}
+
+void method_data::print(FILE* out) const
+{
+    fprintf(out, "  invocations %" PRIu64 ", back-edges %" PRIu64 "\n", invocation_count, backedge_count);
+
+    for (auto& branch : branches) {
+        fprintf(out, "  %5u  branch        taken %" PRIu64 ", not taken %" PRIu64 "\n",
+            branch.bci, branch.taken, branch.not_taken);
+    }
+    for (auto& range : array_lengths) {
+        if (!range.count) {
+            fprintf(out, "  %5u  array length  -\n", range.bci);
+            continue;
+        }
+        fprintf(out, "  %5u  array length  [%u, %u] in %" PRIu64 " accesses\n",
+            range.bci, range.min, range.max, range.count);
+    }
+}
+
+void method_data_stats()
+{
+    if (!print_method_data) {
+        return;
+    }
+    fprintf(stderr, "Method data:\n");
+    _jvm->for_each_klass([](klass* klass) {
+        for (auto method : klass->methods()) {
+            auto* data = method->data.load();
+            if (!data) {
+                continue;
+            }
+            fprintf(stderr, "%s.%s%s\n", klass->name.c_str(), method->name.c_str(), method->descriptor.c_str());
+            data->print(stderr);
+        }
+    });
+}
+
+}
@@ -0,0 +1,409 @@
+#include "hornet/safepoint.hh"
+
+#include "hornet/system_error.hh"
+#include "hornet/compat.hh"
+#include "hornet/vm.hh"
+
+#include <sys/mman.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <thread>
+
+namespace hornet {
+
+struct code_stack_maps {
+    size_t size;
+    std::map<const void*, stack_map> maps;
+};
+
+static std::map<const void*, code_stack_maps> stack_maps;
+static std::mutex stack_map_mutex;
+
+static char* poll_page;
+static size_t poll_page_size;
+static struct sigaction prev_action;
+
+std::atomic<bool> safepoint_pending;
+
+unsigned int guaranteed_safepoint_interval;
+bool print_safepoint_statistics;
+
+// The parked thread, and its context at the poll if it is parked in
+// compiled code or nullptr if it is parked in the interpreter.
+static std::atomic<bool> parked;
+static thread* parked_thread;
+static ucontext_t* parked_context;
+
+#ifdef __APPLE__
+static uint64_t* context_reg(ucontext_t* uc, uint8_t reg)
+{
+    auto& ss = uc->uc_mcontext->__ss;
+    uint64_t* regs[] = {
+        &ss.__rax, &ss.__rcx, &ss.__rdx, &ss.__rbx, &ss.__rsp, &ss.__rbp, &ss.__rsi, &ss.__rdi,
+        &ss.__r8,  &ss.__r9,  &ss.__r10, &ss.__r11, &ss.__r12, &ss.__r13, &ss.__r14, &ss.__r15,
+    };
+    return regs[reg];
+}
+
+static void* context_pc(ucontext_t* uc)
+{
+    return reinterpret_cast<void*>(uc->uc_mcontext->__ss.__rip);
+}
+#else
+static uint64_t* context_reg(ucontext_t* uc, uint8_t reg)
+{
+    static const int gregs[] = {
+        REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+        REG_R8,  REG_R9,  REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+    };
+    return reinterpret_cast<uint64_t*>(&uc->uc_mcontext.gregs[gregs[reg]]);
+}
+
+static void* context_pc(ucontext_t* uc)
+{
+    return reinterpret_cast<void*>(uc->uc_mcontext.gregs[REG_RIP]);
+}
+#endif
+
+static constexpr uint8_t reg_rbp = 5;
+
+static void park(ucontext_t* context)
+{
+    parked_thread = thread::current();
+    parked_context = context;
+    parked.store(true, std::memory_order_release);
+
+    struct timespec ts = { 0, 100000 };
+    while (safepoint_pending.load(std::memory_order_acquire)) {
+        nanosleep(&ts, nullptr);
+    }
+
+    parked.store(false, std::memory_order_release);
+}
+
+// Park a thread that faulted on the poll page until the safepoint is
+// disarmed, and then let the poll run again. Any other fault goes to the
+// handler that was installed before.
+static void poll_handler(int signo, siginfo_t* info, void* context)
+{
+    auto addr = static_cast<char*>(info->si_addr);
+    if (addr < poll_page || addr >= poll_page + poll_page_size) {
+        sigaction(signo, &prev_action, nullptr);
+        return;
+    }
+
+    park(static_cast<ucontext_t*>(context));
+}
+
+void safepoint_block()
+{
+    park(nullptr);
+}
+
+static char* init_poll_page()
+{
+    poll_page_size = sysconf(_SC_PAGESIZE);
+
+    auto addr = mmap(0, poll_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        THROW_ERRNO("mmap");
+
+    poll_page = static_cast<char*>(addr);
+
+    struct sigaction action = {};
+    action.sa_sigaction = poll_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+#ifdef __APPLE__
+    // Protection faults raise SIGBUS on Darwin.
+    if (sigaction(SIGBUS, &action, &prev_action) < 0)
+        THROW_ERRNO("sigaction");
+#else
+    if (sigaction(SIGSEGV, &action, &prev_action) < 0)
+        THROW_ERRNO("sigaction");
+#endif
+    return poll_page;
+}
+
+char* safepoint_poll_page()
+{
+    static char* page = init_poll_page();
+
+    return page;
+}
+
+void register_stack_maps(const void* code, size_t size, std::map<const void*, stack_map> maps)
+{
+    std::lock_guard<std::mutex> lock(stack_map_mutex);
+
+    stack_maps[code] = code_stack_maps{size, std::move(maps)};
+}
+
+void unregister_stack_maps(const void* code)
+{
+    std::lock_guard<std::mutex> lock(stack_map_mutex);
+
+    stack_maps.erase(code);
+}
+
+// The code that contains 'pc'. Called with stack_map_mutex held.
+static std::map<const void*, code_stack_maps>::iterator lookup_code(const void* pc)
+{
+    auto it = stack_maps.upper_bound(pc);
+    if (it == stack_maps.begin()) {
+        return stack_maps.end();
+    }
+    it--;
+    if (static_cast<const char*>(pc) >= static_cast<const char*>(it->first) + it->second.size) {
+        return stack_maps.end();
+    }
+    return it;
+}
+
+const stack_map* lookup_stack_map(const void* pc)
+{
+    std::lock_guard<std::mutex> lock(stack_map_mutex);
+
+    auto it = lookup_code(pc);
+    if (it == stack_maps.end()) {
+        return nullptr;
+    }
+    auto map = it->second.maps.find(pc);
+    if (map == it->second.maps.end()) {
+        return nullptr;
+    }
+    return &map->second;
+}
+
+void safepoint_arm()
+{
+    safepoint_pending.store(true, std::memory_order_release);
+
+    if (mprotect(safepoint_poll_page(), poll_page_size, PROT_NONE) < 0)
+        THROW_ERRNO("mprotect");
+}
+
+void safepoint_disarm()
+{
+    if (mprotect(safepoint_poll_page(), poll_page_size, PROT_READ) < 0)
+        THROW_ERRNO("mprotect");
+
+    safepoint_pending.store(false, std::memory_order_release);
+}
+
+bool safepoint_reached()
+{
+    return parked.load(std::memory_order_acquire);
+}
+
+// Visit the compiled frames that called the frame at 'fp', up to the first
+// one whose return address has no stack map. That is the i2c adapter or the
+// interpreter that entered compiled code.
+static void walk_callers(char* fp, const std::function<void(const void*, char*, const stack_map*)>& visit)
+{
+    for (;;) {
+        auto* pc = *reinterpret_cast<void**>(fp + 8);
+        fp = *reinterpret_cast<char**>(fp);
+        auto* map = lookup_stack_map(pc);
+        if (!map) {
+            return;
+        }
+        visit(pc, fp, map);
+    }
+}
+
+//
+// Visit the compiled frames of the parked thread with their pc, frame
+// pointer and stack map: the parked frame, if the thread is parked in
+// compiled code, first. Returns false if the thread runs code that has no
+// stack maps.
+//
+static bool walk_frames(const std::function<void(const void*, char*, const stack_map*)>& visit)
+{
+    assert(parked.load(std::memory_order_acquire));
+
+    if (parked_context) {
+        auto* uc = parked_context;
+        auto* map = lookup_stack_map(context_pc(uc));
+        if (!map) {
+            return false;
+        }
+        auto fp = reinterpret_cast<char*>(*context_reg(uc, reg_rbp));
+        visit(context_pc(uc), fp, map);
+        walk_callers(fp, visit);
+    }
+
+    for (auto* anchor = parked_thread->anchor; anchor; anchor = anchor->prev) {
+        if (!anchor->fp) {
+            return false;
+        }
+        walk_callers(static_cast<char*>(anchor->fp), visit);
+    }
+    return true;
+}
+
+bool safepoint_visit_roots(const std::function<void(object**)>& visit,
+                           const std::function<void(uint64_t*)>& visit_ambiguous)
+{
+    assert(parked.load(std::memory_order_acquire));
+
+    auto& stack = parked_thread->stack;
+    for (auto* slot = stack.base(); slot < stack.top(); slot++) {
+        visit_ambiguous(slot);
+    }
+
+    // Only the parked frame has references in registers. Calls clobber
+    // them.
+    auto* parked_pc = parked_context ? context_pc(parked_context) : nullptr;
+    return walk_frames([&](const void* pc, char* fp, const stack_map* map) {
+        if (pc == parked_pc) {
+            for (auto reg : map->regs) {
+                visit(reinterpret_cast<object**>(context_reg(parked_context, reg)));
+            }
+        } else {
+            assert(map->regs.empty());
+        }
+        for (auto slot : map->slots) {
+            visit(reinterpret_cast<object**>(fp + slot));
+        }
+    });
+}
+
+bool safepoint_visit_code(const std::function<void(const void*)>& visit)
+{
+    return walk_frames([&](const void* pc, char*, const stack_map*) {
+        const void* code;
+        {
+            std::lock_guard<std::mutex> lock(stack_map_mutex);
+            code = lookup_code(pc)->first;
+        }
+        visit(code);
+    });
+}
+
+static std::thread safepoint_thread;
+static std::mutex safepoint_mutex;
+static std::condition_variable safepoint_cv;
+static bool safepoint_shutdown;
+static bool safepoint_requested;
+static std::vector<std::function<void()>> safepoint_operations;
+
+static uint64_t nr_safepoints;
+static uint64_t nr_incomplete;
+static uint64_t nr_roots;
+static uint64_t nr_ambiguous_roots;
+
+// A precise root is null or points to an object, which has a class.
+static void verify_root(object** root)
+{
+    auto* obj = *root;
+    if (obj && !obj->klass) {
+        fprintf(stderr, "error: safepoint: %p does not point to an object\n", static_cast<void*>(root));
+        abort();
+    }
+    nr_roots++;
+}
+
+//
+// The VM thread waits for the Java thread to park for as long as it takes.
+// A thread that is blocked outside Java code delays the safepoint until it
+// returns to Java code or the VM shuts down.
+//
+// The operations run without the lock, so that they can wait for threads
+// that request a safepoint.
+//
+static void safepoint_loop()
+{
+    auto interval = std::chrono::milliseconds(guaranteed_safepoint_interval);
+    auto wake = [] { return safepoint_shutdown || safepoint_requested; };
+
+    std::unique_lock<std::mutex> lock(safepoint_mutex);
+    for (;;) {
+        if (guaranteed_safepoint_interval) {
+            safepoint_cv.wait_for(lock, interval, wake);
+        } else {
+            safepoint_cv.wait(lock, wake);
+        }
+        if (safepoint_shutdown) {
+            return;
+        }
+        safepoint_requested = false;
+        safepoint_arm();
+        while (!safepoint_reached() && !safepoint_shutdown) {
+            safepoint_cv.wait_for(lock, std::chrono::microseconds(100));
+        }
+        if (safepoint_reached()) {
+            lock.unlock();
+            nr_safepoints++;
+            if (!safepoint_visit_roots(verify_root, [](uint64_t*) { nr_ambiguous_roots++; })) {
+                nr_incomplete++;
+            }
+            for (auto& operation : safepoint_operations) {
+                operation();
+            }
+            lock.lock();
+        }
+        safepoint_disarm();
+        // Let the thread leave the poll before the next safepoint, or that
+        // one would be reached at the same poll without the thread moving.
+        while (safepoint_reached() && !safepoint_shutdown) {
+            safepoint_cv.wait_for(lock, std::chrono::microseconds(100));
+        }
+    }
+}
+
+void safepoint_add_operation(std::function<void()> operation)
+{
+    safepoint_operations.push_back(std::move(operation));
+}
+
+void safepoint_request()
+{
+    {
+        std::lock_guard<std::mutex> lock(safepoint_mutex);
+        safepoint_requested = true;
+    }
+    safepoint_cv.notify_all();
+}
+
+void safepoint_start()
+{
+    if (!guaranteed_safepoint_interval && safepoint_operations.empty()) {
+        return;
+    }
+    safepoint_thread = std::thread(safepoint_loop);
+}
+
+void safepoint_stop()
+{
+    if (!safepoint_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(safepoint_mutex);
+        safepoint_shutdown = true;
+    }
+    safepoint_cv.notify_all();
+    safepoint_thread.join();
+}
+
+void safepoint_stats()
+{
+    if (!print_safepoint_statistics) {
+        return;
+    }
+    fprintf(stderr, "Safepoints: %" PRIu64 " (%" PRIu64 " with incomplete roots)\n", nr_safepoints, nr_incomplete);
+    fprintf(stderr, "Roots:      %" PRIu64 " precise, %" PRIu64 " ambiguous\n", nr_roots, nr_ambiguous_roots);
+}
+
+}
@@ -1,11 +1,50 @@
 #include "hornet/vm.hh"
 
+#include "hornet/system_error.hh"
+#include "hornet/compat.hh"
 #include "hornet/gc.hh"
 
+#include <sys/mman.h>
+#include <cstdio>
+#include <cstdlib>
+
 namespace hornet {
 
+java_stack::java_stack(size_t size)
+{
+    constexpr int mmap_prot  = PROT_READ   | PROT_WRITE;
+    constexpr int mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    auto addr = mmap(0, size, mmap_prot, mmap_flags, -1, 0);
+
+    if (addr == MAP_FAILED)
+        THROW_ERRNO("mmap");
+
+    _base = _top = reinterpret_cast<value_t *>(addr);
+    _end  = _base + size / sizeof(value_t);
+}
+
+java_stack::~java_stack()
+{
+    if (munmap(_base, (_end - _base) * sizeof(value_t)) < 0) {
+        perror("munmap");
+        abort();
+    }
+}
+
+void java_stack::overflow()
+{
+    fprintf(stderr, "error: java stack overflow\n");
+    abort();
+}
+
 thread::thread()
-    : _alloc_buffer(memory_block::get())
+    : stack(java_stack_size)
+    , block_on_compilation(true)
+    , last_compiled_fp(nullptr)
+    , anchor(nullptr)
+    , _alloc_buffer(memory_block::get())
+    , _nr_attached(0)
 {
 }
 